@@ -0,0 +1,111 @@
+#!/bin/bash
+# ./scaling.sh [tamanho_base] [máscara]
+# Escalabilidade forte (mesma imagem para 1..N tarefas) e fraca (altura da
+# imagem proporcional ao número de tarefas) das versões OpenMP e MPI, com
+# imagens sintéticas de bin/bmpgen. Variáveis de ambiente:
+#   MAX_TASKS  maior número de threads / processos (padrão: número de CPUs)
+#   REPS       execuções por ponto (padrão: 3)
+#   ENTROPY    bits aleatórios por canal das imagens (padrão: 4)
+#   MPIRUN     comando do mpirun (padrão: mpirun)
+
+BASE_SIZE=${1:-2048}
+MASK=${2:-3}
+MAX_TASKS=${MAX_TASKS:-$(nproc)}
+REPS=${REPS:-3}
+ENTROPY=${ENTROPY:-4}
+MPIRUN=${MPIRUN:-mpirun}
+OUTPUT_DIR="output"
+CSV_FILE="scaling_metrics.csv"
+
+# awk e printf com ponto decimal
+export LC_NUMERIC=C
+
+if [ ! -x ./bin/bmpgen ] || [ ! -x ./bin/openmp_version ] || [ ! -x ./bin/mpi_version ]; then
+    echo "Compile antes: make all"
+    exit 1
+fi
+
+# Mesmas colunas de performance_metrics.csv, mais escala, imagem, speedup e eficiência
+echo "Modelo,Máscara,Tarefas,Tempo Médio (s),Escala,Imagem,Speedup,Eficiência" > $CSV_FILE
+
+# 1 2 4 ... até MAX_TASKS (incluído)
+task_counts() {
+    local n=1
+    while [ $n -lt $MAX_TASKS ]; do
+        echo $n
+        n=$((n * 2))
+    done
+    echo $MAX_TASKS
+}
+
+# Gera (uma vez) a imagem sintética <largura>x<altura> e imprime o caminho
+synthetic_image() {
+    local file="$OUTPUT_DIR/scaling_${1}x${2}.bmp"
+    if [ ! -f "$file" ]; then
+        ./bin/bmpgen $1 $2 "$file" $ENTROPY > /dev/null || exit 1
+    fi
+    echo "$file"
+}
+
+# Tempo médio de REPS execuções de um comando (TEMPO_TOTAL)
+average_time() {
+    local times=""
+    local value
+    for ((i = 0; i < REPS; i++)); do
+        value=$($1 2>&1 | grep "TEMPO_TOTAL" | tail -1 | cut -d'=' -f2)
+        if [ -z "$value" ]; then
+            echo "AVISO: execução sem TEMPO_TOTAL: $1" >&2
+            return 1
+        fi
+        times="$times $value"
+    done
+    echo $times | awk '{ for (i = 1; i <= NF; i++) sum += $i; printf "%.6f", sum / NF }'
+}
+
+# Roda um modelo nos dois tipos de escala
+# Parâmetros: modelo, comando com TASKS e IMAGE no lugar das tarefas e da imagem
+run_model() {
+    local model=$1
+    local template=$2
+    local scale tasks width height image cmd avg base work speedup efficiency
+
+    for scale in forte fraca; do
+        base=""
+        for tasks in $(task_counts); do
+            width=$BASE_SIZE
+            height=$BASE_SIZE
+            if [ $scale = fraca ]; then
+                height=$((BASE_SIZE * tasks))
+            fi
+            image=$(synthetic_image $width $height)
+            cmd=${template//TASKS/$tasks}
+            cmd=${cmd//IMAGE/$image}
+
+            echo "  $model, escala $scale, $tasks tarefas, ${width}x${height}..." >&2
+            avg=$(average_time "$cmd") || continue
+            if [ -z "$base" ]; then
+                base=$avg
+            fi
+
+            # forte: T1 / Tp; fraca: cada tarefa tem o trabalho de T1, então p * T1 / Tp
+            work=1
+            if [ $scale = fraca ]; then
+                work=$tasks
+            fi
+            read speedup efficiency < <(awk -v t1=$base -v tp=$avg -v p=$tasks -v w=$work \
+                'BEGIN { s = (tp > 0) ? w * t1 / tp : 0; printf "%.3f %.3f", s, s / p }')
+            printf "%s,%dx%d,%d,%s,%s,%dx%d,%s,%s\n" "$model" $MASK $MASK $tasks $avg $scale \
+                $width $height $speedup $efficiency >> $CSV_FILE
+        done
+    done
+}
+
+echo "Testando escalabilidade OpenMP..."
+run_model "OpenMP" "./bin/openmp_version $MASK TASKS IMAGE"
+
+echo "Testando escalabilidade MPI..."
+run_model "MPI" "$MPIRUN -np TASKS ./bin/mpi_version $MASK IMAGE"
+
+echo ""
+echo "Resultados salvos em: $CSV_FILE"
+column -t -s',' $CSV_FILE 2>/dev/null || cat $CSV_FILE
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    int cpu;
+    int package;  // socket
+    int core;     // core id within the socket
+    int thread;   // hardware thread of the core: 0 for the first CPU
+    int rank;     // position of the core among the cores of its socket
+} CpuPlace;
+
+// reads an integer from /sys/devices/system/cpu/cpu<cpu>/topology/<name>
+static int read_topology(int cpu, const char *name, int fallback) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE *file = fopen(path, "r");
+    int value;
+    if (!file) {
+        return fallback;
+    }
+    if (fscanf(file, "%d", &value) != 1) {
+        value = fallback;
+    }
+    fclose(file);
+    return value;
+}
+
+static int compare_close(const void *a, const void *b) {
+    const CpuPlace *p = (const CpuPlace*)a;
+    const CpuPlace *q = (const CpuPlace*)b;
+    if (p->thread != q->thread) {
+        return p->thread - q->thread;
+    }
+    if (p->package != q->package) {
+        return p->package - q->package;
+    }
+    if (p->rank != q->rank) {
+        return p->rank - q->rank;
+    }
+    return p->cpu - q->cpu;
+}
+
+static int compare_spread(const void *a, const void *b) {
+    const CpuPlace *p = (const CpuPlace*)a;
+    const CpuPlace *q = (const CpuPlace*)b;
+    if (p->thread != q->thread) {
+        return p->thread - q->thread;
+    }
+    if (p->rank != q->rank) {
+        return p->rank - q->rank;
+    }
+    if (p->package != q->package) {
+        return p->package - q->package;
+    }
+    return p->cpu - q->cpu;
+}
+
+// allowed CPUs in both orders; count is 0 when the affinity cannot be read
+static int close_order[CPU_SETSIZE];
+static int spread_order[CPU_SETSIZE];
+static int order_count;
+static pthread_once_t order_once = PTHREAD_ONCE_INIT;
+
+static void read_order(void) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+
+    CpuPlace *places = (CpuPlace*)malloc(sizeof(CpuPlace) * CPU_SETSIZE);
+    int count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            places[count].cpu = cpu;
+            places[count].package = read_topology(cpu, "physical_package_id", 0);
+            places[count].core = read_topology(cpu, "core_id", cpu);
+            count++;
+        }
+    }
+
+    // the CPUs are in increasing order: earlier ones sharing a core are
+    // its lower hardware threads
+    for (int i = 0; i < count; i++) {
+        places[i].thread = 0;
+        for (int j = 0; j < i; j++) {
+            if (places[j].package == places[i].package && places[j].core == places[i].core) {
+                places[i].thread++;
+            }
+        }
+    }
+    // rank: cores of the same socket with a lower id, each counted once
+    for (int i = 0; i < count; i++) {
+        places[i].rank = 0;
+        for (int j = 0; j < count; j++) {
+            if (places[j].thread == 0 && places[j].package == places[i].package &&
+                places[j].core < places[i].core) {
+                places[i].rank++;
+            }
+        }
+    }
+
+    qsort(places, count, sizeof(CpuPlace), compare_close);
+    for (int i = 0; i < count; i++) {
+        close_order[i] = places[i].cpu;
+    }
+    qsort(places, count, sizeof(CpuPlace), compare_spread);
+    for (int i = 0; i < count; i++) {
+        spread_order[i] = places[i].cpu;
+    }
+    order_count = count;
+    free(places);
+}
+
+int pin_thread(PinMode mode, int thread) {
+    pthread_once(&order_once, read_order);
+    if (order_count == 0) {
+        return -1;
+    }
+
+    const int *order = (mode == PIN_SPREAD) ? spread_order : close_order;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(order[thread % order_count], &set);
+    return (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) ? 0 : -1;
+}
@@ -0,0 +1,70 @@
+#include "arena.h"
+#include <stdlib.h>
+
+struct ArenaBlock {
+    ArenaBlock *next;
+};
+
+// size rounded up to the allocation alignment
+static size_t align_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+// empty arena
+void arena_init(Arena *a) {
+    a->base = NULL;
+    a->capacity = 0;
+    a->used = 0;
+    a->peak = 0;
+    a->overflow = NULL;
+}
+
+// bumps the main block, or allocates an overflow block when it is full
+void* arena_alloc(Arena *a, size_t size) {
+    size = align_size(size);
+    a->peak += size;
+
+    if (a->used + size <= a->capacity) {
+        void *p = a->base + a->used;
+        a->used += size;
+        return p;
+    }
+
+    // the header is padded to a full alignment unit so the data stays aligned
+    ArenaBlock *block = (ArenaBlock*)aligned_alloc(ARENA_ALIGNMENT, ARENA_ALIGNMENT + size);
+    if (!block) {
+        return NULL;
+    }
+    block->next = a->overflow;
+    a->overflow = block;
+    return (uint8_t*)block + ARENA_ALIGNMENT;
+}
+
+// frees the overflow blocks
+static void free_overflow(Arena *a) {
+    while (a->overflow) {
+        ArenaBlock *next = a->overflow->next;
+        free(a->overflow);
+        a->overflow = next;
+    }
+}
+
+// frees the overflow blocks and regrows the main block to the peak
+void arena_reset(Arena *a) {
+    free_overflow(a);
+
+    if (a->peak > a->capacity) {
+        free(a->base);
+        a->base = (uint8_t*)aligned_alloc(ARENA_ALIGNMENT, a->peak);
+        a->capacity = a->base ? a->peak : 0;
+    }
+    a->used = 0;
+    a->peak = 0;
+}
+
+// frees all memory of the arena
+void arena_free(Arena *a) {
+    free_overflow(a);
+    free(a->base);
+    arena_init(a);
+}
@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+#include "async_batch.h"
+#include "timing.h"
+#include <stdio.h>
+#include <pthread.h>
+
+// one image in flight
+typedef struct {
+    int index;                // position in the list, -1 marks the end of the batch
+    int status;               // 0, or -1 when the image could not be loaded
+    char output_file[4096];
+    ImageFiles files;
+    Arena arena;              // image and scratch buffers of this slot
+} BatchSlot;
+
+// bounded FIFO of slots, blocking on empty (it never fills: there are only
+// ASYNC_BATCH_SLOTS slots)
+typedef struct {
+    BatchSlot *items[ASYNC_BATCH_SLOTS + 1];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} SlotQueue;
+
+static void queue_init(SlotQueue *q) {
+    q->head = 0;
+    q->count = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->ready, NULL);
+}
+
+static void queue_destroy(SlotQueue *q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->ready);
+}
+
+static void queue_push(SlotQueue *q, BatchSlot *slot) {
+    pthread_mutex_lock(&q->lock);
+    q->items[(q->head + q->count) % (ASYNC_BATCH_SLOTS + 1)] = slot;
+    q->count++;
+    pthread_cond_signal(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static BatchSlot* queue_pop(SlotQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        pthread_cond_wait(&q->ready, &q->lock);
+    }
+    BatchSlot *slot = q->items[q->head];
+    q->head = (q->head + 1) % (ASYNC_BATCH_SLOTS + 1);
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+    return slot;
+}
+
+// state shared by the three threads
+typedef struct {
+    const BatchList *list;
+    const char *name;
+    int mask_size;
+    const Options *opts;
+    BatchSlot slots[ASYNC_BATCH_SLOTS];
+    BatchSlot end;            // index -1: no more images
+    SlotQueue free_slots;     // writer -> reader
+    SlotQueue loaded;         // reader -> process
+    SlotQueue processed;      // process -> writer
+} AsyncBatch;
+
+// loads the images in order into free slots
+static void* reader_thread(void *arg) {
+    AsyncBatch *b = (AsyncBatch*)arg;
+
+    for (int i = 0; i < b->list->count; i++) {
+        BatchSlot *slot = queue_pop(&b->free_slots);
+        slot->index = i;
+        output_path(slot->output_file, sizeof(slot->output_file), b->name, b->mask_size,
+                    b->list->paths[i], 1);
+        slot->status = open_image_files(&slot->files, b->list->paths[i], slot->output_file,
+                                        b->opts->io, &slot->arena, NULL, NULL);
+        queue_push(&b->loaded, slot);
+    }
+    queue_push(&b->loaded, &b->end);
+    return NULL;
+}
+
+// saves the processed images and hands their slots back to the reader
+static void* writer_thread(void *arg) {
+    AsyncBatch *b = (AsyncBatch*)arg;
+
+    for (;;) {
+        BatchSlot *slot = queue_pop(&b->processed);
+        if (slot->index < 0) {
+            break;
+        }
+        if (slot->status == 0) {
+            close_image_files(&slot->files, slot->output_file);
+        }
+        // buffers are reused by the next image read into this slot
+        arena_reset(&slot->arena);
+        queue_push(&b->free_slots, slot);
+    }
+    return NULL;
+}
+
+// processes the loaded slots on the calling thread
+int async_batch(const BatchList *list, const char *name, int mask_size, const Options *opts,
+                ImageProcessor process, double *time_spent) {
+    AsyncBatch b;
+    b.list = list;
+    b.name = name;
+    b.mask_size = mask_size;
+    b.opts = opts;
+    b.end.index = -1;
+    queue_init(&b.free_slots);
+    queue_init(&b.loaded);
+    queue_init(&b.processed);
+    for (int i = 0; i < ASYNC_BATCH_SLOTS; i++) {
+        arena_init(&b.slots[i].arena);
+        queue_push(&b.free_slots, &b.slots[i]);
+    }
+
+    pthread_t reader, writer;
+    pthread_create(&reader, NULL, reader_thread, &b);
+    pthread_create(&writer, NULL, writer_thread, &b);
+
+    int failures = 0;
+    *time_spent = 0.0;
+    for (;;) {
+        BatchSlot *slot = queue_pop(&b.loaded);
+        if (slot->index < 0) {
+            break;
+        }
+        printf("[%d/%d] %s -> %s\n", slot->index + 1, list->count, list->paths[slot->index],
+               slot->output_file);
+
+        if (slot->status != 0) {
+            failures++;
+        } else {
+            double start = wall_time();
+            process(slot->files.src, slot->files.dst, mask_size, opts, &slot->arena);
+            // wall clock: clock() would also count the I/O threads
+            double spent = wall_time() - start;
+            TIMING_RECORD(STAGE_TOTAL, 0, spent);
+            *time_spent += spent;
+        }
+        queue_push(&b.processed, slot);
+    }
+    queue_push(&b.processed, &b.end);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    for (int i = 0; i < ASYNC_BATCH_SLOTS; i++) {
+        arena_free(&b.slots[i].arena);
+    }
+    queue_destroy(&b.free_slots);
+    queue_destroy(&b.loaded);
+    queue_destroy(&b.processed);
+    return failures;
+}
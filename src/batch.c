@@ -0,0 +1,270 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// 1 if path is a directory
+static int is_directory(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// 1 if name ends in ".bmp" (any case)
+static int has_bmp_extension(const char *name) {
+    size_t len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".bmp") == 0;
+}
+
+// appends a copy of path to the list
+static void add_path(BatchList *list, int *capacity, const char *path) {
+    if (list->count == *capacity) {
+        *capacity = (*capacity > 0) ? *capacity * 2 : 16;
+        list->paths = (char**)realloc(list->paths, *capacity * sizeof(char*));
+    }
+    list->paths[list->count] = (char*)malloc(strlen(path) + 1);
+    strcpy(list->paths[list->count], path);
+    list->count++;
+}
+
+// helper function for qsort
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// .bmp files of a directory, in name order
+static int directory_inputs(const char *dir_path, BatchList *list, int *capacity) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        printf("Erro ao abrir diretório: %s\n", dir_path);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!has_bmp_extension(entry->d_name)) {
+            continue;
+        }
+        size_t size = strlen(dir_path) + strlen(entry->d_name) + 2;
+        char *path = (char*)malloc(size);
+        snprintf(path, size, "%s/%s", dir_path, entry->d_name);
+        if (!is_directory(path)) {
+            add_path(list, capacity, path);
+        }
+        free(path);
+    }
+    closedir(dir);
+
+    qsort(list->paths, list->count, sizeof(char*), compare_paths);
+    return 0;
+}
+
+// one path per line; blank lines and lines starting with '#' are skipped
+static int list_file_inputs(const char *list_path, BatchList *list, int *capacity) {
+    FILE *file = fopen(list_path, "r");
+    if (!file) {
+        printf("Erro ao abrir lista: %s\n", list_path);
+        return -1;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0' && line[0] != '#') {
+            add_path(list, capacity, line);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+// file name part of path
+static const char* base_name(const char *path) {
+    const char *base = strrchr(path, '/');
+    return base ? base + 1 : path;
+}
+
+// helper function for qsort: paths by file name
+static int compare_base_names(const void *a, const void *b) {
+    return strcmp(base_name(*(char* const*)a), base_name(*(char* const*)b));
+}
+
+// batch outputs are named after the input file name alone, so two list
+// entries such as a/img.bmp and b/img.bmp would write the same file;
+// returns -1 after printing the first such pair
+static int check_output_names(const BatchList *list) {
+    char **sorted = (char**)malloc(list->count * sizeof(char*));
+    memcpy(sorted, list->paths, list->count * sizeof(char*));
+    qsort(sorted, list->count, sizeof(char*), compare_base_names);
+
+    int result = 0;
+    for (int i = 1; i < list->count && result == 0; i++) {
+        if (compare_base_names(&sorted[i - 1], &sorted[i]) == 0) {
+            printf("Entradas com o mesmo nome de arquivo gravariam a mesma saída: %s e %s\n",
+                   sorted[i - 1], sorted[i]);
+            result = -1;
+        }
+    }
+    free(sorted);
+    return result;
+}
+
+// 1 if path holds exactly one integer conversion (%d, %04d, ...) and no
+// other '%', so it can be given to snprintf
+static int is_frame_pattern(const char *path) {
+    int conversions = 0;
+    for (const char *p = strchr(path, '%'); p; p = strchr(p, '%')) {
+        p++;
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+        if (*p != 'd') {
+            return 0;
+        }
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+// numbered frames of a pattern, from 0 (or 1 when there is no frame 0) up
+// to the first missing number
+static int frame_inputs(const char *pattern, BatchList *list, int *capacity) {
+    char path[4096];
+    struct stat st;
+    int first = 0;
+    snprintf(path, sizeof(path), pattern, 0);
+    if (stat(path, &st) != 0) {
+        first = 1;
+    }
+    for (int i = first; ; i++) {
+        snprintf(path, sizeof(path), pattern, i);
+        if (stat(path, &st) != 0) {
+            break;
+        }
+        add_path(list, capacity, path);
+    }
+    return 0;
+}
+
+// 1 for a directory, an @list or a numbered frame pattern
+int is_batch_input(const char *arg) {
+    return arg[0] == '@' || is_directory(arg) || is_frame_pattern(arg);
+}
+
+// fills list with the inputs named by arg
+int batch_inputs(const char *arg, BatchList *list) {
+    int capacity = 0;
+    list->paths = NULL;
+    list->count = 0;
+
+    int result = 0;
+    if (arg[0] == '@') {
+        result = list_file_inputs(arg + 1, list, &capacity);
+        if (result == 0) {
+            result = check_output_names(list);
+        }
+    } else if (is_directory(arg)) {
+        result = directory_inputs(arg, list, &capacity);
+    } else if (is_frame_pattern(arg)) {
+        result = frame_inputs(arg, list, &capacity);
+    } else {
+        add_path(list, &capacity, arg);
+    }
+
+    if (result == 0 && list->count == 0) {
+        printf("Nenhuma imagem BMP encontrada em: %s\n", arg);
+        result = -1;
+    }
+    if (result != 0) {
+        free_batch_list(list);
+    }
+    return result;
+}
+
+// frees the paths of the list
+void free_batch_list(BatchList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    list->paths = NULL;
+    list->count = 0;
+}
+
+// output/<name>_<mask>_output.bmp, or output/<name>_<mask>_<input file name>
+void output_path(char *path, size_t size, const char *name, int mask_size,
+                 const char *input_file, int batch) {
+    if (!batch) {
+        snprintf(path, size, "output/%s_%d_output.bmp", name, mask_size);
+        return;
+    }
+    snprintf(path, size, "output/%s_%d_%s", name, mask_size, base_name(input_file));
+}
+
+// reads the pixels into the arena, or maps input and output
+int open_image_files(ImageFiles *f, const char *input_file, const char *output_file,
+                     IOMode io, Arena *arena, PlaceImageFn place, void *ctx) {
+    TIMING_START(t_read);
+    f->input_map = NULL;
+    f->output_map = NULL;
+
+    if (io == IO_MMAP) {
+        f->input_map = map_bmp(input_file);
+        if (!f->input_map) {
+            return -1;
+        }
+        f->output_map = create_mapped_bmp(output_file, &f->input_map->image);
+        if (!f->output_map) {
+            unmap_bmp(f->input_map);
+            return -1;
+        }
+        f->src = &f->input_map->image;
+        f->dst = &f->output_map->image;
+        TIMING_STOP(t_read, STAGE_READ, 0);
+        return 0;
+    }
+
+    BMPHeader info;
+    FILE *file = open_bmp(input_file, &info);
+    if (!file) {
+        return -1;
+    }
+
+    int row_size = ((info.width * 3 + 3) / 4) * 4;
+    size_t data_size = (size_t)row_size * info.height;
+    f->image.width = info.width;
+    f->image.height = info.height;
+    f->image.data = (uint8_t*)arena_alloc(arena, data_size);
+    f->image.top_down = info.top_down;
+    if (f->image.data && place) {
+        place(f->image.data, info.width, info.height, ctx);
+    }
+
+    if (!f->image.data || fread(f->image.data, 1, data_size, file) != data_size) {
+        printf("Erro ao ler dados da imagem\n");
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    f->src = &f->image;
+    f->dst = &f->image;
+    TIMING_STOP(t_read, STAGE_READ, 0);
+    return 0;
+}
+
+// writes dst, or unmaps both files
+void close_image_files(ImageFiles *f, const char *output_file) {
+    TIMING_START(t_write);
+    if (f->output_map) {
+        unmap_bmp(f->output_map);
+        unmap_bmp(f->input_map);
+    } else {
+        write_bmp(output_file, f->dst);
+    }
+    TIMING_STOP(t_write, STAGE_WRITE, 0);
+}
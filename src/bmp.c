@@ -1,8 +1,70 @@
+#define _POSIX_C_SOURCE 200809L
 #include "bmp.h"
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-// reads a BMP file
-BMPImage* read_bmp(const char *filename) {
+// parses the file header and a BITMAPINFOHEADER or one of its larger
+// successors (V4, V5), whose first 40 bytes have the same layout
+const char* parse_bmp_header(const uint8_t *header, BMPHeader *info) {
+    // check if it's a BMP (first 2 bytes should be "BM")
+    if (header[0] != 'B' || header[1] != 'M') {
+        return "Arquivo não é um BMP válido";
+    }
+
+    uint32_t dib_size = *(uint32_t*)&header[14];
+    if (dib_size < 40) {
+        return "Header BMP não suportado (BITMAPCOREHEADER)";
+    }
+
+    // get width and height from header
+    info->width = *(int*)&header[18];
+    int height = *(int*)&header[22];
+    int bits_per_pixel = *(short*)&header[28];
+    uint32_t compression = *(uint32_t*)&header[30];
+    info->data_offset = *(uint32_t*)&header[10];
+
+    if (bits_per_pixel != 24) {
+        return "Apenas BMP 24 bits são suportados";
+    }
+    if (compression != 0) {
+        return "Apenas BMP sem compressão é suportado";
+    }
+
+    // a negative height means the rows are stored top to bottom
+    info->top_down = height < 0;
+    info->height = (height < 0) ? -height : height;
+
+    if (info->width <= 0 || info->height <= 0 || info->data_offset < 14 + dib_size) {
+        return "Header BMP inválido";
+    }
+    return NULL;
+}
+
+// fills the header of a 24-bit image
+void make_bmp_header(uint8_t *header, int width, int height, int top_down) {
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    uint64_t data_size = (uint64_t)row_size * height;
+    uint64_t file_size = BMP_HEADER_SIZE + data_size;
+
+    memset(header, 0, BMP_HEADER_SIZE);
+    header[0] = 'B';
+    header[1] = 'M';
+    // the size fields are 32-bit: past 4 GB they are left 0 (unknown)
+    *(uint32_t*)&header[2] = (file_size <= UINT32_MAX) ? (uint32_t)file_size : 0;
+    *(int*)&header[10] = BMP_HEADER_SIZE;  // data offset
+    *(int*)&header[14] = 40;  // header size
+    *(int*)&header[18] = width;
+    *(int*)&header[22] = top_down ? -height : height;
+    *(short*)&header[26] = 1;  // planes
+    *(short*)&header[28] = 24; // bits per pixel
+    *(uint32_t*)&header[34] = (data_size <= UINT32_MAX) ? (uint32_t)data_size : 0;
+}
+
+// opens a BMP file and parses its header
+FILE* open_bmp(const char *filename, BMPHeader *info) {
     FILE *file = fopen(filename, "rb");
     if (!file) {
         printf("Erro ao abrir arquivo: %s\n", filename);
@@ -10,43 +72,52 @@ BMPImage* read_bmp(const char *filename) {
     }
 
     // read BMP header (54 bytes)
-    uint8_t header[54];
-    if (fread(header, 1, 54, file) != 54) {
+    uint8_t header[BMP_HEADER_SIZE];
+    if (fread(header, 1, BMP_HEADER_SIZE, file) != BMP_HEADER_SIZE) {
         printf("Erro ao ler header BMP\n");
         fclose(file);
         return NULL;
     }
 
-    // check if it's a BMP (first 2 bytes should be "BM")
-    if (header[0] != 'B' || header[1] != 'M') {
-        printf("Arquivo não é um BMP válido\n");
+    const char *error = parse_bmp_header(header, info);
+    if (error) {
+        printf("%s\n", error);
         fclose(file);
         return NULL;
     }
 
-    // get width and height from header
-    int width = *(int*)&header[18];
-    int height = *(int*)&header[22];
-    int bits_per_pixel = *(short*)&header[28];
-
-    if (bits_per_pixel != 24) {
-        printf("Apenas BMP 24 bits são suportados\n");
+    // pixel rows start at the offset in the header, not always right after it
+    if (fseek(file, info->data_offset, SEEK_SET) != 0) {
+        printf("Erro ao ler dados da imagem\n");
         fclose(file);
         return NULL;
     }
+    return file;
+}
+
+// reads a BMP file
+BMPImage* read_bmp(const char *filename) {
+    BMPHeader info;
+    FILE *file = open_bmp(filename, &info);
+    if (!file) {
+        return NULL;
+    }
+    int width = info.width;
+    int height = info.height;
 
     // calculate row size with padding (must be multiple of 4)
     int row_size = ((width * 3 + 3) / 4) * 4;
-    int data_size = row_size * height;
+    size_t data_size = (size_t)row_size * height;
 
     // allocate memory for image
     BMPImage *img = (BMPImage*)malloc(sizeof(BMPImage));
     img->width = width;
     img->height = height;
     img->data = (uint8_t*)malloc(data_size);
+    img->top_down = info.top_down;
 
     // read image data
-    if (fread(img->data, 1, data_size, file) != (size_t)data_size) {
+    if (fread(img->data, 1, data_size, file) != data_size) {
         printf("Erro ao ler dados da imagem\n");
         free(img->data);
         free(img);
@@ -67,24 +138,14 @@ void write_bmp(const char *filename, BMPImage *img) {
     }
 
     int row_size = ((img->width * 3 + 3) / 4) * 4;
-    int data_size = row_size * img->height;
-    int file_size = 54 + data_size;
+    size_t data_size = (size_t)row_size * img->height;
 
     // create BMP header
-    uint8_t header[54] = {0};
-    header[0] = 'B';
-    header[1] = 'M';
-    *(int*)&header[2] = file_size;
-    *(int*)&header[10] = 54;  // data offset
-    *(int*)&header[14] = 40;  // header size
-    *(int*)&header[18] = img->width;
-    *(int*)&header[22] = img->height;
-    *(short*)&header[26] = 1;  // planes
-    *(short*)&header[28] = 24; // bits per pixel
-    *(int*)&header[34] = data_size;
+    uint8_t header[BMP_HEADER_SIZE];
+    make_bmp_header(header, img->width, img->height, img->top_down);
 
     // write header
-    fwrite(header, 1, 54, file);
+    fwrite(header, 1, BMP_HEADER_SIZE, file);
 
     // write image data
     fwrite(img->data, 1, data_size, file);
@@ -100,3 +161,108 @@ void free_bmp(BMPImage *img) {
     }
 }
 
+
+// maps a BMP file read-only
+MappedBMP* map_bmp(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Erro ao abrir arquivo: %s\n", filename);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BMP_HEADER_SIZE) {
+        printf("Erro ao ler header BMP\n");
+        close(fd);
+        return NULL;
+    }
+
+    size_t map_size = (size_t)st.st_size;
+    uint8_t *map = (uint8_t*)mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Erro ao mapear arquivo: %s\n", filename);
+        return NULL;
+    }
+
+    BMPHeader info;
+    const char *error = parse_bmp_header(map, &info);
+    int row_size = ((info.width * 3 + 3) / 4) * 4;
+    if (!error && info.data_offset + (size_t)row_size * info.height > map_size) {
+        error = "Erro ao ler dados da imagem";
+    }
+    if (error) {
+        printf("%s\n", error);
+        munmap(map, map_size);
+        return NULL;
+    }
+
+    // the stages read the rows roughly in order: let the kernel read ahead
+    posix_madvise(map, map_size, POSIX_MADV_SEQUENTIAL);
+
+    MappedBMP *m = (MappedBMP*)malloc(sizeof(MappedBMP));
+    m->image.width = info.width;
+    m->image.height = info.height;
+    m->image.data = map + info.data_offset;
+    m->image.top_down = info.top_down;
+    m->map = map;
+    m->map_size = map_size;
+    return m;
+}
+
+// creates filename at its final size and maps it for writing
+MappedBMP* create_mapped_bmp(const char *filename, const BMPImage *like) {
+    int width = like->width;
+    int height = like->height;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    size_t map_size = BMP_HEADER_SIZE + (size_t)row_size * height;
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Erro ao criar arquivo: %s\n", filename);
+        return NULL;
+    }
+
+    // allocate the blocks now: a full disk fails here instead of as a
+    // SIGBUS when a page of the mapping is first written
+    if (posix_fallocate(fd, 0, (off_t)map_size) != 0) {
+        printf("Erro ao criar arquivo: %s\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t *map = (uint8_t*)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Erro ao mapear arquivo: %s\n", filename);
+        return NULL;
+    }
+
+    make_bmp_header(map, width, height, like->top_down);
+
+    MappedBMP *m = (MappedBMP*)malloc(sizeof(MappedBMP));
+    m->image.width = width;
+    m->image.height = height;
+    m->image.data = map + BMP_HEADER_SIZE;
+    m->image.top_down = like->top_down;
+    m->map = map;
+    m->map_size = map_size;
+
+    // the stages only write pixels: keep the row padding bytes of like
+    int pixel_bytes = width * 3;
+    if (row_size > pixel_bytes) {
+        for (int y = 0; y < height; y++) {
+            memcpy(m->image.data + (size_t)y * row_size + pixel_bytes,
+                   like->data + (size_t)y * row_size + pixel_bytes, row_size - pixel_bytes);
+        }
+    }
+    return m;
+}
+
+// unmaps the file; the pages of an output mapping reach the file
+void unmap_bmp(MappedBMP *m) {
+    if (m) {
+        munmap(m->map, m->map_size);
+        free(m);
+    }
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bmp.h"
+
+// Writes a synthetic 24-bit BMP of any size, one row at a time, so images
+// much larger than the ones in data/ (16k x 16k and beyond) can be made
+// without holding them in memory. Each channel is a smooth gradient whose
+// low `entropy` bits are replaced by random bits: 0 gives flat gradients
+// (the median and histogram see long runs of equal values), 8 gives white
+// noise, and values in between look like photos with sensor noise.
+
+// xorshift64*: fast and good enough for pixel noise
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// fills one BGR row of the gradient plus noise
+static void make_row(uint8_t *row, int width, int height, int y, int entropy, uint64_t *state) {
+    uint8_t noise_mask = (uint8_t)((1u << entropy) - 1);
+    uint64_t bits = 0;
+    int left = 0;
+
+    for (int x = 0; x < width; x++) {
+        uint8_t base[3] = {
+            (uint8_t)((uint64_t)x * 255 / width),
+            (uint8_t)((uint64_t)y * 255 / height),
+            (uint8_t)(((uint64_t)x * height + (uint64_t)y * width) * 127 / ((uint64_t)width * height))
+        };
+        for (int c = 0; c < 3; c++) {
+            if (left == 0) {
+                bits = next_random(state);
+                left = 8;
+            }
+            uint8_t noise = (uint8_t)bits;
+            bits >>= 8;
+            left--;
+            row[x * 3 + c] = (uint8_t)((base[c] & ~noise_mask) | (noise & noise_mask));
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        printf("Uso: %s <largura> <altura> <arquivo_saida> [entropia] [semente]\n", argv[0]);
+        printf("Gera um BMP 24 bits sintético: gradiente com <entropia> bits aleatórios por canal\n");
+        printf("(0 = gradiente liso, 8 = ruído branco; padrão: 4)\n");
+        printf("Exemplo: %s 16384 16384 output/synthetic.bmp 4\n", argv[0]);
+        return 1;
+    }
+
+    int width = atoi(argv[1]);
+    int height = atoi(argv[2]);
+    const char *output_file = argv[3];
+    int entropy = (argc > 4) ? atoi(argv[4]) : 4;
+    uint64_t seed = (argc > 5) ? strtoull(argv[5], NULL, 10) : 1;
+
+    if (width <= 0 || height <= 0 || width > (INT32_MAX - 3) / 3) {
+        printf("Dimensões inválidas: %sx%s\n", argv[1], argv[2]);
+        return 1;
+    }
+    if (entropy < 0 || entropy > 8) {
+        printf("Entropia deve estar entre 0 e 8\n");
+        return 1;
+    }
+
+    FILE *file = fopen(output_file, "wb");
+    if (!file) {
+        printf("Erro ao criar arquivo: %s\n", output_file);
+        return 1;
+    }
+
+    uint8_t header[BMP_HEADER_SIZE];
+    make_bmp_header(header, width, height, 0);
+    fwrite(header, 1, BMP_HEADER_SIZE, file);
+
+    // the padding bytes stay 0; rows are stored bottom-up, as y goes
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    uint8_t *row = (uint8_t*)calloc(row_size, 1);
+    uint64_t state = seed ? seed : 1;
+    int ok = 1;
+    for (int y = 0; y < height && ok; y++) {
+        make_row(row, width, height, y, entropy, &state);
+        ok = fwrite(row, 1, row_size, file) == (size_t)row_size;
+    }
+    free(row);
+
+    if (fclose(file) != 0 || !ok) {
+        printf("Erro ao escrever arquivo: %s\n", output_file);
+        return 1;
+    }
+    printf("Imagem gerada: %s (%dx%d, entropia %d bits por canal, %.1f MB)\n", output_file, width,
+           height, entropy, (BMP_HEADER_SIZE + (double)row_size * height) / 1e6);
+    return 0;
+}
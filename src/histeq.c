@@ -0,0 +1,248 @@
+#include "histeq.h"
+#include "arena.h"
+#include "luma.h"
+#include "padded.h"
+#include "pipeline.h"
+#include <math.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct HistEqContext {
+    int mask_size;
+    Options opts;
+    int threads;
+    Arena arena;    // reset by every call; grows to the largest image
+
+    // sequence state (--smooth, --lut-threshold): histograms as fractions
+    // of their frame, so frames of different sizes mix
+    double smoothed[256];     // smoothed histogram of the frames so far
+    double lut_source[256];   // the smoothed histogram lut was built from
+    uint8_t lut[256];
+    HistEqStats stats;
+};
+
+// rows [y_start, y_end) of the calling thread
+static void thread_band(int height, int *y_start, int *y_end) {
+    int tid = omp_get_thread_num();
+    int nthreads = omp_get_num_threads();
+    *y_start = (int)((long)height * tid / nthreads);
+    *y_end = (int)((long)height * (tid + 1) / nthreads);
+}
+
+static int format_bpp(HistEqFormat format) {
+    return (format == HISTEQ_GRAY) ? 1 : 3;
+}
+
+static int valid_image(const HistEqImage *img) {
+    return img && img->data && img->width > 0 && img->height > 0 &&
+           (img->format == HISTEQ_BGR || img->format == HISTEQ_GRAY) &&
+           img->stride >= img->width * format_bpp(img->format);
+}
+
+HistEqContext* histeq_create(int mask_size, const Options *opts, int threads) {
+    if (mask_size % 2 == 0 || mask_size < 3) {
+        return NULL;
+    }
+    HistEqContext *ctx = (HistEqContext*)malloc(sizeof(HistEqContext));
+    if (!ctx) {
+        return NULL;
+    }
+    ctx->mask_size = mask_size;
+    if (opts) {
+        ctx->opts = *opts;
+    } else {
+        options_init(&ctx->opts);
+    }
+    ctx->threads = (threads > 0) ? threads : omp_get_max_threads();
+    arena_init(&ctx->arena);
+    histeq_reset_sequence(ctx);
+    return ctx;
+}
+
+void histeq_reset_sequence(HistEqContext *ctx) {
+    memset(ctx->smoothed, 0, sizeof(ctx->smoothed));
+    memset(ctx->lut_source, 0, sizeof(ctx->lut_source));
+    memset(ctx->lut, 0, sizeof(ctx->lut));
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+void histeq_stats(const HistEqContext *ctx, HistEqStats *stats) {
+    *stats = ctx->stats;
+}
+
+// LUT of one frame of a sequence: the histogram joins the smoothed one
+// with weight 1 - smooth, and the LUT is only rebuilt when the smoothed
+// histogram moved by more than lut_threshold (half the L1 distance: the
+// fraction of pixels that changed bins) since the last build
+static void sequence_lut(HistEqContext *ctx, const HistogramCount *histogram,
+                         HistogramCount total_pixels, uint8_t *lut) {
+    double smooth = ctx->opts.smooth;
+    double distance = 0.0;
+    for (int i = 0; i < 256; i++) {
+        double current = (double)histogram[i] / (double)total_pixels;
+        // the first frame of a sequence starts the smoothed histogram
+        if (ctx->stats.frames == 0) {
+            ctx->smoothed[i] = current;
+        } else {
+            ctx->smoothed[i] = smooth * ctx->smoothed[i] + (1.0 - smooth) * current;
+        }
+        distance += fabs(ctx->smoothed[i] - ctx->lut_source[i]);
+    }
+    ctx->stats.frames++;
+
+    if (ctx->stats.lut_builds == 0 || distance / 2 > ctx->opts.lut_threshold) {
+        // back to counts of this frame for equalization_lut
+        HistogramCount cumulative[256];
+        double sum = 0.0;
+        for (int i = 0; i < 256; i++) {
+            sum += ctx->smoothed[i];
+            cumulative[i] = (HistogramCount)llround(sum * (double)total_pixels);
+            if (cumulative[i] > total_pixels) {
+                cumulative[i] = total_pixels;
+            }
+        }
+        equalization_lut(cumulative, total_pixels, ctx->lut);
+        memcpy(ctx->lut_source, ctx->smoothed, sizeof(ctx->smoothed));
+        ctx->stats.lut_builds++;
+    }
+    memcpy(lut, ctx->lut, sizeof(ctx->lut));
+}
+
+// most arena bytes one call on a width x height image takes: a framed BGR
+// copy, the framed luma plane, the luma / filtered plane and the scratch
+// of every thread (plus one alignment unit each)
+static size_t context_bytes(const HistEqContext *ctx, int width, int height) {
+    int border = padded_border(ctx->opts.border, ctx->mask_size);
+    return padded_size(width, height, 3, border) + padded_size(width, height, 1, border) +
+           (size_t)width * height + (size_t)ctx->threads * fused_scratch_size(width, ctx->mask_size) +
+           (size_t)(ctx->threads + 3) * ARENA_ALIGNMENT;
+}
+
+void histeq_reserve(HistEqContext *ctx, int width, int height) {
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    // the reset regrows the main block to what was just requested
+    arena_reset(&ctx->arena);
+    arena_alloc(&ctx->arena, context_bytes(ctx, width, height));
+    arena_reset(&ctx->arena);
+}
+
+// framed copy of src (bpp 1 or 3) for a replicated / reflected border, rows
+// split among the threads; with BORDER_SHRINK, src itself
+static ImageView source_view(HistEqContext *ctx, const HistEqImage *src, int bpp) {
+    ImageView view = { src->data, src->width, src->height, src->stride, bpp, 0 };
+    if (ctx->opts.border == BORDER_SHRINK) {
+        return view;
+    }
+
+    int border = padded_border(ctx->opts.border, ctx->mask_size);
+    PaddedImage copy;
+    padded_init(&copy, src->width, src->height, bpp, border,
+                (uint8_t*)arena_alloc(&ctx->arena, padded_size(src->width, src->height, bpp, border)));
+
+    #pragma omp parallel num_threads(ctx->threads)
+    {
+        int y_start, y_end;
+        thread_band(src->height, &y_start, &y_end);
+        padded_copy_rows(&copy, src->data, src->stride, y_start, y_end);
+    }
+    padded_fill_border(&copy, ctx->opts.border);
+    return padded_view(&copy, ctx->opts.border);
+}
+
+// luma of the BGR rows of src into a framed plane, rows split among the threads
+static ImageView luma_view(HistEqContext *ctx, const HistEqImage *src) {
+    int border = padded_border(ctx->opts.border, ctx->mask_size);
+    PaddedImage plane;
+    padded_init(&plane, src->width, src->height, 1, border,
+                (uint8_t*)arena_alloc(&ctx->arena, padded_size(src->width, src->height, 1, border)));
+
+    #pragma omp parallel num_threads(ctx->threads)
+    {
+        int y_start, y_end;
+        thread_band(src->height, &y_start, &y_end);
+        for (int y = y_start; y < y_end; y++) {
+            luma_bgr_row(src->data + (size_t)y * src->stride, plane.data + (size_t)y * plane.stride,
+                         src->width);
+        }
+    }
+    padded_fill_border(&plane, ctx->opts.border);
+    return padded_view(&plane, ctx->opts.border);
+}
+
+int histeq_process(HistEqContext *ctx, const HistEqImage *src, const HistEqImage *dst) {
+    if (!ctx || !valid_image(src) || !valid_image(dst) ||
+        src->width != dst->width || src->height != dst->height) {
+        return -1;
+    }
+
+    int width = src->width;
+    int height = src->height;
+    int mask_size = ctx->mask_size;
+    MedianEngine engine = ctx->opts.median;
+    arena_reset(&ctx->arena);
+
+    // pass 1: median, luma and histogram into the luma plane. A BGR source
+    // filters B, G and R and converts the strips (or, luma-first, converts
+    // and filters the luma); a gray source filters its only channel.
+    int bgr = (src->format == HISTEQ_BGR);
+    int luma_first = bgr && ctx->opts.order == ORDER_LUMA_FIRST;
+    ImageView view = luma_first ? luma_view(ctx, src) : source_view(ctx, src, bgr ? 3 : 1);
+
+    size_t scratch_size = fused_scratch_size(width, mask_size);
+    uint8_t *scratch = (uint8_t*)arena_alloc(&ctx->arena, (size_t)ctx->threads * scratch_size);
+    uint8_t *luma = (uint8_t*)arena_alloc(&ctx->arena, (size_t)width * height);
+    HistogramCount histogram[256] = {0};
+    uint8_t lut[256];
+
+    #pragma omp parallel num_threads(ctx->threads) reduction(+:histogram[:256])
+    {
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        uint8_t *own = scratch + (size_t)omp_get_thread_num() * scratch_size;
+        if (bgr && !luma_first) {
+            fused_median_luma_rows(view, luma + (size_t)y_start * width, histogram, mask_size,
+                                   y_start, y_end, engine, own);
+        } else {
+            luma_median_rows(view, luma + (size_t)y_start * width, histogram, mask_size,
+                             y_start, y_end, engine, own);
+        }
+    }
+
+    // pass 2: every pixel of dst through the LUT; src is no longer read.
+    // Without --smooth and --lut-threshold each frame stands alone.
+    if (ctx->opts.smooth > 0.0 || ctx->opts.lut_threshold > 0.0) {
+        sequence_lut(ctx, histogram, (HistogramCount)width * height, lut);
+    } else {
+        build_equalization_lut(histogram, (HistogramCount)width * height, lut);
+        ctx->stats.frames++;
+        ctx->stats.lut_builds++;
+    }
+
+    #pragma omp parallel num_threads(ctx->threads)
+    {
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        for (int y = y_start; y < y_end; y++) {
+            uint8_t *row = luma + (size_t)y * width;
+            uint8_t *out = dst->data + (size_t)y * dst->stride;
+            if (dst->format == HISTEQ_GRAY) {
+                lut_row(row, out, lut, width);
+            } else {
+                lut_row(row, row, lut, width);
+                gray_bgr_row(row, out, width);
+            }
+        }
+    }
+    return 0;
+}
+
+void histeq_destroy(HistEqContext *ctx) {
+    if (!ctx) {
+        return;
+    }
+    arena_free(&ctx->arena);
+    free(ctx);
+}
@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Local client of bin/histeqd: sends one request line (the arguments
+// joined by spaces) and prints the reply. With -r N the same request is
+// sent N times over one connection and the round-trip latencies are
+// summarized, to compare against launching a binary per image.
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// connected socket, or -1 after printing the error
+static int connect_server(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Caminho do socket muito longo: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        printf("Erro ao conectar em %s (o servidor está rodando?)\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    int first = 2;
+    int repetitions = 1;
+    if (argc > 3 && strcmp(argv[2], "-r") == 0) {
+        repetitions = atoi(argv[3]);
+        first = 4;
+    }
+    if (argc <= first || repetitions < 1) {
+        printf("Uso: %s <socket> [-r repetições] <pedido...>\n", argv[0]);
+        printf("Pedidos:\n");
+        printf("  <tamanho_mascara> <entrada.bmp> <saida.bmp> [opções]\n");
+        printf("  shm <tamanho_mascara> <nome> <largura> <altura> <stride> <bgr|gray> [opções]\n");
+        printf("  ping | shutdown\n");
+        printf("Exemplo: %s /tmp/histeq.sock -r 100 3 data/img.bmp output/img_3.bmp\n", argv[0]);
+        return 1;
+    }
+
+    char line[4096] = "";
+    size_t length = 0;
+    for (int i = first; i < argc; i++) {
+        int n = snprintf(line + length, sizeof(line) - length, "%s%s", (i > first) ? " " : "", argv[i]);
+        if (n < 0 || (size_t)n >= sizeof(line) - length - 1) {
+            printf("Pedido muito longo\n");
+            return 1;
+        }
+        length += (size_t)n;
+    }
+    line[length++] = '\n';
+    line[length] = '\0';
+
+    int fd = connect_server(argv[1]);
+    if (fd < 0) {
+        return 1;
+    }
+    FILE *in = fdopen(dup(fd), "r");
+
+    double *times = (double*)malloc(sizeof(double) * repetitions);
+    char reply[512] = "";
+    int ok = 1;
+    for (int i = 0; i < repetitions && ok; i++) {
+        double start = wall_time();
+        if (write(fd, line, length) != (ssize_t)length || !fgets(reply, sizeof(reply), in)) {
+            printf("Conexão encerrada pelo servidor\n");
+            ok = 0;
+            break;
+        }
+        times[i] = wall_time() - start;
+        ok = strncmp(reply, "ok", 2) == 0;
+    }
+
+    printf("%s", reply);
+    if (ok && repetitions > 1) {
+        qsort(times, repetitions, sizeof(double), compare_double);
+        int p99 = (99 * repetitions + 99) / 100 - 1;
+        printf("LATENCIA_P50=%.6f\n", times[repetitions / 2]);
+        printf("LATENCIA_P99=%.6f\n", times[p99]);
+    } else if (ok) {
+        printf("LATENCIA=%.6f\n", times[0]);
+    }
+
+    free(times);
+    fclose(in);
+    close(fd);
+    return ok ? 0 : 1;
+}
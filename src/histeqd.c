@@ -0,0 +1,502 @@
+#define _POSIX_C_SOURCE 200809L
+#include "histeq.h"
+#include "batch.h"
+#include "arena.h"
+#include "options.h"
+#include "timing.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Persistent server: one process keeps its OpenMP team, its libhisteq
+// contexts and the arena of the image buffers across requests, so a small
+// image costs its processing time instead of a process launch, the team
+// creation and the page faults of fresh buffers.
+//
+// Clients connect to a Unix socket and send one request per line; each
+// gets one reply line. Requests of all connections go through one FIFO
+// queue to a single worker thread, which runs them one at a time with the
+// whole team. A connection waits for the reply of a request before its
+// next one is read; clients that want several requests in flight open
+// several connections.
+//
+//   <mask> <input.bmp> <output.bmp> [options]   file in, file out
+//   shm <mask> <name> <width> <height> <stride> <bgr|gray> [options]
+//                                               shared memory object
+//                                               (shm_open), in place
+//   ping                                        "ok"
+//   shutdown                                    stops the server once
+//                                               the queued requests end
+//
+// The reply is "ok <queue wait> <processing>" in seconds, or "erro
+// <message>". The options are those of the binaries (--median, --border,
+// --order, --io, --smooth, --lut-threshold); those given to the server
+// are the defaults of every request. Paths may not contain spaces.
+
+#define MAX_LINE 4096
+#define MAX_ARGS 64
+#define MAX_REPLY 512
+
+// requests waiting for the worker; more are refused with "fila cheia"
+#define JOB_QUEUE_SIZE 64
+
+// contexts kept for different masks and options; the least recently used
+// one is replaced
+#define MAX_CONTEXTS 8
+
+// outcome of queue_submit
+typedef enum {
+    SUBMIT_DONE,       // the worker ran the request; its reply is in the job
+    SUBMIT_FULL,       // JOB_QUEUE_SIZE requests already waiting
+    SUBMIT_STOPPING    // the server is shutting down
+} SubmitStatus;
+
+// one request, owned by the connection thread that waits for it
+typedef struct {
+    char line[MAX_LINE];
+    char reply[MAX_REPLY];
+    double queued;            // wall_time when it entered the queue
+    int done;
+    pthread_cond_t finished;
+} Job;
+
+// bounded FIFO of requests
+typedef struct {
+    Job *items[JOB_QUEUE_SIZE];
+    int head;
+    int count;
+    int stopping;             // no more requests: the worker drains and ends
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} JobQueue;
+
+typedef struct {
+    HistEqContext *ctx;
+    int mask_size;
+    MedianEngine median;
+    BorderMode border;
+    StageOrder order;
+    double smooth;
+    double lut_threshold;
+    long last_used;
+} CachedContext;
+
+typedef struct {
+    JobQueue queue;
+    Options defaults;
+    int threads;
+    CachedContext contexts[MAX_CONTEXTS];
+    long requests;            // requests run by the worker
+    Arena arena;              // pixels of the file requests
+} Server;
+
+static Server server;
+static int listen_fd = -1;
+static volatile sig_atomic_t stop_requested;
+
+// wakes the accept loop (from a signal handler or the shutdown request)
+static void request_stop(void) {
+    stop_requested = 1;
+    shutdown(listen_fd, SHUT_RDWR);
+}
+
+static void handle_signal(int sig) {
+    (void)sig;
+    request_stop();
+}
+
+// queues job and waits until the worker has run it
+static SubmitStatus queue_submit(JobQueue *q, Job *job) {
+    pthread_mutex_lock(&q->lock);
+    if (q->stopping || q->count == JOB_QUEUE_SIZE) {
+        SubmitStatus status = q->stopping ? SUBMIT_STOPPING : SUBMIT_FULL;
+        pthread_mutex_unlock(&q->lock);
+        return status;
+    }
+    job->done = 0;
+    job->queued = wall_time();
+    q->items[(q->head + q->count) % JOB_QUEUE_SIZE] = job;
+    q->count++;
+    pthread_cond_broadcast(&q->ready);
+
+    while (!job->done) {
+        pthread_cond_wait(&job->finished, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return SUBMIT_DONE;
+}
+
+// next request, or NULL once the queue is stopping and empty
+static Job* queue_next(JobQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->stopping) {
+        pthread_cond_wait(&q->ready, &q->lock);
+    }
+    Job *job = NULL;
+    if (q->count > 0) {
+        job = q->items[q->head];
+        q->head = (q->head + 1) % JOB_QUEUE_SIZE;
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+static void queue_finish(JobQueue *q, Job *job) {
+    pthread_mutex_lock(&q->lock);
+    job->done = 1;
+    pthread_cond_signal(&job->finished);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// context for mask_size and the options that matter to libhisteq; with
+// --smooth or --lut-threshold the requests that share it form one sequence
+static HistEqContext* server_context(Server *s, int mask_size, const Options *opts) {
+    CachedContext *slot = &s->contexts[0];
+    for (int i = 0; i < MAX_CONTEXTS; i++) {
+        CachedContext *c = &s->contexts[i];
+        if (c->ctx && c->mask_size == mask_size && c->median == opts->median &&
+            c->border == opts->border && c->order == opts->order &&
+            c->smooth == opts->smooth && c->lut_threshold == opts->lut_threshold) {
+            c->last_used = s->requests;
+            return c->ctx;
+        }
+        if (!c->ctx || (slot->ctx && c->last_used < slot->last_used)) {
+            slot = c;
+        }
+    }
+
+    histeq_destroy(slot->ctx);
+    slot->ctx = histeq_create(mask_size, opts, s->threads);
+    slot->mask_size = mask_size;
+    slot->median = opts->median;
+    slot->border = opts->border;
+    slot->order = opts->order;
+    slot->smooth = opts->smooth;
+    slot->lut_threshold = opts->lut_threshold;
+    slot->last_used = s->requests;
+    return slot->ctx;
+}
+
+// <mask> <input> <output>: the image goes through the arena (or mappings)
+static int run_file(Server *s, HistEqContext *ctx, const char *input, const char *output,
+                    const Options *opts, char *error, size_t size) {
+    arena_reset(&s->arena);
+    ImageFiles f;
+    if (open_image_files(&f, input, output, opts->io, &s->arena, NULL, NULL) != 0) {
+        snprintf(error, size, "não foi possível abrir %s", input);
+        return -1;
+    }
+
+    int row_size = ((f.src->width * 3 + 3) / 4) * 4;
+    HistEqImage src = { f.src->data, f.src->width, f.src->height, row_size, HISTEQ_BGR };
+    HistEqImage dst = { f.dst->data, f.dst->width, f.dst->height, row_size, HISTEQ_BGR };
+    histeq_process(ctx, &src, &dst);
+    close_image_files(&f, output);
+    return 0;
+}
+
+// shm <mask> <name> <width> <height> <stride> <format>: processed in place
+static int run_shared(HistEqContext *ctx, char **args, char *error, size_t size) {
+    HistEqImage img = { NULL, atoi(args[1]), atoi(args[2]), atoi(args[3]), HISTEQ_BGR };
+    if (strcmp(args[4], "gray") == 0) {
+        img.format = HISTEQ_GRAY;
+    } else if (strcmp(args[4], "bgr") != 0) {
+        snprintf(error, size, "formato inválido: %s", args[4]);
+        return -1;
+    }
+    if (img.width <= 0 || img.height <= 0 || img.stride <= 0) {
+        snprintf(error, size, "dimensões inválidas");
+        return -1;
+    }
+
+    int fd = shm_open(args[0], O_RDWR, 0);
+    if (fd < 0) {
+        snprintf(error, size, "shm_open %s: %s", args[0], strerror(errno));
+        return -1;
+    }
+    size_t bytes = (size_t)img.stride * img.height;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < bytes) {
+        snprintf(error, size, "%s tem menos de %zu bytes", args[0], bytes);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        snprintf(error, size, "mmap %s: %s", args[0], strerror(errno));
+        return -1;
+    }
+
+    img.data = (uint8_t*)map;
+    int status = histeq_process(ctx, &img, &img);
+    munmap(map, bytes);
+    if (status != 0) {
+        snprintf(error, size, "dimensões inválidas");
+    }
+    return status;
+}
+
+// runs one request line; returns 0, or -1 with the message in error
+static int run_request(Server *s, char *line, char *error, size_t size) {
+    char *args[MAX_ARGS];
+    int count = 0;
+    char *save;
+    for (char *tok = strtok_r(line, " \t", &save); tok && count < MAX_ARGS;
+         tok = strtok_r(NULL, " \t", &save)) {
+        args[count++] = tok;
+    }
+
+    // file requests take 3 arguments before the options, shm ones 7
+    int shared = count > 0 && strcmp(args[0], "shm") == 0;
+    int first = shared ? 7 : 3;
+    if (count < first) {
+        snprintf(error, size, "pedido incompleto");
+        return -1;
+    }
+
+    int mask_size = atoi(args[shared ? 1 : 0]);
+    if (mask_size % 2 == 0 || mask_size < 3) {
+        snprintf(error, size, "tamanho da máscara deve ser ímpar e >= 3");
+        return -1;
+    }
+    Options opts = s->defaults;
+    int bad = parse_options(count, args, first, &opts);
+    if (bad) {
+        snprintf(error, size, "opção inválida: %s", args[bad]);
+        return -1;
+    }
+
+    HistEqContext *ctx = server_context(s, mask_size, &opts);
+    if (!ctx) {
+        snprintf(error, size, "sem memória");
+        return -1;
+    }
+    if (shared) {
+        return run_shared(ctx, args + 2, error, size);
+    }
+    return run_file(s, ctx, args[1], args[2], &opts, error, size);
+}
+
+// the worker: runs the queued requests in order, with the whole team
+static void* run_jobs(void *arg) {
+    Server *s = (Server*)arg;
+    Job *job;
+    while ((job = queue_next(&s->queue)) != NULL) {
+        double start = wall_time();
+        char error[MAX_REPLY - 8];
+        if (run_request(s, job->line, error, sizeof(error)) == 0) {
+            snprintf(job->reply, MAX_REPLY, "ok %.6f %.6f\n", start - job->queued, wall_time() - start);
+        } else {
+            snprintf(job->reply, MAX_REPLY, "erro %s\n", error);
+        }
+        s->requests++;
+        queue_finish(&s->queue, job);
+    }
+    return NULL;
+}
+
+static int write_all(int fd, const char *text) {
+    size_t left = strlen(text);
+    while (left > 0) {
+        ssize_t n = write(fd, text, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        text += n;
+        left -= (size_t)n;
+    }
+    return 0;
+}
+
+// reads the requests of one client until it disconnects
+static void* serve_connection(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    FILE *in = fdopen(fd, "r");
+    if (!in) {
+        close(fd);
+        return NULL;
+    }
+
+    Job job;
+    pthread_cond_init(&job.finished, NULL);
+    while (fgets(job.line, sizeof(job.line), in)) {
+        job.line[strcspn(job.line, "\r\n")] = '\0';
+        if (job.line[0] == '\0') {
+            continue;
+        }
+        if (strcmp(job.line, "ping") == 0) {
+            snprintf(job.reply, MAX_REPLY, "ok\n");
+        } else if (strcmp(job.line, "shutdown") == 0) {
+            // replied first: the process may exit as soon as the loop stops
+            write_all(fd, "ok\n");
+            request_stop();
+            break;
+        } else {
+            SubmitStatus status = queue_submit(&server.queue, &job);
+            if (status == SUBMIT_FULL) {
+                snprintf(job.reply, MAX_REPLY, "erro fila cheia\n");
+            } else if (status == SUBMIT_STOPPING) {
+                snprintf(job.reply, MAX_REPLY, "erro servidor encerrando\n");
+            }
+        }
+        if (write_all(fd, job.reply) != 0) {
+            break;
+        }
+    }
+    pthread_cond_destroy(&job.finished);
+    fclose(in);
+    return NULL;
+}
+
+// socket bound to path, usable by the owner only (requests read and write
+// files with the server's rights); a stale socket file is replaced, any
+// other file is left alone. Returns -1 on error.
+static int open_listener(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Caminho do socket muito longo: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            printf("%s já existe e não é um socket\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    mode_t old_umask = umask(077);
+    int status = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_umask);
+    if (status != 0 || listen(fd, 64) != 0) {
+        printf("Erro ao abrir o socket %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Uso: %s <socket> [num_threads] [opções]\n", argv[0]);
+        printf("Servidor persistente: recebe pedidos por um socket Unix (veja bin/histeq_client)\n");
+        printf("Exemplo: %s /tmp/histeq.sock 8 --median=histogram\n", argv[0]);
+        print_options_usage();
+        return 1;
+    }
+
+    const char *socket_path = argv[1];
+    int first = 2;
+    server.threads = 0;
+    if (argc > 2 && argv[2][0] != '-') {
+        server.threads = atoi(argv[2]);
+        first = 3;
+        if (server.threads <= 0) {
+            printf("Número de threads deve ser positivo\n");
+            return 1;
+        }
+    }
+    options_init(&server.defaults);
+    int bad = parse_options(argc, argv, first, &server.defaults);
+    if (bad) {
+        printf("Opção inválida: %s\n", argv[bad]);
+        print_options_usage();
+        return 1;
+    }
+
+    listen_fd = open_listener(socket_path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+
+    // the connection and worker threads never take the stop signals, so
+    // they interrupt the accept loop below
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t stop_signals, old_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+
+    JobQueue *q = &server.queue;
+    q->head = 0;
+    q->count = 0;
+    q->stopping = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->ready, NULL);
+    arena_init(&server.arena);
+
+    pthread_t worker;
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+    pthread_create(&worker, NULL, run_jobs, &server);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    printf("Servidor ouvindo em %s\n", socket_path);
+    fflush(stdout);
+
+    while (!stop_requested) {
+        int client = accept(listen_fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || stop_requested) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+
+        pthread_t thread;
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+        if (pthread_create(&thread, NULL, serve_connection, (void*)(intptr_t)client) == 0) {
+            pthread_detach(thread);
+        } else {
+            close(client);
+        }
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    }
+
+    // the queued requests still run; new ones are refused
+    pthread_mutex_lock(&q->lock);
+    q->stopping = 1;
+    pthread_cond_broadcast(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(worker, NULL);
+
+    close(listen_fd);
+    unlink(socket_path);
+    for (int i = 0; i < MAX_CONTEXTS; i++) {
+        histeq_destroy(server.contexts[i].ctx);
+    }
+    arena_free(&server.arena);
+    printf("Servidor encerrado: %ld pedidos\n", server.requests);
+    return 0;
+}
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <omp.h>
+#include "bmp.h"
+#include "image_processing.h"
+#include "options.h"
+#include "planar.h"
+#include "pipeline.h"
+#include "mpi_strip.h"
+#include "batch.h"
+#include "affinity.h"
+#include "timing.h"
+
+// Hybrid MPI + OpenMP: one rank per node (or NUMA domain) holds a row strip
+// and its thread team splits the strip rows. Only the master thread calls
+// MPI, outside the parallel regions (MPI_THREAD_FUNNELED).
+
+// rows [*a, *b) of [y0, y1) for the calling thread: one contiguous band each
+static void thread_band(int y0, int y1, int *a, int *b) {
+    int tid = omp_get_thread_num();
+    int nthreads = omp_get_num_threads();
+    *a = y0 + (int)((long)(y1 - y0) * tid / nthreads);
+    *b = y0 + (int)((long)(y1 - y0) * (tid + 1) / nthreads);
+}
+
+// arguments of the median row callbacks
+typedef struct {
+    Strip *strip;
+    uint8_t *out;        // output row of the first own row
+    int out_stride;
+    HistogramCount *histogram;  // fused pipeline only
+    int mask_size;
+    MedianEngine engine;
+    ImageView src;       // strip rows the median reads (see strip_median_source)
+    uint8_t *scratch;    // median (or fused pipeline) scratch of every thread,
+    size_t scratch_size; // scratch_size bytes each, reused by every call
+} MedianRows;
+
+// one scratch block of size bytes (a multiple of 64) per thread of the team
+static uint8_t* thread_scratch(size_t size) {
+    return (uint8_t*)aligned_alloc(64, size * omp_get_max_threads());
+}
+
+// median of strip rows [y0, y1), split among the threads
+static void median_strip_rows(int y0, int y1, void *ctx) {
+    MedianRows *m = (MedianRows*)ctx;
+    Strip *strip = m->strip;
+
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int a, b;
+        thread_band(y0, y1, &a, &b);
+        median_filter_rows_scratch(m->src, m->out + (size_t)(a - strip->halo_top) * m->out_stride,
+                                   m->out_stride, m->mask_size, a, b, m->engine,
+                                   m->scratch + m->scratch_size * omp_get_thread_num());
+        TIMING_STOP(t, STAGE_MEDIAN, omp_get_thread_num());
+    }
+}
+
+// interleaved stages on the own rows; the median writes into out and the
+// other stages work on out in place
+static void process_strip_staged(Strip *strip, BMPImage *out, int mask_size, const Options *opts) {
+    int rows = out->height;
+
+    // STEP 1: median filter
+    PaddedImage *padded;
+    size_t scratch_size = median_scratch_size(strip->width, 3, mask_size);
+    MedianRows m = { strip, out->data, strip->row_size, NULL, mask_size, opts->median,
+                     strip_median_source(strip, opts->border, mask_size, &padded, MPI_COMM_WORLD),
+                     thread_scratch(scratch_size), scratch_size };
+    strip_run_rows(strip, opts->halo, median_strip_rows, &m, MPI_COMM_WORLD);
+    free(m.scratch);
+    free_padded(padded);
+
+    // STEP 2 and the histogram of STEP 3 on the same band of each thread
+    // each thread counts into its own copy, summed when the region ends
+    HistogramCount histogram[256] = {0};
+    #pragma omp parallel reduction(+:histogram[:256])
+    {
+        int a, b;
+        thread_band(0, rows, &a, &b);
+        TIMING_START(t_gray);
+        grayscale_rows(out, a, b);
+        TIMING_STOP(t_gray, STAGE_GRAYSCALE, omp_get_thread_num());
+        TIMING_START(t_hist);
+        histogram_rows(out, histogram, a, b);
+        TIMING_STOP(t_hist, STAGE_HISTOGRAM, omp_get_thread_num());
+    }
+
+    HistogramCount cumulative[256];
+    global_cumulative_histogram(histogram, cumulative, MPI_COMM_WORLD);
+
+    HistogramCount total_pixels = (HistogramCount)strip->width * strip->height;
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int a, b;
+        thread_band(0, rows, &a, &b);
+        equalize_rows(out, cumulative, total_pixels, a, b);
+        TIMING_STOP(t, STAGE_EQUALIZE, omp_get_thread_num());
+    }
+}
+
+// planar arguments of the median row callback
+typedef struct {
+    Strip *strip;
+    PlanarImage *planar;
+    PlanarImage *filtered;
+    int mask_size;
+    MedianEngine engine;
+} PlanarMedianRows;
+
+// splits the rows read by the windows of strip rows [y0, y1), then filters
+// them; every thread does its share of both
+static void planar_median_strip_rows(int y0, int y1, void *ctx) {
+    PlanarMedianRows *m = (PlanarMedianRows*)ctx;
+    if (y0 >= y1) {
+        return;
+    }
+
+    int half = m->mask_size / 2;
+    int r0 = (y0 > half) ? y0 - half : 0;
+    int r1 = (y1 + half < m->strip->image.height) ? y1 + half : m->strip->image.height;
+
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int a, b;
+        thread_band(r0, r1, &a, &b);
+        bmp_to_planar_rows(&m->strip->image, m->planar, a, b);
+
+        // the median of a band reads the rows of the neighbouring bands
+        #pragma omp barrier
+
+        thread_band(y0, y1, &a, &b);
+        planar_median_rows(m->planar, m->filtered, m->mask_size, a, b, m->engine);
+        TIMING_STOP(t, STAGE_MEDIAN, omp_get_thread_num());
+    }
+}
+
+// planar layout on the strip (own rows plus halo), luma written into out
+static void process_strip_planar(Strip *strip, BMPImage *out, int mask_size, const Options *opts) {
+    int width = strip->width;
+    int local_rows = strip->image.height;
+    int y0 = strip->halo_top;
+    int y1 = y0 + out->height;
+
+    PlanarImage *planar = create_planar(width, local_rows);
+    PlanarImage *filtered = create_planar(width, local_rows);
+
+    PlanarMedianRows m = { strip, planar, filtered, mask_size, opts->median };
+    strip_run_rows(strip, opts->halo, planar_median_strip_rows, &m, MPI_COMM_WORLD);
+
+    HistogramCount histogram[256] = {0};
+    #pragma omp parallel reduction(+:histogram[:256])
+    {
+        int a, b;
+        thread_band(y0, y1, &a, &b);
+        TIMING_START(t_gray);
+        planar_grayscale_rows(filtered, a, b);
+        TIMING_STOP(t_gray, STAGE_GRAYSCALE, omp_get_thread_num());
+        TIMING_START(t_hist);
+        planar_histogram_rows(filtered, histogram, a, b);
+        TIMING_STOP(t_hist, STAGE_HISTOGRAM, omp_get_thread_num());
+    }
+
+    HistogramCount cumulative[256];
+    global_cumulative_histogram(histogram, cumulative, MPI_COMM_WORLD);
+
+    // out holds only the own rows: shift the luma rows up by the halo
+    PlanarImage own = *filtered;
+    own.luma = filtered->luma + (size_t)y0 * width;
+
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int a, b;
+        thread_band(y0, y1, &a, &b);
+        planar_equalize_rows(filtered, cumulative, (HistogramCount)width * strip->height, a, b);
+        luma_to_bmp_rows(&own, out, a - y0, b - y0);
+        TIMING_STOP(t, STAGE_EQUALIZE, omp_get_thread_num());
+    }
+
+    free_planar(filtered);
+    free_planar(planar);
+}
+
+// fused median, luma and histogram of strip rows [y0, y1), split among the threads
+static void fused_median_strip_rows(int y0, int y1, void *ctx) {
+    MedianRows *m = (MedianRows*)ctx;
+    Strip *strip = m->strip;
+    HistogramCount *histogram = m->histogram;
+
+    #pragma omp parallel reduction(+:histogram[:256])
+    {
+        TIMING_START(t);
+        int a, b;
+        thread_band(y0, y1, &a, &b);
+        fused_median_luma_rows(m->src, m->out + (size_t)(a - strip->halo_top) * m->out_stride,
+                               histogram, m->mask_size, a, b, m->engine,
+                               m->scratch + m->scratch_size * omp_get_thread_num());
+        TIMING_STOP(t, STAGE_MEDIAN, omp_get_thread_num());
+    }
+}
+
+// fused strips over the own rows, then the equalization LUT built from the
+// global histogram
+static void process_strip_fused(Strip *strip, BMPImage *out, int mask_size, const Options *opts) {
+    int width = strip->width;
+    int rows = out->height;
+    uint8_t *luma = (uint8_t*)malloc((size_t)width * rows);
+
+    HistogramCount local_histogram[256] = {0};
+    PaddedImage *padded;
+    size_t scratch_size = fused_scratch_size(width, mask_size);
+    MedianRows m = { strip, luma, width, local_histogram, mask_size, opts->median,
+                     strip_median_source(strip, opts->border, mask_size, &padded, MPI_COMM_WORLD),
+                     thread_scratch(scratch_size), scratch_size };
+    strip_run_rows(strip, opts->halo, fused_median_strip_rows, &m, MPI_COMM_WORLD);
+    free(m.scratch);
+    free_padded(padded);
+
+    // sum histograms from all processes
+    HistogramCount global_histogram[256];
+    TIMING_START(t_reduce);
+    MPI_Allreduce(local_histogram, global_histogram, 256, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+    TIMING_STOP(t_reduce, STAGE_MPI, 0);
+
+    uint8_t lut[256];
+    build_equalization_lut(global_histogram, (HistogramCount)width * strip->height, lut);
+
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int a, b;
+        thread_band(0, rows, &a, &b);
+        fused_equalize_rows(out, luma + (size_t)a * width, lut, a, b);
+        TIMING_STOP(t, STAGE_EQUALIZE, omp_get_thread_num());
+    }
+
+    free(luma);
+}
+
+// luma-first order on the strip: each thread converts its band of the own
+// and halo rows, then filters and counts its band of the own rows
+static void process_strip_luma(Strip *strip, BMPImage *out, int mask_size, const Options *opts) {
+    int width = strip->width;
+    int local_rows = strip->image.height;
+    int rows = out->height;
+    int y0 = strip->halo_top;
+
+    // the median reads the luma of the halo rows: exchange them first
+    strip_exchange_halos(strip, MPI_COMM_WORLD);
+    PaddedImage *plane = create_padded(width, local_rows, 1, padded_border(opts->border, mask_size));
+    ImageView view = padded_view(plane, opts->border);
+    uint8_t *filtered = (uint8_t*)malloc((size_t)width * rows);
+    HistogramCount histogram[256] = {0};
+
+    #pragma omp parallel reduction(+:histogram[:256])
+    {
+        TIMING_START(t_gray);
+        int a, b;
+        thread_band(0, local_rows, &a, &b);
+        luma_plane_rows(&strip->image, plane, a, b);
+        TIMING_STOP(t_gray, STAGE_GRAYSCALE, omp_get_thread_num());
+
+        // the median of a band reads the luma of the neighbouring bands
+        #pragma omp barrier
+        #pragma omp single
+        padded_fill_border(plane, opts->border);
+
+        TIMING_START(t_median);
+        thread_band(y0, y0 + rows, &a, &b);
+        luma_median_rows(view, filtered + (size_t)(a - y0) * width, histogram, mask_size, a, b,
+                         opts->median, NULL);
+        TIMING_STOP(t_median, STAGE_MEDIAN, omp_get_thread_num());
+    }
+
+    // sum histograms from all processes
+    HistogramCount global_histogram[256];
+    TIMING_START(t_reduce);
+    MPI_Allreduce(histogram, global_histogram, 256, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+    TIMING_STOP(t_reduce, STAGE_MPI, 0);
+
+    uint8_t lut[256];
+    build_equalization_lut(global_histogram, (HistogramCount)width * strip->height, lut);
+
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int a, b;
+        thread_band(0, rows, &a, &b);
+        fused_equalize_rows(out, filtered + (size_t)a * width, lut, a, b);
+        TIMING_STOP(t, STAGE_EQUALIZE, omp_get_thread_num());
+    }
+
+    free(filtered);
+    free_padded(plane);
+}
+
+// prints the run parameters once the image is loaded
+static void print_image_info(int width, int height, int mask_size, int size, int num_threads) {
+    printf("Imagem carregada: %dx%d\n", width, height);
+    printf("Matriz de %d\n", mask_size);
+    printf("Processando com %d processos x %d threads...\n", size, num_threads);
+}
+
+int main(int argc, char *argv[]) {
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) {
+            printf("A biblioteca MPI não suporta MPI_THREAD_FUNNELED\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (argc < 4) {
+        if (rank == 0) {
+            printf("Uso: mpirun -np <num_processos> %s <tamanho_mascara> <num_threads> <arquivo_entrada> [opções]\n", argv[0]);
+            printf("Exemplo: mpirun -np 2 --map-by ppr:1:node --bind-to none %s 3 8 data/img.bmp\n", argv[0]);
+            print_options_usage();
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    int mask_size = atoi(argv[1]);
+    if (mask_size % 2 == 0 || mask_size < 3) {
+        if (rank == 0) {
+            printf("Tamanho da máscara deve ser ímpar e >= 3\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    int num_threads = atoi(argv[2]);
+    if (num_threads < 1) {
+        if (rank == 0) {
+            printf("Número de threads deve ser >= 1\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    Options opts;
+    options_init(&opts);
+    int bad = parse_options(argc, argv, 4, &opts);
+    if (bad) {
+        if (rank == 0) {
+            printf("Opção inválida: %s\n", argv[bad]);
+            print_options_usage();
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (opts.pipeline == PIPELINE_STREAM) {
+        if (rank == 0) {
+            printf("--pipeline=stream só é suportado na versão sequencial\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    const char *unsupported = unsupported_option(&opts, OPTIONS_PIPELINE | OPTIONS_MPI | OPTIONS_PIN);
+    if (unsupported) {
+        if (rank == 0) {
+            printf("%s não é suportado na versão híbrida\n", unsupported);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (!border_supported(&opts)) {
+        if (rank == 0) {
+            printf("--border=replicate|reflect não é suportado com --layout=planar nem --pipeline=stream\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    omp_set_num_threads(num_threads);
+
+    // the threads of a rank share the CPUs mpirun bound it to
+    if (opts.pin != PIN_NONE) {
+        int failed = 0;
+        #pragma omp parallel reduction(+:failed)
+        failed += (pin_thread(opts.pin, omp_get_thread_num()) != 0);
+        if (failed) {
+            printf("Aviso: processo %d: %d threads não puderam ser fixadas (--pin)\n", rank, failed);
+        }
+    }
+
+    timing_init(&opts, rank == 0);
+
+    const char *input_file = argv[3];
+    if (is_batch_input(input_file)) {
+        if (rank == 0) {
+            printf("Modo em lote (diretório, @lista ou quadros numerados) não é suportado na versão híbrida\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    char output_file[256];
+    snprintf(output_file, sizeof(output_file), "output/hybrid_%d_output.bmp", mask_size);
+
+    // each process keeps only its rows plus the median halo
+    StripFiles files;
+    double start_time = 0.0;
+    if (strip_load(&files, input_file, output_file, mask_size, opts.io, &start_time,
+                   MPI_COMM_WORLD) != 0) {
+        MPI_Finalize();
+        return 1;
+    }
+    if (rank == 0) {
+        print_image_info(files.strip.width, files.strip.height, mask_size, size, num_threads);
+    }
+
+    if (opts.order == ORDER_LUMA_FIRST) {
+        process_strip_luma(&files.strip, &files.out, mask_size, &opts);
+    } else if (opts.pipeline == PIPELINE_FUSED) {
+        process_strip_fused(&files.strip, &files.out, mask_size, &opts);
+    } else if (opts.layout == LAYOUT_PLANAR) {
+        process_strip_planar(&files.strip, &files.out, mask_size, &opts);
+    } else {
+        process_strip_staged(&files.strip, &files.out, mask_size, &opts);
+    }
+
+    double time_spent = strip_store(&files, output_file, start_time, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        printf("TEMPO_TOTAL=%.6f\n", time_spent);
+    }
+    strip_gather_timing(&opts, "hybrid", mask_size, MPI_COMM_WORLD);
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -1,7 +1,24 @@
 #include "image_processing.h"
+#include "median_network.h"
+#include "luma.h"
+#include "padded.h"
 #include <string.h>
 #include <stdlib.h>
 
+// pixels converted to gray per chunk
+#define GRAY_CHUNK 256
+
+// alignment of each buffer inside a median scratch block
+#define MEDIAN_SCRATCH_ALIGNMENT 64
+
+// working buffers of the median engines, carved from one scratch block
+typedef struct {
+    uint8_t *mask_values;   // one window (sort engine, border columns)
+    uint16_t *col_fine;     // column histograms (histogram engine, border rows)
+    uint16_t *col_coarse;
+    uint8_t *cols;          // sorted columns of one row (network engine)
+} MedianScratch;
+
 // helper function for qsort
 int compare_uint8(const void *a, const void *b) {
     uint8_t val_a = *(uint8_t*)a;
@@ -12,117 +29,447 @@ int compare_uint8(const void *a, const void *b) {
 }
 
 
-void apply_median_filter(BMPImage *img, int mask_size) {
-    int width = img->width;
-    int height = img->height;
-    int row_size = ((width * 3 + 3) / 4) * 4;
-    int half = mask_size / 2;
+// median of the window around (x, y) by sorting its values, clipped to the view
+static uint8_t median_sort_pixel(ImageView src, int x, int y, int channel,
+                                 int half, uint8_t *mask_values) {
+    int count = 0;
+
+    // collect values from mask area
+    for (int dy = -half; dy <= half; dy++) {
+        for (int dx = -half; dx <= half; dx++) {
+            int ny = y + dy;
+            int nx = x + dx;
+
+            // check bounds
+            if (ny >= 0 && ny < src.height && nx >= 0 && nx < src.width) {
+                size_t idx = (size_t)ny * src.stride + nx * src.bpp + channel;
+                mask_values[count++] = src.data[idx];
+            }
+        }
+    }
+
+    // sort and get median
+    qsort(mask_values, count, sizeof(uint8_t), compare_uint8);
+    return mask_values[count / 2];
+}
+
+// median of a window that lies wholly inside the view or its border
+static uint8_t median_window_pixel(ImageView src, int x, int y, int channel,
+                                   int half, uint8_t *mask_values) {
+    int size = 2 * half + 1;
+    const uint8_t *p = src.data + (ptrdiff_t)(y - half) * src.stride + (x - half) * src.bpp + channel;
+    int count = 0;
+
+    for (int dy = 0; dy < size; dy++) {
+        for (int dx = 0; dx < size; dx++) {
+            mask_values[count++] = p[dx * src.bpp];
+        }
+        p += src.stride;
+    }
 
-    // make a copy of original image
-    uint8_t *original = (uint8_t*)malloc(row_size * height);
-    memcpy(original, img->data, row_size * height);
+    qsort(mask_values, count, sizeof(uint8_t), compare_uint8);
+    return mask_values[count / 2];
+}
 
-    // array to store mask values
-    uint8_t *mask_values = (uint8_t*)malloc(mask_size * mask_size * sizeof(uint8_t));
+// sorts the windows of columns [x0, x1) of row y
+static void median_sort_columns(ImageView src, uint8_t *out, int y, int x0, int x1,
+                                int half, uint8_t *mask_values) {
+    // columns [lo, hi) have their whole window inside the view or its
+    // border and skip the bounds checks
+    int lo = x0;
+    int hi = x0;
+    if (src.border >= half) {
+        hi = x1;
+    } else if (y >= half && y < src.height - half) {
+        lo = (x0 > half) ? x0 : half;
+        hi = (x1 < src.width - half) ? x1 : src.width - half;
+        if (lo > x1) {
+            lo = x1;
+        }
+        if (hi < lo) {
+            hi = lo;
+        }
+    }
+
+    for (int x = x0; x < lo; x++) {
+        for (int channel = 0; channel < src.bpp; channel++) {
+            out[x * src.bpp + channel] = median_sort_pixel(src, x, y, channel, half, mask_values);
+        }
+    }
+    for (int x = lo; x < hi; x++) {
+        // for each channel (B, G, R)
+        for (int channel = 0; channel < src.bpp; channel++) {
+            out[x * src.bpp + channel] = median_window_pixel(src, x, y, channel, half, mask_values);
+        }
+    }
+    for (int x = hi; x < x1; x++) {
+        for (int channel = 0; channel < src.bpp; channel++) {
+            out[x * src.bpp + channel] = median_sort_pixel(src, x, y, channel, half, mask_values);
+        }
+    }
+}
+
+// median of each window by sorting its values
+static void median_sort_rows(ImageView src, uint8_t *dst, int dst_stride,
+                             int mask_size, int y0, int y1, const MedianScratch *scratch) {
+    int half = mask_size / 2;
 
     // process each pixel
-    for (int y = 0; y < height; y++) {
+    for (int y = y0; y < y1; y++) {
+        uint8_t *out = dst + (size_t)(y - y0) * dst_stride;
+        median_sort_columns(src, out, y, 0, src.width, half, scratch->mask_values);
+    }
+}
+
+// adds (sign = 1) or removes (sign = -1) one source row from the column histograms
+static void update_column_histograms(const uint8_t *row, int width, int bpp,
+                                     uint16_t *col_fine, uint16_t *col_coarse, int sign) {
+    for (int x = 0; x < width; x++) {
+        uint8_t v = row[x * bpp];
+        col_fine[x * 256 + v] += sign;
+        col_coarse[x * 16 + (v >> 4)] += sign;
+    }
+}
+
+// adds one column histogram (n bins) to a window histogram
+static inline void add_histogram(uint16_t *win, const uint16_t *col, int n) {
+    for (int i = 0; i < n; i++) {
+        win[i] += col[i];
+    }
+}
+
+// removes one column histogram (n bins) from a window histogram
+static inline void sub_histogram(uint16_t *win, const uint16_t *col, int n) {
+    for (int i = 0; i < n; i++) {
+        win[i] -= col[i];
+    }
+}
+
+// Perreault-Hébert median of one channel: each column keeps a histogram of
+// the window rows and slides down one row at a time, the window histogram is
+// the sum of its columns and slides right one column at a time. Only the
+// 16-bin coarse level is slid on every step; a 16-bin segment of the fine
+// level is brought up to date when the median search actually lands in it.
+// Only columns [x_skip, width - x_skip) are written, column x_skip to dst column 0.
+static void median_histogram_channel(ImageView src, int channel, uint8_t *dst, int dst_stride,
+                                     int mask_size, int y0, int y1, int x_skip,
+                                     uint16_t *col_fine, uint16_t *col_coarse) {
+    int width = src.width;
+    int height = src.height;
+    int bpp = src.bpp;
+    int half = mask_size / 2;
+    const uint8_t *base = src.data + channel;
+
+    memset(col_fine, 0, (size_t)width * 256 * sizeof(uint16_t));
+    memset(col_coarse, 0, (size_t)width * 16 * sizeof(uint16_t));
+
+    // column histograms start with the window rows of y0
+    int top = (y0 - half > 0) ? y0 - half : 0;
+    int bottom = (y0 + half < height - 1) ? y0 + half : height - 1;
+    for (int r = top; r <= bottom; r++) {
+        update_column_histograms(base + (size_t)r * src.stride, width, bpp, col_fine, col_coarse, 1);
+    }
+
+    uint16_t win_fine[256];
+    uint16_t win_coarse[16];
+    int fine_x[16];  // column at which each fine segment was last brought up to date
+
+    for (int y = y0; y < y1; y++) {
+        if (y > y0) {
+            // slide the columns down: drop row y-half-1, add row y+half
+            if (y - half - 1 >= 0) {
+                update_column_histograms(base + (size_t)(y - half - 1) * src.stride, width, bpp,
+                                         col_fine, col_coarse, -1);
+            }
+            if (y + half < height) {
+                update_column_histograms(base + (size_t)(y + half) * src.stride, width, bpp,
+                                         col_fine, col_coarse, 1);
+            }
+        }
+
+        top = (y - half > 0) ? y - half : 0;
+        bottom = (y + half < height - 1) ? y + half : height - 1;
+        int rows = bottom - top + 1;
+
+        // coarse window of x = 0 covers columns [0, half]
+        memset(win_coarse, 0, sizeof(win_coarse));
+        int right = (half < width - 1) ? half : width - 1;
+        for (int c = 0; c <= right; c++) {
+            add_histogram(win_coarse, col_coarse + c * 16, 16);
+        }
+        for (int k = 0; k < 16; k++) {
+            fine_x[k] = -mask_size - 1;
+        }
+
+        uint8_t *out = dst + (size_t)(y - y0) * dst_stride + channel;
+
         for (int x = 0; x < width; x++) {
-            // for each channel (B, G, R)
-            for (int channel = 0; channel < 3; channel++) {
-                int count = 0;
-
-                // collect values from mask area
-                for (int dy = -half; dy <= half; dy++) {
-                    for (int dx = -half; dx <= half; dx++) {
-                        int ny = y + dy;
-                        int nx = x + dx;
-
-                        // check bounds
-                        if (ny >= 0 && ny < height && nx >= 0 && nx < width) {
-                            int idx = ny * row_size + nx * 3 + channel;
-                            mask_values[count++] = original[idx];
-                        }
+            if (x > 0) {
+                // slide the window right: drop column x-half-1, add column x+half
+                if (x - half - 1 >= 0) {
+                    sub_histogram(win_coarse, col_coarse + (x - half - 1) * 16, 16);
+                }
+                if (x + half < width) {
+                    add_histogram(win_coarse, col_coarse + (x + half) * 16, 16);
+                }
+            }
+
+            int left = (x - half > 0) ? x - half : 0;
+            right = (x + half < width - 1) ? x + half : width - 1;
+
+            // same element as sorted[count / 2]
+            int target = rows * (right - left + 1) / 2;
+            int acc = 0;
+            int k = 0;
+            while (acc + win_coarse[k] <= target) {
+                acc += win_coarse[k++];
+            }
+
+            uint16_t *seg = win_fine + k * 16;
+            if (fine_x[k] < x - mask_size) {
+                // segment too stale to slide, rebuild it from the window columns
+                memset(seg, 0, 16 * sizeof(uint16_t));
+                for (int c = left; c <= right; c++) {
+                    add_histogram(seg, col_fine + c * 256 + k * 16, 16);
+                }
+            } else {
+                for (int j = fine_x[k] + 1; j <= x; j++) {
+                    if (j - half - 1 >= 0) {
+                        sub_histogram(seg, col_fine + (j - half - 1) * 256 + k * 16, 16);
+                    }
+                    if (j + half < width) {
+                        add_histogram(seg, col_fine + (j + half) * 256 + k * 16, 16);
                     }
                 }
+            }
+            fine_x[k] = x;
 
-                // sort and get median
-                qsort(mask_values, count, sizeof(uint8_t), compare_uint8);
-                uint8_t median = mask_values[count / 2];
+            int bin = 0;
+            while (acc + seg[bin] <= target) {
+                acc += seg[bin++];
+            }
 
-                // apply median value
-                int idx = y * row_size + x * 3 + channel;
-                img->data[idx] = median;
+            if (x >= x_skip && x < width - x_skip) {
+                out[(x - x_skip) * bpp] = (uint8_t)(k * 16 + bin);
             }
         }
     }
+}
+
+// median using sliding histograms, one channel at a time
+static void median_histogram_rows(ImageView src, uint8_t *dst, int dst_stride,
+                                  int mask_size, int y0, int y1, const MedianScratch *scratch) {
+    if (y0 >= y1) {
+        return;
+    }
 
-    free(mask_values);
-    free(original);
+    // with a filled border, slide over the view grown by half a window on
+    // every side: the windows of its inner pixels are then never clipped
+    int half = mask_size / 2;
+    int x_skip = 0;
+    if (src.border >= half) {
+        src.data -= (ptrdiff_t)half * src.stride + half * src.bpp;
+        src.width += 2 * half;
+        src.height += 2 * half;
+        src.border = 0;
+        y0 += half;
+        y1 += half;
+        x_skip = half;
+    }
+
+    for (int channel = 0; channel < src.bpp; channel++) {
+        median_histogram_channel(src, channel, dst, dst_stride, mask_size, y0, y1, x_skip,
+                                 scratch->col_fine, scratch->col_coarse);
+    }
 }
 
+// vectorized sorting networks for the interior, where the whole window lies
+// inside the image; border rows use the histogram engine and border columns
+// are sorted pixel by pixel
+static void median_network_image_rows(ImageView src, uint8_t *dst, int dst_stride,
+                                int mask_size, int y0, int y1, const MedianScratch *scratch) {
+    int width = src.width;
+    int height = src.height;
+    int bpp = src.bpp;
+    int half = mask_size / 2;
 
-void convert_to_grayscale(BMPImage *img) {
+    // rows [iy0, iy1) have the full window height (all of them when the
+    // border is filled)
+    int full = src.border >= half;
+    int iy0 = (full || y0 > half) ? y0 : half;
+    int iy1 = (full || y1 < height - half) ? y1 : height - half;
+    if (iy0 >= iy1) {
+        iy0 = iy1 = y1;
+    }
+
+    median_histogram_rows(src, dst, dst_stride, mask_size, y0, iy0, scratch);
+
+    // columns [x0, x1) have the full window width
+    int x0 = full ? 0 : half;
+    int x1 = full ? width : width - half;
+    if (iy0 < iy1) {
+        const uint8_t *row = src.data + (size_t)iy0 * src.stride;
+        uint8_t *out = dst + (size_t)(iy0 - y0) * dst_stride;
+        if (x1 <= x0 || median_network_rows(row, src.stride, bpp, out, dst_stride, iy1 - iy0,
+                                            x0 * bpp, x1 * bpp, mask_size, scratch->cols) != 0) {
+            x0 = x1 = width;
+        }
+    }
+
+    for (int y = iy0; y < iy1; y++) {
+        uint8_t *out = dst + (size_t)(y - y0) * dst_stride;
+        median_sort_columns(src, out, y, 0, x0, half, scratch->mask_values);
+        median_sort_columns(src, out, y, x1, width, half, scratch->mask_values);
+    }
+
+    median_histogram_rows(src, dst + (size_t)(iy1 - y0) * dst_stride, dst_stride, mask_size, iy1, y1,
+                          scratch);
+}
+
+// bytes of one scratch buffer, rounded up to keep the next one aligned
+static size_t scratch_part(size_t bytes) {
+    return (bytes + MEDIAN_SCRATCH_ALIGNMENT - 1) & ~(size_t)(MEDIAN_SCRATCH_ALIGNMENT - 1);
+}
+
+size_t median_scratch_size(int width, int bpp, int mask_size) {
+    // the histogram engine slides over the view grown by half a window on
+    // each side, and the network sorts as many columns
+    size_t columns = (size_t)width + 2 * (mask_size / 2);
+    return scratch_part((size_t)mask_size * mask_size) +
+           scratch_part(columns * 256 * sizeof(uint16_t)) +
+           scratch_part(columns * 16 * sizeof(uint16_t)) +
+           scratch_part((size_t)mask_size * columns * bpp);
+}
+
+// carves the buffers of every engine out of one scratch block
+static MedianScratch median_scratch(uint8_t *block, int width, int mask_size) {
+    size_t columns = (size_t)width + 2 * (mask_size / 2);
+    MedianScratch scratch;
+    scratch.mask_values = block;
+    block += scratch_part((size_t)mask_size * mask_size);
+    scratch.col_fine = (uint16_t*)block;
+    block += scratch_part(columns * 256 * sizeof(uint16_t));
+    scratch.col_coarse = (uint16_t*)block;
+    block += scratch_part(columns * 16 * sizeof(uint16_t));
+    scratch.cols = block;
+    return scratch;
+}
+
+void median_filter_rows(ImageView src, uint8_t *dst, int dst_stride,
+                        int mask_size, int y0, int y1, MedianEngine engine) {
+    if (y0 >= y1) {
+        return;
+    }
+
+    uint8_t *scratch = (uint8_t*)malloc(median_scratch_size(src.width, src.bpp, mask_size));
+    median_filter_rows_scratch(src, dst, dst_stride, mask_size, y0, y1, engine, scratch);
+    free(scratch);
+}
+
+void median_filter_rows_scratch(ImageView src, uint8_t *dst, int dst_stride, int mask_size,
+                                int y0, int y1, MedianEngine engine, uint8_t *scratch) {
+    if (y0 >= y1) {
+        return;
+    }
+    MedianScratch buffers = median_scratch(scratch, src.width, mask_size);
+
+    // sorting networks exist for 3x3, 5x5 and 7x7 on SIMD capable CPUs
+    if (engine == MEDIAN_AUTO || engine == MEDIAN_NETWORK) {
+        engine = median_network_supported(mask_size) ? MEDIAN_NETWORK : MEDIAN_HISTOGRAM;
+    }
+
+    // window counts of the histogram engine are 16 bits wide
+    if (engine == MEDIAN_HISTOGRAM && mask_size > 255) {
+        engine = MEDIAN_SORT;
+    }
+
+    switch (engine) {
+        case MEDIAN_NETWORK:
+            median_network_image_rows(src, dst, dst_stride, mask_size, y0, y1, &buffers);
+            break;
+        case MEDIAN_HISTOGRAM:
+            median_histogram_rows(src, dst, dst_stride, mask_size, y0, y1, &buffers);
+            break;
+        case MEDIAN_SORT:
+        default:
+            median_sort_rows(src, dst, dst_stride, mask_size, y0, y1, &buffers);
+            break;
+    }
+}
+
+// view of the padded BGR rows of img
+ImageView bmp_view(const BMPImage *img) {
+    int row_size = ((img->width * 3 + 3) / 4) * 4;
+    ImageView view = { img->data, img->width, img->height, row_size, 3, 0 };
+    return view;
+}
+
+// filters every row of src into dst (separate buffers, same size)
+void median_filter_image(const BMPImage *src, BMPImage *dst, int mask_size, MedianEngine engine) {
+    int row_size = ((src->width * 3 + 3) / 4) * 4;
+    median_filter_rows(bmp_view(src), dst->data, row_size, mask_size, 0, src->height, engine);
+}
+
+
+// converts rows [y0, y1) to gray BGR pixels
+void grayscale_rows(BMPImage *img, int y0, int y1) {
     int width = img->width;
-    int height = img->height;
     int row_size = ((width * 3 + 3) / 4) * 4;
+    uint8_t gray[GRAY_CHUNK];
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * row_size + x * 3;
+    for (int y = y0; y < y1; y++) {
+        uint8_t *row = img->data + (size_t)y * row_size;
 
-            uint8_t B = img->data[idx];
-            uint8_t G = img->data[idx + 1];
-            uint8_t R = img->data[idx + 2];
+        // chunk by chunk, so the luma of a chunk is still in cache when
+        // it is written back to the three channels
+        for (int x = 0; x < width; x += GRAY_CHUNK) {
+            int n = (width - x < GRAY_CHUNK) ? width - x : GRAY_CHUNK;
+            luma_bgr_row(row + x * 3, gray, n);
+            gray_bgr_row(gray, row + x * 3, n);
+        }
+    }
+}
 
-            // standard grayscale formula
-            uint8_t gray = (uint8_t)(0.299 * R + 0.587 * G + 0.114 * B);
+// adds the gray values of rows [y0, y1) to histogram
+void histogram_rows(const BMPImage *img, HistogramCount *histogram, int y0, int y1) {
+    int width = img->width;
+    int row_size = ((width * 3 + 3) / 4) * 4;
 
-            img->data[idx] = gray;     // B
-            img->data[idx + 1] = gray; // G
-            img->data[idx + 2] = gray; // R
-        }
+    // one channel is enough since the image is grayscale
+    if (y0 < y1) {
+        histogram_bytes(img->data + (size_t)y0 * row_size, width, y1 - y0, row_size, 3, histogram);
     }
 }
 
-void equalize_histogram(BMPImage *img) {
+// remaps rows [y0, y1) through the cumulative histogram
+void equalize_rows(BMPImage *img, const HistogramCount *cumulative, HistogramCount total_pixels,
+                   int y0, int y1) {
     int width = img->width;
-    int height = img->height;
     int row_size = ((width * 3 + 3) / 4) * 4;
 
-    // calculate histogram (using one channel since it's grayscale)
-    int histogram[256] = {0};
-    int total_pixels = width * height;
+    // only 256 possible outputs: compute them once
+    uint8_t lut[256];
+    equalization_lut(cumulative, total_pixels, lut);
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * row_size + x * 3;
-            uint8_t gray = img->data[idx];
-            histogram[gray]++;
-        }
+    for (int y = y0; y < y1; y++) {
+        lut_bgr_row(img->data + (size_t)y * row_size, lut, width);
     }
+}
+
+void convert_to_grayscale(BMPImage *img) {
+    grayscale_rows(img, 0, img->height);
+}
+
+void equalize_histogram(BMPImage *img) {
+    HistogramCount histogram[256] = {0};
+    histogram_rows(img, histogram, 0, img->height);
 
     // calculate cumulative histogram
-    int cumulative[256];
+    HistogramCount cumulative[256];
     cumulative[0] = histogram[0];
     for (int i = 1; i < 256; i++) {
         cumulative[i] = cumulative[i - 1] + histogram[i];
     }
 
-    // apply equalization
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * row_size + x * 3;
-            uint8_t gray = img->data[idx];
-
-            // calculate new equalized value
-            uint8_t new_value = (uint8_t)((cumulative[gray] * 255.0) / total_pixels);
-
-            // apply to all three channels
-            img->data[idx] = new_value;
-            img->data[idx + 1] = new_value;
-            img->data[idx + 2] = new_value;
-        }
-    }
+    equalize_rows(img, cumulative, (HistogramCount)img->width * img->height, 0, img->height);
 }
-
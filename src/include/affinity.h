@@ -0,0 +1,24 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include "options.h"
+
+// Thread pinning (--pin): the CPUs the process may run on (after taskset
+// or the binding of mpirun) are ordered from the sysfs topology, and
+// thread t binds itself to CPU t of that order. Both orders place one
+// thread per core before using the second hardware thread of any core;
+// close fills the cores of a socket before the next, spread alternates
+// between sockets. Without topology information the CPUs keep their
+// numbering.
+//
+// Call it from every thread of the first parallel region, e.g.
+//     #pragma omp parallel
+//     pin_thread(mode, omp_get_thread_num());
+
+// binds the calling thread to CPU `thread` of the order of mode (wrapping
+// around when there are more threads than CPUs); the allowed CPUs are read
+// once, by the first call, so every thread must call it before any thread of
+// the process has been pinned. Returns 0, or -1 on failure.
+int pin_thread(PinMode mode, int thread);
+
+#endif
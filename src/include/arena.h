@@ -0,0 +1,38 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator for the per-image buffers of batch runs. Allocations
+// come from one block and are all released together by arena_reset. When
+// an image needs more than the block holds, the excess is served by
+// overflow blocks, and the next reset regrows the main block to the
+// largest total seen. After the largest image, no image allocates again.
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    uint8_t *base;         // main block
+    size_t capacity;
+    size_t used;
+    size_t peak;           // bytes requested since the last reset
+    ArenaBlock *overflow;  // blocks allocated while base was too small
+} Arena;
+
+// empty arena (the first image allocates the main block)
+void arena_init(Arena *a);
+
+// returns size bytes aligned to ARENA_ALIGNMENT, valid until arena_reset
+void* arena_alloc(Arena *a, size_t size);
+
+// releases every allocation; grows the main block to the largest total
+void arena_reset(Arena *a);
+
+// frees all memory of the arena
+void arena_free(Arena *a);
+
+// alignment of every allocation (one cache line)
+#define ARENA_ALIGNMENT 64
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef ASYNC_BATCH_H
+#define ASYNC_BATCH_H
+
+#include "bmp.h"
+#include "arena.h"
+#include "options.h"
+#include "batch.h"
+
+// Triple-buffered batch (--batch=async): a reader thread loads image N+1
+// and a writer thread saves image N-1 while the calling thread (and its
+// OpenMP team) processes image N. The threads pass ASYNC_BATCH_SLOTS
+// slots around through bounded queues; each slot owns the ImageFiles and
+// the arena of the image it holds, so a slot's buffers are only reused
+// once its image is written.
+
+#define ASYNC_BATCH_SLOTS 3
+
+// stages of one image: reads src and writes dst, scratch from arena
+typedef void (*ImageProcessor)(const BMPImage *src, BMPImage *dst, int mask_size,
+                               const Options *opts, Arena *arena);
+
+// runs every image of list through the reader, process and the writer.
+// `name` selects the output paths (see output_path); time_spent receives
+// the wall time spent in process. Returns the number of images that could
+// not be loaded.
+int async_batch(const BatchList *list, const char *name, int mask_size, const Options *opts,
+                ImageProcessor process, double *time_spent);
+
+#endif
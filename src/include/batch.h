@@ -0,0 +1,60 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "bmp.h"
+#include "arena.h"
+#include "options.h"
+
+// Batch runs: the input argument may name a directory (all its .bmp files,
+// in name order), a list file written as @paths.txt (one path per line) or
+// numbered frames written as a pattern such as frames/f_%04d.bmp (from 0
+// or 1 up to the first missing number) instead of a single BMP. All the
+// images are then processed by one process, with their buffers taken from
+// an arena that is reused.
+
+typedef struct {
+    char **paths;
+    int count;
+} BatchList;
+
+// 1 if arg names a batch (a directory, an @list or a frame pattern)
+// rather than one file
+int is_batch_input(const char *arg);
+
+// fills list with the inputs named by arg (just arg for a single file);
+// returns 0, or -1 after printing the error
+int batch_inputs(const char *arg, BatchList *list);
+
+// frees the paths of the list
+void free_batch_list(BatchList *list);
+
+// output path for the binary `name`: output/<name>_<mask>_output.bmp for
+// single runs, output/<name>_<mask>_<input file name> in batches
+void output_path(char *path, size_t size, const char *name, int mask_size,
+                 const char *input_file, int batch);
+
+// input and output of one image: the stages read src and write dst
+typedef struct {
+    BMPImage image;        // stdio: pixels in the arena, src == dst == &image
+    BMPImage *src;
+    BMPImage *dst;
+    MappedBMP *input_map;  // --io=mmap: src and dst are file mappings
+    MappedBMP *output_map;
+} ImageFiles;
+
+// called on the pixel buffer of a stdio image before the file is read
+// into it, to first touch its pages from the threads that will process
+// them (see tiles.h)
+typedef void (*PlaceImageFn)(uint8_t *data, int width, int height, void *ctx);
+
+// loads input_file (into the arena, or mapped with --io=mmap, which also
+// creates the mapped output_file); place (may be NULL) is called with ctx
+// on the arena buffer. Returns 0, or -1 after printing the error.
+int open_image_files(ImageFiles *f, const char *input_file, const char *output_file,
+                     IOMode io, Arena *arena, PlaceImageFn place, void *ctx);
+
+// saves dst to output_file (stdio) or completes the mapped output
+void close_image_files(ImageFiles *f, const char *output_file);
+
+#endif
@@ -10,8 +10,38 @@ typedef struct {
     int width;
     int height;
     uint8_t *data;  // image data (BGR format)
+    int top_down;   // rows stored top to bottom (negative height in the file)
 } BMPImage;
 
+// BMP file mapped into memory; image.data points into the mapping
+typedef struct {
+    BMPImage image;
+    uint8_t *map;
+    size_t map_size;
+} MappedBMP;
+
+// size of the file and info headers written by write_bmp
+#define BMP_HEADER_SIZE 54
+
+// header fields needed to locate the pixel rows in the file
+typedef struct {
+    int width;
+    int height;            // always positive
+    int top_down;          // the header height was negative
+    uint32_t data_offset;  // file offset of the first stored row
+} BMPHeader;
+
+// parses the first BMP_HEADER_SIZE bytes of a file; returns NULL on
+// success or the error message
+const char* parse_bmp_header(const uint8_t *header, BMPHeader *info);
+
+// fills the BMP_HEADER_SIZE-byte header of a 24-bit image
+void make_bmp_header(uint8_t *header, int width, int height, int top_down);
+
+// opens a BMP file, parses its header and leaves the file at the first
+// pixel row; returns NULL after printing the error
+FILE* open_bmp(const char *filename, BMPHeader *info);
+
 // reads a BMP file
 BMPImage* read_bmp(const char *filename);
 
@@ -21,5 +51,15 @@ void write_bmp(const char *filename, BMPImage *img);
 // frees image memory
 void free_bmp(BMPImage *img);
 
+// maps a BMP file read-only (zero-copy load); the image must not be written
+MappedBMP* map_bmp(const char *filename);
+
+// creates filename with the header and size of an image like `like` and
+// maps it for writing; the row padding bytes are copied from like
+MappedBMP* create_mapped_bmp(const char *filename, const BMPImage *like);
+
+// unmaps a mapped file; for create_mapped_bmp this completes the write
+void unmap_bmp(MappedBMP *m);
+
 #endif
 
@@ -0,0 +1,81 @@
+#ifndef HISTEQ_H
+#define HISTEQ_H
+
+#include <stdint.h>
+#include "options.h"
+
+// libhisteq: the median, grayscale and equalization pipeline for programs
+// that hold their pixels in memory (bin/libhisteq.a, bin/libhisteq.so).
+//
+// A context is created once per mask size and options and owns what every
+// call reuses: its OpenMP thread count, the median engine, border and
+// stage order picked from the options, and an arena with the luma plane,
+// the per-thread median scratch and the framed copy a replicated /
+// reflected border needs. Calls read and write the caller's buffers in
+// place, with any row stride; once the arena has grown to the largest
+// image (or histeq_reserve sized it), a call allocates nothing.
+//
+// The output is the same as bin/sequential with the same options: three
+// equal gray channels for a BGR destination, the gray value alone for a
+// gray one. A gray source is taken as the luma itself, so the median runs
+// on its single channel whatever the stage order.
+//
+// Successive calls on one context form a sequence (video frames). With
+// --smooth the LUT comes from an exponentially smoothed histogram of the
+// frames instead of the current one alone, which removes the flicker of
+// frame-by-frame equalization; with --lut-threshold the LUT of the
+// previous frame is kept until the smoothed histogram moves by more than
+// that fraction of the pixels. Both default to 0: every call is then
+// independent and matches bin/sequential.
+
+// pixel layout of a buffer
+typedef enum {
+    HISTEQ_BGR,     // 3 bytes per pixel: B, G, R (as in BMP rows)
+    HISTEQ_GRAY     // 1 byte per pixel
+} HistEqFormat;
+
+// caller-owned pixels: row y starts at data + y * stride, stride >= width
+// times the bytes per pixel
+typedef struct {
+    uint8_t *data;
+    int width;
+    int height;
+    int stride;
+    HistEqFormat format;
+} HistEqImage;
+
+typedef struct HistEqContext HistEqContext;
+
+// frames processed and equalization LUTs built since the sequence began
+typedef struct {
+    long frames;
+    long lut_builds;
+} HistEqStats;
+
+// creates a context for mask_size medians with the median engine, border
+// and order of opts (NULL for the defaults) and its --smooth and
+// --lut-threshold, run by `threads` OpenMP
+// threads (0 for the OpenMP default); the pipeline, layout and schedule
+// options do not apply. Returns NULL if mask_size is not odd and >= 3.
+HistEqContext* histeq_create(int mask_size, const Options *opts, int threads);
+
+// grows the scratch of ctx for images up to width x height, so the first
+// histeq_process of that size does not allocate either
+void histeq_reserve(HistEqContext *ctx, int width, int height);
+
+// filters, converts and equalizes src into dst, which has the same size
+// and may be the same buffer (src is read entirely before dst is
+// written). Returns 0, or -1 if the buffers are invalid or differ in size.
+int histeq_process(HistEqContext *ctx, const HistEqImage *src, const HistEqImage *dst);
+
+// starts a new sequence (e.g. at a scene cut): the next frame builds its
+// LUT from its own histogram
+void histeq_reset_sequence(HistEqContext *ctx);
+
+// counters of the current sequence
+void histeq_stats(const HistEqContext *ctx, HistEqStats *stats);
+
+// frees the context and its scratch
+void histeq_destroy(HistEqContext *ctx);
+
+#endif
@@ -2,13 +2,71 @@
 #define IMAGE_PROCESSING_H
 
 #include "bmp.h"
+#include "luma.h"
 #include <stdint.h>
 
+// median filter implementations (all give the same result)
+typedef enum {
+    MEDIAN_AUTO,       // network when available for the mask size, else histogram
+    MEDIAN_SORT,       // qsort of every window (reference)
+    MEDIAN_HISTOGRAM,  // sliding column/window histograms, cost flat in mask size
+    MEDIAN_NETWORK     // SIMD sorting networks for 3x3, 5x5 and 7x7
+} MedianEngine;
+
+// what the median windows see past the image edges
+typedef enum {
+    BORDER_SHRINK,     // nothing: windows are clipped to the image (default)
+    BORDER_REPLICATE,  // copies of the edge pixels
+    BORDER_REFLECT     // the pixels mirrored around the edge one
+} BorderMode;
+
+// read-only view of an image region: rows are `stride` bytes apart and
+// the same channel of neighbouring pixels is `bpp` bytes apart. `border`
+// pixels around the region may be read as well (see padded.h); with 0
+// the windows are clipped to the region.
+typedef struct {
+    const uint8_t *data;
+    int width;
+    int height;
+    int stride;
+    int bpp;
+    int border;
+} ImageView;
+
 // helper function for qsort
 int compare_uint8(const void *a, const void *b);
 
-// applies N×N median filter to image
-void apply_median_filter(BMPImage *img, int mask_size);
+// view of the padded BGR rows of img, windows clipped to the image
+ImageView bmp_view(const BMPImage *img);
+
+// filters rows [y0, y1) of every channel of src into dst (dst points to
+// row y0); windows that reach past the view and its border only use the
+// neighbours inside them
+void median_filter_rows(ImageView src, uint8_t *dst, int dst_stride,
+                        int mask_size, int y0, int y1, MedianEngine engine);
+
+// bytes of scratch median_filter_rows_scratch needs for views of this
+// width and bpp (any border)
+size_t median_scratch_size(int width, int bpp, int mask_size);
+
+// median_filter_rows with the working buffers of the engines taken from
+// scratch (median_scratch_size bytes, 64-byte aligned) instead of the heap
+void median_filter_rows_scratch(ImageView src, uint8_t *dst, int dst_stride, int mask_size,
+                                int y0, int y1, MedianEngine engine, uint8_t *scratch);
+
+// filters src into dst (for a source that must not be written, such as a
+// read-only mapping)
+void median_filter_image(const BMPImage *src, BMPImage *dst, int mask_size, MedianEngine engine);
+
+// converts rows [y0, y1) to gray BGR pixels
+void grayscale_rows(BMPImage *img, int y0, int y1);
+
+// adds the gray values of rows [y0, y1) to histogram
+void histogram_rows(const BMPImage *img, HistogramCount *histogram, int y0, int y1);
+
+// remaps rows [y0, y1) through the cumulative histogram
+void equalize_rows(BMPImage *img, const HistogramCount *cumulative, HistogramCount total_pixels,
+                   int y0, int y1);
 
 // converts image to grayscale
 void convert_to_grayscale(BMPImage *img);
@@ -17,4 +75,3 @@ void convert_to_grayscale(BMPImage *img);
 void equalize_histogram(BMPImage *img);
 
 #endif
-
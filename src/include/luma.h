@@ -0,0 +1,50 @@
+#ifndef LUMA_H
+#define LUMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Grayscale, histogram and equalization row kernels shared by every pipeline.
+//
+// The luma is computed in integers as (299 R + 587 G + 114 B) / 1000 and
+// matches (uint8_t)(0.299 * R + 0.587 * G + 0.114 * B) in double precision
+// bit for bit: the only inputs where they differ are sums that are exact
+// multiples of 1000 and that the double expression rounds just below, and
+// those are corrected from a bitmap indexed by (R, G). Equalization goes
+// through a 256-entry LUT holding the same double expression as before,
+// so no pixel computes a division. AVX2 versions are picked at run time.
+
+// histogram bins, cumulative counts and pixel totals: 64 bits, so images
+// above 2^31 pixels do not overflow
+typedef int64_t HistogramCount;
+
+// luma of one pixel
+uint8_t luma_pixel(uint8_t b, uint8_t g, uint8_t r);
+
+// luma of `width` interleaved BGR pixels
+void luma_bgr_row(const uint8_t *bgr, uint8_t *luma, int width);
+
+// luma of `count` pixels stored as B, G and R planes
+void luma_planes_row(const uint8_t *b, const uint8_t *g, const uint8_t *r, uint8_t *luma, int count);
+
+// lut[v] = cumulative[v] * 255 / total_pixels, rounded as the per-pixel
+// double expression was
+void equalization_lut(const HistogramCount *cumulative, HistogramCount total_pixels, uint8_t *lut);
+
+// adds to histogram the bytes data[y * stride + x * step] of `rows` rows
+// of `width` values. Counts go to four interleaved 32-bit sub-histograms,
+// so runs of equal bytes do not wait on the previous increment of the same
+// bin, and are added to the 64-bit histogram before they could overflow.
+void histogram_bytes(const uint8_t *data, int width, int rows, size_t stride, int step,
+                     HistogramCount *histogram);
+
+// dst[i] = lut[src[i]] for `count` bytes (dst may be src)
+void lut_row(const uint8_t *src, uint8_t *dst, const uint8_t *lut, int count);
+
+// writes gray[x] to the three channels of `width` BGR pixels
+void gray_bgr_row(const uint8_t *gray, uint8_t *bgr, int width);
+
+// writes lut[B] to the three channels of `width` BGR pixels, in place
+void lut_bgr_row(uint8_t *bgr, const uint8_t *lut, int width);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef MEDIAN_NETWORK_H
+#define MEDIAN_NETWORK_H
+
+#include <stdint.h>
+
+// returns 1 if a sorting-network kernel exists for this mask size on this CPU
+int median_network_supported(int mask_size);
+
+// filters bytes [start, end) of `rows` consecutive rows with vectorized
+// min/max networks specialized for mask_size (3, 5 or 7). src points to the
+// centre row of the first window and dst to its output row; neighbouring
+// pixels are bpp bytes apart and every window must lie inside the image.
+// cols holds the sorted columns of one row: mask_size * (end - start +
+// (mask_size / 2) * 2 * bpp) bytes. Returns 0 on success or -1 if no
+// kernel fits (mask size, CPU or fewer bytes than one vector).
+int median_network_rows(const uint8_t *src, int src_stride, int bpp, uint8_t *dst, int dst_stride,
+                        int rows, int start, int end, int mask_size, uint8_t *cols);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef MEDIAN_WINDOW_H
+#define MEDIAN_WINDOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bmp.h"
+#include "image_processing.h"
+#include "padded.h"
+
+// Median of a band of rows without a copy of the whole image: the source
+// rows are read through a rolling window of strip_rows + mask_size - 1
+// rows (a padded image, with its frame for --border=replicate|reflect).
+// Each strip is filtered from the window into dst, then the window slides
+// down, keeping the mask_size - 1 rows the next strip shares. dst may be
+// src: a row is only overwritten once the window holds its original.
+//
+// Bands of the same image filtered at the same time (one per thread)
+// read the rows below them after the neighbouring band may have
+// overwritten them, so median_window_init saves those halo rows, and
+// every band must be initialized before any band runs.
+
+typedef struct {
+    const BMPImage *src;
+    BMPImage *dst;
+    int mask_size;
+    BorderMode border;
+    MedianEngine engine;
+    int y0, y1;          // rows filtered
+    int strip_rows;      // rows filtered per step
+    PaddedImage window;  // source rows [base, base + strip_rows + mask_size - 1)
+    int base;
+    int held;            // source rows [lo, held) are in the window
+    uint8_t *halo;       // source rows [y1, y1 + mask_size / 2), unpadded
+    uint8_t *scratch;    // median scratch, reused by every strip
+} MedianWindow;
+
+// bytes of one window for mask_size on images `width` pixels wide, with
+// its halo rows and median scratch
+size_t median_window_size(int width, int mask_size, BorderMode border);
+
+// sets up the window of rows [y0, y1) in memory (median_window_size()
+// bytes, aligned to PADDED_ALIGN) and reads its first source rows
+void median_window_init(MedianWindow *w, const BMPImage *src, BMPImage *dst, int mask_size,
+                        BorderMode border, MedianEngine engine, int y0, int y1, uint8_t *memory);
+
+// filters rows [y0, y1) of src into dst strip by strip
+void median_window_run(MedianWindow *w);
+
+#endif
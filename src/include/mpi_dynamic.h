@@ -0,0 +1,31 @@
+#ifndef MPI_DYNAMIC_H
+#define MPI_DYNAMIC_H
+
+#include <mpi.h>
+#include "bmp.h"
+#include "options.h"
+
+// Dynamic row distribution for the MPI binary (--distribute=dynamic):
+// rank 0 only coordinates. It sends each worker a block of rows with its
+// halo, and a worker filters it, converts it to gray, counts it into its
+// histogram and sends the rows back, then gets the next block. Rank 0
+// receives the rows straight into the output image. Each block is a share
+// of the rows still left, weighted by the worker's measured rows per
+// second (guided self-scheduling), so faster nodes take bigger blocks and
+// the blocks shrink toward the end to even out the finish. The histograms
+// are then summed on rank 0, which equalizes the image.
+
+// blocks never get thinner than this (or than the mask)
+#define DYNAMIC_MIN_ROWS 16
+
+// rank 0: hands out the rows of src and collects the gray rows into dst
+// (not src: later blocks still read its rows), then equalizes dst. The
+// blocks and rows of every worker are printed when verbose.
+void dynamic_coordinate(const BMPImage *src, BMPImage *dst, int mask_size, int verbose,
+                        MPI_Comm comm);
+
+// other ranks: filters the blocks of a width x height image until rank 0
+// has no more
+void dynamic_work(int width, int height, int mask_size, const Options *opts, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef MPI_STRIP_H
+#define MPI_STRIP_H
+
+#include <mpi.h>
+#include <stdint.h>
+#include "bmp.h"
+#include "options.h"
+#include "padded.h"
+
+// Row-strip domain decomposition for the MPI binaries: every rank holds
+// only its own rows plus up to `half` halo rows above and below, so memory
+// per rank scales with height / size.
+typedef struct {
+    int width;
+    int height;          // full image height
+    int row_size;        // padded BMP row size
+    MPI_Datatype row_type; // one row; strip messages count rows, not bytes
+    int half;            // halo rows needed by the median (mask_size / 2)
+    int start_y;         // own rows [start_y, end_y) of the full image
+    int end_y;
+    int halo_top;        // halo rows present above / below the own rows
+    int halo_bottom;
+    uint8_t *buffer;     // halo_top + own + halo_bottom rows
+    BMPImage image;      // view of buffer; own rows are [halo_top, halo_top + rows)
+    int halos_ready;     // halo rows hold the neighbours' data
+} Strip;
+
+// processes rows [y0, y1) of strip->image
+typedef void (*strip_rows_fn)(int y0, int y1, void *ctx);
+
+// own rows [start_y, end_y) of rank out of size ranks
+void strip_rows(int height, int rank, int size, int *start_y, int *end_y);
+
+// sets up the strip of this rank and allocates its buffer
+void strip_init(Strip *s, int width, int height, int mask_size, MPI_Comm comm);
+
+// own rows of the strip
+static inline int strip_own_rows(const Strip *s) {
+    return s->end_y - s->start_y;
+}
+
+// first own row of the strip buffer
+static inline uint8_t* strip_own_data(const Strip *s) {
+    return s->buffer + (size_t)s->halo_top * s->row_size;
+}
+
+// distributes the own rows of the image of rank 0 with MPI_Scatterv (img is
+// ignored on other ranks); the halo rows are filled later by the exchange,
+// or here, point-to-point from rank 0, when a strip is thinner than the halo
+void strip_scatter(Strip *s, const BMPImage *img, MPI_Comm comm);
+
+// posts non-blocking sends/receives of the halo rows to/from the neighbours
+void strip_start_halo_exchange(Strip *s, MPI_Comm comm, MPI_Request requests[4]);
+
+// waits for the halo messages posted by strip_start_halo_exchange
+void strip_finish_halo_exchange(Strip *s, MPI_Request requests[4]);
+
+// fills the halo rows with the neighbours' first / last own rows
+void strip_exchange_halos(Strip *s, MPI_Comm comm);
+
+// calls fn on all own rows (as strip->image rows) after the halo exchange;
+// with HALO_OVERLAP the rows that need no halo run while it is in flight
+// and the boundary rows after it completes
+void strip_run_rows(Strip *s, HaloMode mode, strip_rows_fn fn, void *ctx, MPI_Comm comm);
+
+// what the median of the strip reads: the strip buffer, or for a
+// replicated / reflected border a padded copy of it (*padded, freed with
+// free_padded). The copy needs the halos, so they are exchanged first and
+// strip_run_rows then filters every own row at once.
+ImageView strip_median_source(Strip *s, BorderMode border, int mask_size, PaddedImage **padded,
+                              MPI_Comm comm);
+
+// collects `rows` (one own-row block per rank, row_size bytes per row) into
+// img on rank 0 with a single MPI_Gatherv
+void strip_gather(const Strip *s, const uint8_t *rows, BMPImage *img, MPI_Comm comm);
+
+// sums the 256-bin histograms of all ranks and accumulates the result
+void global_cumulative_histogram(const HistogramCount *local_histogram, HistogramCount *cumulative,
+                                 MPI_Comm comm);
+
+// opens filename on every rank, parses its header and reads the strip of
+// this rank (own rows and halo) with one collective MPI-IO read, so the
+// halos need no exchange; returns 0, or -1 after rank 0 printed the error
+int strip_read_bmp(Strip *s, const char *filename, int mask_size, MPI_Comm comm);
+
+// writes `rows` (one own-row block per rank) to filename with one
+// collective MPI-IO write; rank 0 also writes the header
+int strip_write_bmp(const Strip *s, const uint8_t *rows, const char *filename, MPI_Comm comm);
+
+// one image of the MPI binaries: the strip of this rank, the buffer its
+// stages write, and on rank 0 (--io=stdio|mmap) the whole image
+typedef struct {
+    Strip strip;
+    BMPImage out;            // own rows after the stages, row_size bytes each
+    IOMode io;
+    BMPImage *img;           // rank 0: the image read, or the input mapping
+    BMPImage *result;        // rank 0: gather target, img unless --io=mmap
+    MappedBMP *input_map;    // rank 0, --io=mmap
+    MappedBMP *output_map;
+} StripFiles;
+
+// reads input_file and gives every rank its strip (rank 0 reads and
+// scatters it, or with --io=mpiio every rank reads its own rows) and an
+// out buffer carrying the input's row padding; --io=mmap also creates the
+// mapped output_file. *start_time is set on rank 0 once the file is read.
+// Returns 0, or -1 after rank 0 printed the error (a failed read on rank 0
+// aborts the job).
+int strip_load(StripFiles *f, const char *input_file, const char *output_file, int mask_size,
+               IOMode io, double *start_time, MPI_Comm comm);
+
+// collects out into output_file (gathered on rank 0, or written by every
+// rank with --io=mpiio) and frees what strip_load allocated; returns the
+// time since start_time on rank 0, 0 on the other ranks
+double strip_store(StripFiles *f, const char *output_file, double start_time, MPI_Comm comm);
+
+// with --timing, gathers the stage timers of every rank and rank 0 writes
+// them to output/<binary>_<mask_size>_timing.json|csv
+void strip_gather_timing(const Options *opts, const char *binary, int mask_size, MPI_Comm comm);
+
+// frees the strip buffer and its row datatype
+void strip_free(Strip *s);
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "image_processing.h"
+
+// memory layout the stages run on
+typedef enum {
+    LAYOUT_INTERLEAVED,  // padded BGR rows, as stored in the BMP file
+    LAYOUT_PLANAR        // B, G, R and luma planes (see planar.h)
+} ImageLayout;
+
+// how the stages are scheduled over the image
+typedef enum {
+    PIPELINE_STAGED,  // one full-image sweep per stage
+    PIPELINE_FUSED,   // L2-sized strips, median -> luma -> histogram in one pass (see pipeline.h)
+    PIPELINE_STREAM   // sequential only: out-of-core, file to file through a rolling window (see stream.h)
+} PipelineMode;
+
+// how the MPI median stage waits for the halo rows
+typedef enum {
+    HALO_BLOCKING,  // exchange the halos, then filter every row
+    HALO_OVERLAP    // filter the rows that need no halo while the messages travel
+} HaloMode;
+
+// how the image file is read and written
+typedef enum {
+    IO_STDIO,  // read_bmp / write_bmp (on rank 0 for MPI)
+    IO_MMAP,   // input mapped read-only, output written into a mapped file (rank 0 for MPI)
+    IO_MPIIO   // MPI only: every rank reads and writes its own strip with MPI-IO
+} IOMode;
+
+// how batch runs (a directory or an @list) move images through the stages
+typedef enum {
+    BATCH_SERIAL,  // read, process and write one image after the other
+    BATCH_ASYNC    // read N+1 and write N-1 on I/O threads while N is processed (see async_batch.h)
+} BatchMode;
+
+// order of the median and grayscale stages
+typedef enum {
+    ORDER_MEDIAN_FIRST,  // median on B, G and R, then grayscale (reference output)
+    ORDER_LUMA_FIRST     // grayscale, then median on the luma only: 3x less median work, approximate
+} StageOrder;
+
+// how the OpenMP threads share the staged interleaved stages
+typedef enum {
+    SCHEDULE_BANDS,  // one contiguous band of rows per thread
+    SCHEDULE_TILES   // L2-sized tiles, taken from the other threads once a thread is done (see tiles.h)
+} ScheduleMode;
+
+// where the OpenMP threads run (see affinity.h)
+typedef enum {
+    PIN_NONE,    // left to the OS scheduler
+    PIN_CLOSE,   // one core after the other, filling a socket before the next
+    PIN_SPREAD   // cores alternating between the sockets
+} PinMode;
+
+// how the MPI binary shares the rows of one image among the ranks
+typedef enum {
+    DISTRIBUTE_STATIC,  // one strip of height / size rows per rank
+    DISTRIBUTE_DYNAMIC  // rank 0 hands out row blocks on demand, sized by each rank's speed (see mpi_dynamic.h)
+} DistributeMode;
+
+// stage timing file written at the end of the run (see timing.h)
+typedef enum {
+    TIMING_NONE,  // only TEMPO_TOTAL
+    TIMING_JSON,  // output/<binary>_<mask>_timing.json
+    TIMING_CSV    // output/<binary>_<mask>_timing.csv
+} TimingFormat;
+
+// hardware counters added to the stage timing file (see timing.h)
+typedef enum {
+    COUNTERS_NONE,  // wall time only
+    COUNTERS_HW     // cycles, instructions, LLC and branch misses per stage (perf_event_open)
+} CountersMode;
+
+// optional "--name=value" flags accepted by all binaries
+typedef struct {
+    MedianEngine median;  // --median=auto|network|histogram|sort
+    ImageLayout layout;   // --layout=interleaved|planar
+    PipelineMode pipeline;  // --pipeline=staged|fused|stream
+    HaloMode halo;          // --halo=blocking|overlap (MPI only)
+    IOMode io;              // --io=stdio|mmap|mpiio
+    BatchMode batch;        // --batch=serial|async
+    BorderMode border;      // --border=shrink|replicate|reflect
+    StageOrder order;       // --order=median-first|luma-first
+    ScheduleMode schedule;  // --schedule=bands|tiles (OpenMP only)
+    PinMode pin;            // --pin=none|close|spread (OpenMP and hybrid)
+    DistributeMode distribute;  // --distribute=static|dynamic (MPI only)
+    TimingFormat timing;    // --timing=none|json|csv (builds with make TIMING=1)
+    CountersMode counters;  // --counters=none|hw (with --timing)
+    double smooth;          // --smooth=0..1: weight of the past frames in the CDF (libhisteq, sequence)
+    double lut_threshold;   // --lut-threshold=0..1: histogram change that rebuilds the LUT (libhisteq, sequence)
+} Options;
+
+// flag groups only some binaries honour (bits of the `honoured` argument
+// of unsupported_option); the other flags apply everywhere
+#define OPTIONS_PIPELINE    0x01  // --layout=planar, --pipeline=fused|stream
+#define OPTIONS_MPI         0x02  // --halo=overlap, --io=mpiio
+#define OPTIONS_DISTRIBUTE  0x04  // --distribute=dynamic
+#define OPTIONS_SCHEDULE    0x08  // --schedule=tiles
+#define OPTIONS_PIN         0x10  // --pin=close|spread
+#define OPTIONS_BATCH       0x20  // --batch=async
+#define OPTIONS_SEQUENCE    0x40  // --smooth, --lut-threshold
+
+// fills options with the default values
+void options_init(Options *opts);
+
+// parses the flags in argv[first..argc-1]; returns 0 on success or
+// the index of the first invalid argument
+int parse_options(int argc, char *argv[], int first, Options *opts);
+
+// 0 when opts asks for a replicated / reflected border on a schedule that
+// only clips windows (staged planar layout, stream pipeline)
+int border_supported(const Options *opts);
+
+// the first flag of opts, in the form it was given, that belongs to a
+// group outside `honoured` (OPTIONS_* bits), or NULL; a binary rejects it
+// instead of silently ignoring it
+const char* unsupported_option(const Options *opts, int honoured);
+
+// prints the accepted flags
+void print_options_usage(void);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PADDED_H
+#define PADDED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "image_processing.h"
+
+// Working copy of an image for the median: rows hold only width * bpp
+// bytes (the BMP row padding stays in the file buffers) and start on a
+// PADDED_ALIGN boundary, and a frame of `border` pixels surrounds the
+// image. Once the frame is filled (replicate or reflect), every window of
+// up to 2 * border + 1 pixels is complete, so the median kernels run one
+// branch-free loop over the whole image instead of clipping at its edges.
+
+// alignment of the buffer and of the first pixel of every row
+#define PADDED_ALIGN 64
+
+typedef struct {
+    int width;
+    int height;
+    int bpp;
+    int border;       // pixels of frame on every side
+    size_t stride;    // bytes between rows, a multiple of PADDED_ALIGN
+    uint8_t *data;    // pixel (0, 0); the frame lies before and after it
+    uint8_t *block;   // allocation (create_padded only)
+} PaddedImage;
+
+// frame needed by a mask_size median with the given border mode
+static inline int padded_border(BorderMode mode, int mask_size) {
+    return (mode == BORDER_SHRINK) ? 0 : mask_size / 2;
+}
+
+// bytes of a width x height image with the given frame
+size_t padded_size(int width, int height, int bpp, int border);
+
+// lays out p over memory, which holds padded_size() bytes aligned to
+// PADDED_ALIGN (arena_alloc returns such blocks)
+void padded_init(PaddedImage *p, int width, int height, int bpp, int border, uint8_t *memory);
+
+// allocates a padded image
+PaddedImage* create_padded(int width, int height, int bpp, int border);
+
+// frees a padded image from create_padded
+void free_padded(PaddedImage *p);
+
+// copies rows [y0, y1) from src, whose rows are src_stride bytes apart
+// (src points to row 0)
+void padded_copy_rows(PaddedImage *p, const uint8_t *src, size_t src_stride, int y0, int y1);
+
+// image index read for the out-of-range index i of n pixels: replicate
+// repeats the edge pixel (aaa|abc), reflect mirrors around it (cb|abc)
+int padded_border_index(int i, int n, BorderMode mode);
+
+// fills the left and right frame of row y from its pixels
+void padded_fill_row_sides(PaddedImage *p, int y, BorderMode mode);
+
+// fills the frame from the image pixels; BORDER_SHRINK leaves it untouched
+void padded_fill_border(PaddedImage *p, BorderMode mode);
+
+// view of the image; its border field tells the kernels how much of the
+// frame they may read
+ImageView padded_view(const PaddedImage *p, BorderMode mode);
+
+#endif
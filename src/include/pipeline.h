@@ -0,0 +1,58 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "bmp.h"
+#include "image_processing.h"
+#include "options.h"
+#include "arena.h"
+#include "padded.h"
+#include <stdint.h>
+
+// Fused pipeline: instead of three full-image sweeps, rows are processed in
+// strips small enough for L2. Pass 1 filters a strip into a scratch buffer,
+// converts it to luma and counts the histogram while the strip is still in
+// cache; pass 2 remaps the luma through the equalization LUT into the image.
+// The source image is only read in pass 1, so no copy of it is needed.
+
+// number of rows per strip so one strip fits in half of L2
+int fused_strip_rows(int width, int mask_size);
+
+// bytes of scratch fused_median_luma_rows or luma_median_rows need for
+// images of this width (the filtered strip and the median buffers)
+size_t fused_scratch_size(int width, int mask_size);
+
+// pass 1 over rows [y0, y1): median, luma (one byte per pixel, luma[0] is
+// row y0) and histogram, strip by strip. scratch holds fused_scratch_size
+// bytes (64-byte aligned), or is NULL to allocate them for this call.
+void fused_median_luma_rows(ImageView src, uint8_t *luma, HistogramCount *histogram,
+                            int mask_size, int y0, int y1, MedianEngine engine, uint8_t *scratch);
+
+// builds the equalization LUT from the histogram of total_pixels pixels
+void build_equalization_lut(const HistogramCount *histogram, HistogramCount total_pixels, uint8_t *lut);
+
+// pass 2 over rows [y0, y1): writes lut[luma] to all three channels
+void fused_equalize_rows(BMPImage *img, const uint8_t *luma, const uint8_t *lut, int y0, int y1);
+
+// Luma-first order (--order=luma-first): the image is converted to one
+// luma byte per pixel first, and the median runs on that single plane
+// instead of on B, G and R, a third of the work. The median of the luma
+// is not the luma of the per-channel medians, so the output differs
+// slightly from the reference order (see bin/psnr).
+
+// luma of src rows [y0, y1) into the same rows of plane (bpp 1)
+void luma_plane_rows(const BMPImage *src, PaddedImage *plane, int y0, int y1);
+
+// median of plane rows [y0, y1) into filtered (width bytes per row,
+// filtered[0] is row y0), counting the filtered values into histogram;
+// scratch as for fused_median_luma_rows
+void luma_median_rows(ImageView plane, uint8_t *filtered, HistogramCount *histogram,
+                      int mask_size, int y0, int y1, MedianEngine engine, uint8_t *scratch);
+
+// runs median, grayscale and equalization on one image with the schedule
+// and layout of opts, single-threaded: reads src and writes dst (which may
+// be the same image). Scratch buffers come from arena; the stage messages
+// are printed when verbose.
+void process_image(const BMPImage *src, BMPImage *dst, int mask_size, const Options *opts,
+                   Arena *arena, int verbose);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef PLANAR_H
+#define PLANAR_H
+
+#include "bmp.h"
+#include "image_processing.h"
+#include <stdint.h>
+
+// planar copy of an image: one unpadded plane per channel plus a luma
+// plane, so every stage walks memory with unit stride
+typedef struct {
+    int width;
+    int height;
+    uint8_t *plane[3];  // B, G, R
+    uint8_t *luma;      // grayscale result
+} PlanarImage;
+
+// bytes of the block holding the four planes of a width x height image
+size_t planar_size(int width, int height);
+
+// sets up p on a caller-owned block of planar_size(width, height) bytes
+void planar_init(PlanarImage *p, int width, int height, uint8_t *memory);
+
+// allocates a planar image (all four planes in one block)
+PlanarImage* create_planar(int width, int height);
+
+// frees planar image memory
+void free_planar(PlanarImage *p);
+
+// writes the luma plane back into the interleaved image as gray pixels
+void planar_to_bmp(const PlanarImage *p, BMPImage *img);
+
+// computes the luma plane
+void planar_grayscale(PlanarImage *p);
+
+// equalizes the histogram of the luma plane
+void planar_equalize_histogram(PlanarImage *p);
+
+// splits rows [y0, y1) of the interleaved image into the B, G and R planes
+void bmp_to_planar_rows(const BMPImage *img, PlanarImage *p, int y0, int y1);
+
+// writes the luma of rows [y0, y1) back as gray BGR pixels
+void luma_to_bmp_rows(const PlanarImage *p, BMPImage *img, int y0, int y1);
+
+// median filters rows [y0, y1) of the B, G and R planes of src into dst
+void planar_median_rows(const PlanarImage *src, PlanarImage *dst, int mask_size,
+                        int y0, int y1, MedianEngine engine);
+
+// computes the luma plane of rows [y0, y1) from the B, G and R planes
+void planar_grayscale_rows(PlanarImage *p, int y0, int y1);
+
+// adds the luma values of rows [y0, y1) to histogram
+void planar_histogram_rows(const PlanarImage *p, HistogramCount *histogram, int y0, int y1);
+
+// remaps the luma of rows [y0, y1) through the cumulative histogram
+void planar_equalize_rows(PlanarImage *p, const HistogramCount *cumulative, HistogramCount total_pixels,
+                          int y0, int y1);
+
+#endif
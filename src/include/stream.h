@@ -0,0 +1,18 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "image_processing.h"
+
+// Out-of-core pipeline: the image is never loaded whole. Pass 1 reads the
+// input in strips through a rolling window of strip + mask_size - 1 rows,
+// filters each strip, and writes its luma to the output file as gray
+// pixels while the histogram is counted. Pass 2 reads the output back
+// strip by strip, remaps it through the equalization LUT and writes it in
+// place. Peak memory is O(width x (strip rows + mask_size)).
+
+// runs both passes from input_file into output_file; returns 0 on success
+// or -1 after printing the error. The pass messages are printed when verbose.
+int stream_pipeline(const char *input_file, const char *output_file,
+                    int mask_size, MedianEngine engine, int verbose);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bmp.h"
+#include "image_processing.h"
+
+// Tile schedule of the OpenMP binary (--schedule=tiles): the image is cut
+// into tiles small enough for L2 (full rows unless the image is wider than
+// TILE_MAX_WIDTH), and every thread owns the tiles of one contiguous band
+// of tile rows, its home band. A thread takes its own tiles from the
+// front of its queue; once they run out it steals from the back of the
+// other threads' queues, so a thread slowed down (costlier rows, a busy
+// core) is helped instead of the whole team waiting for it.
+//
+// The home bands are the same in every stage, and the buffers the stages
+// write are first touched by the thread of each home band, so on NUMA
+// machines most tiles are processed next to their memory.
+
+// images up to this many pixels wide are cut into full-row tiles
+#define TILE_MAX_WIDTH 2048
+
+// width of the tiles of wider images (a multiple of 64 bytes)
+#define TILE_WIDTH 1024
+
+typedef struct {
+    int x0, y0;  // first column and row
+    int x1, y1;  // one past the last
+} Tile;
+
+// tiles [front, back) of one thread, packed in one word so the owner and
+// the thieves both claim a tile with a single compare-and-swap
+typedef struct {
+    uint64_t range;
+    char pad[56];  // one queue per cache line
+} TileQueue;
+
+typedef struct {
+    int width, height;
+    int tile_width, tile_height;
+    int columns, rows;    // tiles across and down
+    int threads;
+    TileQueue *queues;    // one per thread
+} TileGrid;
+
+// cuts a width x height image for a mask_size median among `threads`
+// threads; the same arguments always give the same grid
+void tile_grid_init(TileGrid *grid, int width, int height, int mask_size, int threads);
+
+// frees the queues
+void tile_grid_free(TileGrid *grid);
+
+// refills every queue with its home tiles; call before each pass, while
+// no thread takes tiles
+void tile_grid_reset(TileGrid *grid);
+
+// rows [y0, y1) of the home band of thread
+void tile_grid_home_rows(const TileGrid *grid, int thread, int *y0, int *y1);
+
+// next tile for thread: its own, or one stolen from another thread;
+// returns 0, or -1 when no tile is left in any queue
+int tile_grid_next(TileGrid *grid, int thread, Tile *tile);
+
+// writes one byte of every page of [data, data + size), so the pages are
+// placed on the memory node of the calling thread
+void first_touch(uint8_t *data, size_t size);
+
+// median of the tile's pixels of src into dst (same size as src). Tiles
+// narrower than an unframed src are filtered with half a window of
+// neighbouring columns into scratch (tile_scratch_size() bytes) and copied.
+void tile_median(ImageView src, BMPImage *dst, const Tile *tile, int mask_size,
+                 MedianEngine engine, uint8_t *scratch);
+
+// bytes of scratch tile_median needs for the tiles of grid
+size_t tile_scratch_size(const TileGrid *grid, int mask_size);
+
+// converts the tile to gray BGR and adds it to histogram
+void tile_grayscale_histogram(BMPImage *img, const Tile *tile, HistogramCount *histogram);
+
+// remaps the gray pixels of the tile through lut
+void tile_equalize(BMPImage *img, const Tile *tile, const uint8_t *lut);
+
+#endif
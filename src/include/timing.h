@@ -0,0 +1,107 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "options.h"
+
+// Stage timers (--timing=json|csv). They only exist in builds made with
+// `make TIMING=1` (-DENABLE_TIMING); otherwise TIMING_START and
+// TIMING_STOP expand to nothing, so the stages carry no timer calls.
+//
+// Each thread adds the wall time it spends in a stage to its own slot
+// (slots are one cache line apart), keyed by its OpenMP thread number.
+// Time spent inside MPI calls is recorded as STAGE_MPI, apart from the
+// stage that made the call. The MPI binaries gather the slots of every
+// rank on rank 0, which writes the file.
+//
+// With --counters=hw each timer also reads the hardware counters of its
+// thread (perf_event_open, user space only), so every stage gets the
+// cycles, instructions, LLC misses and branch misses it spent. A thread
+// whose counters cannot be opened records the time alone.
+
+typedef enum {
+    STAGE_READ,       // loading the image (and scattering it, for MPI)
+    STAGE_MEDIAN,     // median filter (fused modes: with luma and histogram)
+    STAGE_GRAYSCALE,
+    STAGE_HISTOGRAM,
+    STAGE_EQUALIZE,
+    STAGE_WRITE,
+    STAGE_MPI,        // inside MPI calls: halos, reductions, scatter / gather
+    STAGE_TOTAL,      // the stages of one image, as in TEMPO_TOTAL
+    STAGE_COUNT
+} TimingStage;
+
+// hardware counters read by each timer with --counters=hw
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT
+} TimingCounter;
+
+// start of a timed stage
+typedef struct {
+    double seconds;
+    uint64_t counters[COUNTER_COUNT];
+    int counted;    // counters holds this thread's counters
+} TimingMark;
+
+// threads with their own slot; higher thread numbers are not recorded
+#define TIMING_MAX_THREADS 256
+
+// doubles per thread and stage: seconds, calls, calls with counters, counters
+#define TIMING_FIELDS (3 + COUNTER_COUNT)
+
+// doubles exported per process by timing_export
+#define TIMING_VALUES (TIMING_MAX_THREADS * STAGE_COUNT * TIMING_FIELDS)
+
+// monotonic wall clock in seconds (also without ENABLE_TIMING)
+double wall_time(void);
+
+#ifdef ENABLE_TIMING
+#define TIMING_ENABLED 1
+#define TIMING_START(t) TimingMark t; timing_start(&t)
+#define TIMING_STOP(t, stage, thread) timing_stop(&(t), (stage), (thread))
+#define TIMING_RECORD(stage, thread, seconds) timing_add((stage), (thread), (seconds))
+#else
+#define TIMING_ENABLED 0
+#define TIMING_START(t)
+#define TIMING_STOP(t, stage, thread)
+#define TIMING_RECORD(stage, thread, seconds)
+#endif
+
+// turns on the hardware counters when opts asks for them, probing them on
+// the calling thread; prints a warning (when verbose) if they are not
+// available, and the run then records the time alone
+void timing_init(const Options *opts, int verbose);
+
+// marks the start of a stage on the calling thread
+void timing_start(TimingMark *mark);
+
+// adds the time (and counters) since mark to stage of thread
+void timing_stop(const TimingMark *mark, TimingStage stage, int thread);
+
+// adds seconds (and one call) to stage of thread
+void timing_add(TimingStage stage, int thread, double seconds);
+
+// copies the slots of this process into values (TIMING_VALUES doubles)
+void timing_export(double *values);
+
+// output/<binary>_<mask_size>_timing.json or .csv
+void timing_path(char *path, size_t size, const char *binary, int mask_size, TimingFormat format);
+
+// writes the slots of `ranks` processes (their timing_export values one
+// after the other) to path; returns 0, or -1 after printing the error
+int timing_write(const char *path, TimingFormat format, const char *binary, int mask_size,
+                 int ranks, const double *values);
+
+// 1 when opts asks for a timing file and the build has the timers; prints
+// a warning (when verbose) if it asks for one without them
+int timing_requested(const Options *opts, int verbose);
+
+// writes the timing file of a single-process binary, if requested
+void timing_finish(const Options *opts, const char *binary, int mask_size);
+
+#endif
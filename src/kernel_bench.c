@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+#include "image_processing.h"
+#include "timing.h"
+
+// Microbenchmarks of the kernels of image_processing.c on one image: each
+// runs `warmup` times untimed, then `repetitions` timed runs. Reports the
+// median and 95th percentile of the runs and the throughput over the BGR
+// pixel bytes of the image, and writes the same rows to kernel_metrics.csv.
+
+#define CSV_FILE "kernel_metrics.csv"
+
+// the sort engine takes minutes on large images: only up to this many pixels
+#define SORT_MAX_PIXELS (4L * 1024 * 1024)
+
+typedef struct {
+    const BMPImage *src;
+    BMPImage *work;     // median output, then what the other kernels work on
+    int mask_size;
+    MedianEngine engine;
+    HistogramCount histogram[256];
+    HistogramCount cumulative[256];
+} BenchContext;
+
+typedef void (*KernelFn)(BenchContext *b);
+
+static void run_median(BenchContext *b) {
+    median_filter_image(b->src, b->work, b->mask_size, b->engine);
+}
+
+// the grayscale and equalize kernels write in place: they cost the same on
+// pixels that are already gray
+static void run_grayscale(BenchContext *b) {
+    grayscale_rows(b->work, 0, b->work->height);
+}
+
+static void run_histogram(BenchContext *b) {
+    memset(b->histogram, 0, sizeof(b->histogram));
+    histogram_rows(b->work, b->histogram, 0, b->work->height);
+}
+
+static void run_equalize(BenchContext *b) {
+    equalize_rows(b->work, b->cumulative, (HistogramCount)b->work->width * b->work->height, 0,
+                  b->work->height);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// times fn and prints / appends its row
+static void bench_kernel(const char *kernel, const char *engine, KernelFn fn, BenchContext *b,
+                         int warmup, int repetitions, FILE *csv) {
+    for (int i = 0; i < warmup; i++) {
+        fn(b);
+    }
+
+    double *times = (double*)malloc(sizeof(double) * repetitions);
+    for (int i = 0; i < repetitions; i++) {
+        double start = wall_time();
+        fn(b);
+        times[i] = wall_time() - start;
+    }
+    qsort(times, repetitions, sizeof(double), compare_double);
+
+    double median = (repetitions % 2) ? times[repetitions / 2]
+                                      : (times[repetitions / 2 - 1] + times[repetitions / 2]) / 2;
+    int p95_index = (95 * repetitions + 99) / 100 - 1;
+    double p95 = times[p95_index];
+    double bytes = 3.0 * b->src->width * b->src->height;
+    double throughput = bytes / median / 1e6;
+
+    printf("%-10s %-10s %12.6f %12.6f %12.1f\n", kernel, engine, median, p95, throughput);
+    fprintf(csv, "%s,%s,%dx%d,%d,%d,%d,%.6f,%.6f,%.1f\n", kernel, engine, b->mask_size, b->mask_size,
+            b->src->width, b->src->height, repetitions, median, p95, throughput);
+    free(times);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Uso: %s <arquivo_entrada> [tamanho_mascara] [repetições] [aquecimento]\n", argv[0]);
+        printf("Mede cada kernel de image_processing.c (padrão: máscara 3, 10 repetições, 2 de aquecimento)\n");
+        printf("Exemplo: %s output/bench_4096.bmp 5 20 3\n", argv[0]);
+        return 1;
+    }
+
+    int mask_size = (argc > 2) ? atoi(argv[2]) : 3;
+    int repetitions = (argc > 3) ? atoi(argv[3]) : 10;
+    int warmup = (argc > 4) ? atoi(argv[4]) : 2;
+    if (mask_size % 2 == 0 || mask_size < 3) {
+        printf("Tamanho da máscara deve ser ímpar e >= 3\n");
+        return 1;
+    }
+    if (repetitions < 1 || warmup < 0) {
+        printf("Repetições devem ser >= 1 e aquecimento >= 0\n");
+        return 1;
+    }
+
+    BMPImage *src = read_bmp(argv[1]);
+    if (!src) {
+        return 1;
+    }
+    int row_size = ((src->width * 3 + 3) / 4) * 4;
+    BMPImage work = *src;
+    work.data = (uint8_t*)malloc((size_t)row_size * src->height);
+    memcpy(work.data, src->data, (size_t)row_size * src->height);
+
+    FILE *csv = fopen(CSV_FILE, "w");
+    if (!csv) {
+        printf("Erro ao criar arquivo: %s\n", CSV_FILE);
+        return 1;
+    }
+    fprintf(csv, "Kernel,Motor,Máscara,Largura,Altura,Repetições,Mediana (s),P95 (s),MB/s\n");
+
+    printf("Imagem: %s (%dx%d), máscara %dx%d, %d repetições, %d de aquecimento\n", argv[1],
+           src->width, src->height, mask_size, mask_size, repetitions, warmup);
+    printf("%-10s %-10s %12s %12s %12s\n", "Kernel", "Motor", "Mediana (s)", "P95 (s)", "MB/s");
+
+    BenchContext b;
+    b.src = src;
+    b.work = &work;
+    b.mask_size = mask_size;
+
+    static const struct { MedianEngine engine; const char *name; } engines[] = {
+        { MEDIAN_NETWORK, "network" }, { MEDIAN_HISTOGRAM, "histogram" }, { MEDIAN_SORT, "sort" }
+    };
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (engines[i].engine == MEDIAN_SORT && (long)src->width * src->height > SORT_MAX_PIXELS) {
+            printf("%-10s %-10s omitido: imagem acima de %ld pixels\n", "median", "sort", SORT_MAX_PIXELS);
+            continue;
+        }
+        b.engine = engines[i].engine;
+        bench_kernel("median", engines[i].name, run_median, &b, warmup, repetitions, csv);
+    }
+
+    // the other kernels run on the filtered image, as in the pipeline
+    bench_kernel("grayscale", "-", run_grayscale, &b, warmup, repetitions, csv);
+    bench_kernel("histogram", "-", run_histogram, &b, warmup, repetitions, csv);
+
+    b.cumulative[0] = b.histogram[0];
+    for (int i = 1; i < 256; i++) {
+        b.cumulative[i] = b.cumulative[i - 1] + b.histogram[i];
+    }
+    bench_kernel("equalize", "-", run_equalize, &b, warmup, repetitions, csv);
+
+    fclose(csv);
+    printf("Resultados salvos em: %s\n", CSV_FILE);
+
+    free(work.data);
+    free_bmp(src);
+    return 0;
+}
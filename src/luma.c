@@ -0,0 +1,476 @@
+#include "luma.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// (299 R + 587 G + 114 B) / 1000 == ((sum >> 3) * LUMA_DIV_MUL) >> LUMA_DIV_SHIFT
+// for every sum up to 255000
+#define LUMA_DIV_MUL 33555
+#define LUMA_DIV_SHIFT 22
+
+// interleaved sub-histograms of histogram_bytes
+#define HISTOGRAM_LANES 4
+
+// bit (R << 8 | G) is set when the one B that makes the sum a multiple of
+// 1000 gives a double luma one below the exact quotient
+static uint32_t exceptions[65536 / 32];
+static pthread_once_t exceptions_once = PTHREAD_ONCE_INIT;
+
+// fills the exception bitmap (once per process)
+static void build_exceptions(void) {
+    // 114 * B mod 1000 is distinct for every B in [0, 255]
+    int b_for[1000];
+    for (int i = 0; i < 1000; i++) {
+        b_for[i] = -1;
+    }
+    for (int b = 0; b < 256; b++) {
+        b_for[(114 * b) % 1000] = b;
+    }
+
+    for (int r = 0; r < 256; r++) {
+        for (int g = 0; g < 256; g++) {
+            int b = b_for[(1000 - (299 * r + 587 * g) % 1000) % 1000];
+            if (b < 0) {
+                continue;
+            }
+            int sum = 299 * r + 587 * g + 114 * b;
+            uint8_t R = (uint8_t)r, G = (uint8_t)g, B = (uint8_t)b;
+            // the grayscale formula the integer kernel replaces
+            if ((uint8_t)(0.299 * R + 0.587 * G + 0.114 * B) != sum / 1000) {
+                exceptions[(r << 3) | (g >> 5)] |= 1u << (g & 31);
+            }
+        }
+    }
+}
+
+static inline void init_exceptions(void) {
+    pthread_once(&exceptions_once, build_exceptions);
+}
+
+// integer luma with the exception correction
+static inline uint8_t luma_exact(uint32_t b, uint32_t g, uint32_t r) {
+    uint32_t sum = 299 * r + 587 * g + 114 * b;
+    uint32_t q = ((sum >> 3) * LUMA_DIV_MUL) >> LUMA_DIV_SHIFT;
+    uint32_t bit = (exceptions[(r << 3) | (g >> 5)] >> (g & 31)) & 1;
+    return (uint8_t)(q - ((sum == q * 1000) & bit));
+}
+
+// luma of one pixel
+uint8_t luma_pixel(uint8_t b, uint8_t g, uint8_t r) {
+    init_exceptions();
+    return luma_exact(b, g, r);
+}
+
+#ifdef HAVE_X86_KERNELS
+
+#define TARGET __attribute__((target("avx2")))
+
+// luma of 8 pixels held as 32-bit lanes
+TARGET static inline __m256i luma8_avx2(__m256i b, __m256i g, __m256i r) {
+    __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(r, _mm256_set1_epi32(299)),
+                                                    _mm256_mullo_epi32(g, _mm256_set1_epi32(587))),
+                                   _mm256_mullo_epi32(b, _mm256_set1_epi32(114)));
+    __m256i q = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(sum, 3),
+                                                     _mm256_set1_epi32(LUMA_DIV_MUL)), LUMA_DIV_SHIFT);
+
+    // exact multiples of 1000 are rare outside gray input: only then look
+    // up the exception bits
+    __m256i exact = _mm256_cmpeq_epi32(sum, _mm256_mullo_epi32(q, _mm256_set1_epi32(1000)));
+    if (!_mm256_testz_si256(exact, exact)) {
+        __m256i index = _mm256_or_si256(_mm256_slli_epi32(r, 3), _mm256_srli_epi32(g, 5));
+        __m256i words = _mm256_i32gather_epi32((const int*)exceptions, index, 4);
+        __m256i bit = _mm256_srlv_epi32(words, _mm256_and_si256(g, _mm256_set1_epi32(31)));
+        bit = _mm256_and_si256(bit, _mm256_set1_epi32(1));
+        q = _mm256_sub_epi32(q, _mm256_and_si256(exact, bit));
+    }
+    return q;
+}
+
+// luma of 16 pixels given as 16-byte B, G and R vectors
+TARGET static inline __m128i luma16_avx2(__m128i b, __m128i g, __m128i r) {
+    __m256i lo = luma8_avx2(_mm256_cvtepu8_epi32(b), _mm256_cvtepu8_epi32(g), _mm256_cvtepu8_epi32(r));
+    __m256i hi = luma8_avx2(_mm256_cvtepu8_epi32(_mm_srli_si128(b, 8)),
+                            _mm256_cvtepu8_epi32(_mm_srli_si128(g, 8)),
+                            _mm256_cvtepu8_epi32(_mm_srli_si128(r, 8)));
+    __m128i lo16 = _mm_packus_epi32(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1));
+    __m128i hi16 = _mm_packus_epi32(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1));
+    return _mm_packus_epi16(lo16, hi16);
+}
+
+// one channel of 16 BGR pixels (48 bytes in a0, a1, a2)
+#define GATHER_CHANNEL(a0, a1, a2, m0, m1, m2) \
+    _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a0, m0), _mm_shuffle_epi8(a1, m1)), _mm_shuffle_epi8(a2, m2))
+
+// 16 BGR pixels per step; returns the pixels done
+TARGET static int luma_bgr_row_avx2(const uint8_t *bgr, uint8_t *luma, int width) {
+    const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i r0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t *p = bgr + (size_t)x * 3;
+        __m128i a0 = _mm_loadu_si128((const __m128i*)p);
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(p + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i*)(p + 32));
+        __m128i b = GATHER_CHANNEL(a0, a1, a2, b0, b1, b2);
+        __m128i g = GATHER_CHANNEL(a0, a1, a2, g0, g1, g2);
+        __m128i r = GATHER_CHANNEL(a0, a1, a2, r0, r1, r2);
+        _mm_storeu_si128((__m128i*)(luma + x), luma16_avx2(b, g, r));
+    }
+    return x;
+}
+
+// 16 pixels per step; returns the pixels done
+TARGET static int luma_planes_row_avx2(const uint8_t *b, const uint8_t *g, const uint8_t *r,
+                                       uint8_t *luma, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i vg = _mm_loadu_si128((const __m128i*)(g + i));
+        __m128i vr = _mm_loadu_si128((const __m128i*)(r + i));
+        _mm_storeu_si128((__m128i*)(luma + i), luma16_avx2(vb, vg, vr));
+    }
+    return i;
+}
+
+// the 256-entry LUT as 16 16-byte tables, both lanes
+TARGET static inline void load_lut_tables(const uint8_t *lut, __m256i *table) {
+    for (int h = 0; h < 16; h++) {
+        table[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(lut + h * 16)));
+    }
+}
+
+// lut[v] for 32 bytes: one shuffle per table, selected by the high nibble
+TARGET static inline __m256i lut32_avx2(__m256i v, const __m256i *table) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i lo = _mm256_and_si256(v, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    __m256i result = _mm256_setzero_si256();
+    for (int h = 0; h < 16; h++) {
+        __m256i hit = _mm256_cmpeq_epi8(hi, _mm256_set1_epi8((char)h));
+        result = _mm256_blendv_epi8(result, _mm256_shuffle_epi8(table[h], lo), hit);
+    }
+    return result;
+}
+
+// 32 bytes per step; returns the bytes done
+TARGET static int lut_row_avx2(const uint8_t *src, uint8_t *dst, const uint8_t *lut, int count) {
+    __m256i table[16];
+    load_lut_tables(lut, table);
+
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), lut32_avx2(v, table));
+    }
+    return i;
+}
+
+// writes each byte of v three times to the 48 bytes at p
+TARGET static inline void store_gray16(uint8_t *p, __m128i v) {
+    const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    _mm_storeu_si128((__m128i*)p, _mm_shuffle_epi8(v, m0));
+    _mm_storeu_si128((__m128i*)(p + 16), _mm_shuffle_epi8(v, m1));
+    _mm_storeu_si128((__m128i*)(p + 32), _mm_shuffle_epi8(v, m2));
+}
+
+// 16 pixels per step; returns the pixels done
+TARGET static int gray_bgr_row_avx2(const uint8_t *gray, uint8_t *bgr, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        store_gray16(bgr + (size_t)x * 3, _mm_loadu_si128((const __m128i*)(gray + x)));
+    }
+    return x;
+}
+
+// B channel of the 16 BGR pixels at p
+TARGET static inline __m128i load_blue16(const uint8_t *p) {
+    const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    __m128i a0 = _mm_loadu_si128((const __m128i*)p);
+    __m128i a1 = _mm_loadu_si128((const __m128i*)(p + 16));
+    __m128i a2 = _mm_loadu_si128((const __m128i*)(p + 32));
+    return GATHER_CHANNEL(a0, a1, a2, b0, b1, b2);
+}
+
+// 32 pixels per step; returns the pixels done
+TARGET static int lut_bgr_row_avx2(uint8_t *bgr, const uint8_t *lut, int width) {
+    __m256i table[16];
+    load_lut_tables(lut, table);
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        uint8_t *p = bgr + (size_t)x * 3;
+        __m256i v = _mm256_set_m128i(load_blue16(p + 48), load_blue16(p));
+        v = lut32_avx2(v, table);
+        store_gray16(p, _mm256_castsi256_si128(v));
+        store_gray16(p + 48, _mm256_extracti128_si256(v, 1));
+    }
+    return x;
+}
+
+#undef TARGET
+
+#define TARGET __attribute__((target("ssse3")))
+
+// luma of 8 pixels held as 16-bit lanes; sets *exact to the lanes whose
+// sum is a multiple of 1000
+TARGET static inline __m128i luma8_ssse3(__m128i b, __m128i g, __m128i r, __m128i *exact) {
+    // 16-bit weights; pmaddubsw would need them in signed 8 bits, so the
+    // dot product is pmaddwd over (B, G) and (R, 0) pairs
+    const __m128i bg_weights = _mm_set1_epi32(587 << 16 | 114);
+    const __m128i r_weight = _mm_set1_epi32(299);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum_lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(b, g), bg_weights),
+                                   _mm_madd_epi16(_mm_unpacklo_epi16(r, zero), r_weight));
+    __m128i sum_hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(b, g), bg_weights),
+                                   _mm_madd_epi16(_mm_unpackhi_epi16(r, zero), r_weight));
+
+    // sum >> 3 is at most 31875, so it packs to 16 bits and pmulhuw does
+    // the first 16 bits of the LUMA_DIV_SHIFT shift
+    __m128i eighth = _mm_packs_epi32(_mm_srli_epi32(sum_lo, 3), _mm_srli_epi32(sum_hi, 3));
+    __m128i q = _mm_srli_epi16(_mm_mulhi_epu16(eighth, _mm_set1_epi16((short)LUMA_DIV_MUL)),
+                               LUMA_DIV_SHIFT - 16);
+
+    // sum == 1000 q  <=>  sum & 7 == 0 and sum >> 3 == 125 q; the low bits
+    // survive the 16-bit wrap
+    __m128i sum16 = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(299)),
+                                                _mm_mullo_epi16(g, _mm_set1_epi16(587))),
+                                  _mm_mullo_epi16(b, _mm_set1_epi16(114)));
+    __m128i low_zero = _mm_cmpeq_epi16(_mm_and_si128(sum16, _mm_set1_epi16(7)), zero);
+    *exact = _mm_and_si128(low_zero, _mm_cmpeq_epi16(eighth, _mm_mullo_epi16(q, _mm_set1_epi16(125))));
+    return q;
+}
+
+// luma of 16 pixels given as 16-byte B, G and R vectors
+TARGET static inline __m128i luma16_ssse3(__m128i b, __m128i g, __m128i r) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i exact_lo, exact_hi;
+    __m128i lo = luma8_ssse3(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(g, zero),
+                             _mm_unpacklo_epi8(r, zero), &exact_lo);
+    __m128i hi = luma8_ssse3(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(g, zero),
+                             _mm_unpackhi_epi8(r, zero), &exact_hi);
+    __m128i q = _mm_packus_epi16(lo, hi);
+
+    // no gather here: the rare exact multiples take the scalar correction
+    int mask = _mm_movemask_epi8(_mm_packs_epi16(exact_lo, exact_hi));
+    if (mask) {
+        uint8_t vb[16], vg[16], vr[16], vq[16];
+        _mm_storeu_si128((__m128i*)vb, b);
+        _mm_storeu_si128((__m128i*)vg, g);
+        _mm_storeu_si128((__m128i*)vr, r);
+        _mm_storeu_si128((__m128i*)vq, q);
+        for (int i = 0; i < 16; i++) {
+            if (mask & (1 << i)) {
+                vq[i] = luma_exact(vb[i], vg[i], vr[i]);
+            }
+        }
+        q = _mm_loadu_si128((const __m128i*)vq);
+    }
+    return q;
+}
+
+// 16 BGR pixels per step; returns the pixels done
+TARGET static int luma_bgr_row_ssse3(const uint8_t *bgr, uint8_t *luma, int width) {
+    const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i r0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t *p = bgr + (size_t)x * 3;
+        __m128i a0 = _mm_loadu_si128((const __m128i*)p);
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(p + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i*)(p + 32));
+        __m128i b = GATHER_CHANNEL(a0, a1, a2, b0, b1, b2);
+        __m128i g = GATHER_CHANNEL(a0, a1, a2, g0, g1, g2);
+        __m128i r = GATHER_CHANNEL(a0, a1, a2, r0, r1, r2);
+        _mm_storeu_si128((__m128i*)(luma + x), luma16_ssse3(b, g, r));
+    }
+    return x;
+}
+
+// 16 pixels per step; returns the pixels done
+TARGET static int luma_planes_row_ssse3(const uint8_t *b, const uint8_t *g, const uint8_t *r,
+                                        uint8_t *luma, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i vg = _mm_loadu_si128((const __m128i*)(g + i));
+        __m128i vr = _mm_loadu_si128((const __m128i*)(r + i));
+        _mm_storeu_si128((__m128i*)(luma + i), luma16_ssse3(vb, vg, vr));
+    }
+    return i;
+}
+
+#undef TARGET
+
+static inline int have_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+static inline int have_ssse3(void) {
+    return __builtin_cpu_supports("ssse3");
+}
+
+#endif
+
+// luma of interleaved BGR pixels
+void luma_bgr_row(const uint8_t *bgr, uint8_t *luma, int width) {
+    init_exceptions();
+    int x = 0;
+#ifdef HAVE_X86_KERNELS
+    if (have_avx2()) {
+        x = luma_bgr_row_avx2(bgr, luma, width);
+    } else if (have_ssse3()) {
+        x = luma_bgr_row_ssse3(bgr, luma, width);
+    }
+#endif
+    for (; x < width; x++) {
+        luma[x] = luma_exact(bgr[x * 3], bgr[x * 3 + 1], bgr[x * 3 + 2]);
+    }
+}
+
+// luma of B, G and R planes
+void luma_planes_row(const uint8_t *b, const uint8_t *g, const uint8_t *r, uint8_t *luma, int count) {
+    init_exceptions();
+    int i = 0;
+#ifdef HAVE_X86_KERNELS
+    if (have_avx2()) {
+        i = luma_planes_row_avx2(b, g, r, luma, count);
+    } else if (have_ssse3()) {
+        i = luma_planes_row_ssse3(b, g, r, luma, count);
+    }
+#endif
+    for (; i < count; i++) {
+        luma[i] = luma_exact(b[i], g[i], r[i]);
+    }
+}
+
+// same expression the equalization used per pixel
+void equalization_lut(const HistogramCount *cumulative, HistogramCount total_pixels, uint8_t *lut) {
+    for (int i = 0; i < 256; i++) {
+        lut[i] = (uint8_t)((cumulative[i] * 255.0) / total_pixels);
+    }
+}
+
+// byte-wise LUT
+void lut_row(const uint8_t *src, uint8_t *dst, const uint8_t *lut, int count) {
+    int i = 0;
+#ifdef HAVE_X86_KERNELS
+    if (have_avx2()) {
+        i = lut_row_avx2(src, dst, lut, count);
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = lut[src[i]];
+    }
+}
+
+// gray bytes to gray BGR pixels
+void gray_bgr_row(const uint8_t *gray, uint8_t *bgr, int width) {
+    int x = 0;
+#ifdef HAVE_X86_KERNELS
+    if (have_avx2()) {
+        x = gray_bgr_row_avx2(gray, bgr, width);
+    }
+#endif
+    for (; x < width; x++) {
+        bgr[x * 3] = gray[x];
+        bgr[x * 3 + 1] = gray[x];
+        bgr[x * 3 + 2] = gray[x];
+    }
+}
+
+// LUT of the B channel to all three channels
+void lut_bgr_row(uint8_t *bgr, const uint8_t *lut, int width) {
+    int x = 0;
+#ifdef HAVE_X86_KERNELS
+    if (have_avx2()) {
+        x = lut_bgr_row_avx2(bgr, lut, width);
+    }
+#endif
+    for (; x < width; x++) {
+        uint8_t value = lut[bgr[x * 3]];
+        bgr[x * 3] = value;
+        bgr[x * 3 + 1] = value;
+        bgr[x * 3 + 2] = value;
+    }
+}
+
+// adds the sub-histograms into histogram and clears them
+static void flush_histogram(uint32_t (*sub)[256], HistogramCount *histogram) {
+    for (int i = 0; i < 256; i++) {
+        histogram[i] += (HistogramCount)sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+    }
+    memset(sub, 0, HISTOGRAM_LANES * 256 * sizeof(uint32_t));
+}
+
+// four sub-histograms, four (or eight) values per step
+void histogram_bytes(const uint8_t *data, int width, int rows, size_t stride, int step,
+                     HistogramCount *histogram) {
+    uint32_t sub[HISTOGRAM_LANES][256];
+    memset(sub, 0, sizeof(sub));
+    uint64_t pending = 0;
+
+    for (int y = 0; y < rows; y++) {
+        const uint8_t *p = data + (size_t)y * stride;
+
+        // no sub-histogram bin may pass 2^32 - 1
+        if (pending + (uint64_t)width > UINT32_MAX) {
+            flush_histogram(sub, histogram);
+            pending = 0;
+        }
+        pending += (uint64_t)width;
+
+        int x = 0;
+        if (step == 1) {
+            // eight bytes per load, extracted by shifts
+            for (; x + 8 <= width; x += 8) {
+                uint64_t v;
+                memcpy(&v, p + x, sizeof(v));
+                sub[0][v & 0xFF]++;
+                sub[1][(v >> 8) & 0xFF]++;
+                sub[2][(v >> 16) & 0xFF]++;
+                sub[3][(v >> 24) & 0xFF]++;
+                sub[0][(v >> 32) & 0xFF]++;
+                sub[1][(v >> 40) & 0xFF]++;
+                sub[2][(v >> 48) & 0xFF]++;
+                sub[3][v >> 56]++;
+            }
+        } else {
+            for (; x + 4 <= width; x += 4) {
+                const uint8_t *q = p + (size_t)x * step;
+                sub[0][q[0]]++;
+                sub[1][q[step]]++;
+                sub[2][q[2 * step]]++;
+                sub[3][q[3 * step]]++;
+            }
+        }
+        for (; x < width; x++) {
+            sub[0][p[(size_t)x * step]]++;
+        }
+    }
+
+    flush_histogram(sub, histogram);
+}
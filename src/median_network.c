@@ -0,0 +1,102 @@
+#include "median_network.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define MAX_NETWORK_MASK 7
+
+// optimal-size sorting networks for 3, 5 and 7 inputs
+#define SORT3_NETWORK(X) X(0, 1) X(1, 2) X(0, 1)
+#define SORT5_NETWORK(X) \
+    X(0, 1) X(3, 4) X(2, 4) X(2, 3) X(1, 4) X(0, 3) X(0, 2) X(1, 3) X(1, 2)
+#define SORT7_NETWORK(X) \
+    X(1, 2) X(3, 4) X(5, 6) X(0, 2) X(3, 5) X(4, 6) X(0, 1) X(4, 5) \
+    X(2, 6) X(0, 4) X(1, 5) X(0, 3) X(2, 5) X(1, 3) X(2, 4) X(2, 3)
+
+typedef void (*median_rows_fn)(const uint8_t *src, int src_stride, int bpp, uint8_t *dst, int dst_stride,
+                               int rows, int start, int end, uint8_t *cols);
+
+#ifdef HAVE_X86_KERNELS
+
+// SSE2: 16 bytes per vector
+#define VEC __m128i
+#define VW 16
+#define VLOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define VSTORE(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define VMIN(a, b) _mm_min_epu8(a, b)
+#define VMAX(a, b) _mm_max_epu8(a, b)
+#define TARGET __attribute__((target("sse2")))
+#define FN(name) name##_sse2
+#include "median_network_template.h"
+#undef VEC
+#undef VW
+#undef VLOAD
+#undef VSTORE
+#undef VMIN
+#undef VMAX
+#undef TARGET
+#undef FN
+
+// AVX2: 32 bytes per vector
+#define VEC __m256i
+#define VW 32
+#define VLOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define VSTORE(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define VMIN(a, b) _mm256_min_epu8(a, b)
+#define VMAX(a, b) _mm256_max_epu8(a, b)
+#define TARGET __attribute__((target("avx2")))
+#define FN(name) name##_avx2
+#include "median_network_template.h"
+#undef VEC
+#undef VW
+#undef VLOAD
+#undef VSTORE
+#undef VMIN
+#undef VMAX
+#undef TARGET
+#undef FN
+
+#endif
+
+// picks the widest kernel for this mask size, CPU and row length
+static median_rows_fn select_kernel(int mask_size, int count) {
+#ifdef HAVE_X86_KERNELS
+    if (count >= 32 && __builtin_cpu_supports("avx2")) {
+        switch (mask_size) {
+            case 3: return median_rows3_avx2;
+            case 5: return median_rows5_avx2;
+            case 7: return median_rows7_avx2;
+        }
+    }
+    if (count >= 16 && __builtin_cpu_supports("sse2")) {
+        switch (mask_size) {
+            case 3: return median_rows3_sse2;
+            case 5: return median_rows5_sse2;
+            case 7: return median_rows7_sse2;
+        }
+    }
+#else
+    (void)mask_size;
+    (void)count;
+#endif
+    return NULL;
+}
+
+int median_network_supported(int mask_size) {
+    return select_kernel(mask_size, 32) != NULL;
+}
+
+int median_network_rows(const uint8_t *src, int src_stride, int bpp, uint8_t *dst, int dst_stride,
+                        int rows, int start, int end, int mask_size, uint8_t *cols) {
+    median_rows_fn kernel = select_kernel(mask_size, end - start);
+    if (!kernel) {
+        return -1;
+    }
+
+    kernel(src, src_stride, bpp, dst, dst_stride, rows, start, end, cols);
+    return 0;
+}
@@ -0,0 +1,131 @@
+// Median sorting-network kernels, instantiated once per instruction set by
+// median_network.c. The includer defines:
+//   VEC            vector type holding VW bytes
+//   VW             vector width in bytes
+//   VLOAD/VSTORE   unaligned load/store
+//   VMIN/VMAX      per-byte unsigned min/max
+//   TARGET         function attribute enabling the instruction set
+//   FN(name)       adds the instruction set suffix to a function name
+
+// compare-exchange: smaller value to a, larger to b
+#define CSWAP(a, b) do { VEC t_ = VMIN(a, b); (b) = VMAX(a, b); (a) = t_; } while (0)
+#define CSWAP_P(i, j) CSWAP(p[i], p[j]);
+
+// sorts k = 3, 5 or 7 values with an optimal-size network
+TARGET static inline __attribute__((always_inline)) void FN(sort_k)(VEC *p, const int k) {
+    if (k == 3) {
+        SORT3_NETWORK(CSWAP_P)
+    } else if (k == 5) {
+        SORT5_NETWORK(CSWAP_P)
+    } else {
+        SORT7_NETWORK(CSWAP_P)
+    }
+}
+
+// median of n values (n odd) by forgetful selection: keep n/2 + 2 values,
+// drop the smallest and the largest, take the next value and repeat. Every
+// step is a fixed min/max exchange, so it runs unchanged over all lanes.
+TARGET static inline __attribute__((always_inline)) VEC FN(median_forgetful)(VEC *p, const int n) {
+    int lo = 0;
+    int m = n / 2 + 2;
+    int next = m;
+
+    while (m > 1) {
+        for (int i = lo + 1; i < lo + m; i++) {
+            CSWAP(p[lo], p[i]);
+        }
+        for (int i = lo + 1; i < lo + m - 1; i++) {
+            CSWAP(p[i], p[lo + m - 1]);
+        }
+        lo++;
+        m -= 2;
+        if (next < n) {
+            p[lo + m] = p[next++];
+            m++;
+        }
+    }
+    return p[lo];
+}
+
+// filters bytes [start, end) of `rows` consecutive rows of a k x k window.
+// Every column of k values is sorted once per row into cols and shared by
+// the k windows that contain it; each window then sorts its rank rows
+// across the columns, after which only the candidates that can still hold
+// the median go through the selection.
+TARGET static inline __attribute__((always_inline))
+void FN(median_rows)(const uint8_t *src, int src_stride, int bpp, uint8_t *dst, int dst_stride,
+                     int rows, int start, int end, uint8_t *cols, const int k) {
+    const int half = k / 2;
+    const int rank = (k * k + 1) / 2;
+    const int span_start = start - half * bpp;
+    const int span = end - start + 2 * half * bpp;
+
+    for (int y = 0; y < rows; y++) {
+        const uint8_t *row = src + (ptrdiff_t)y * src_stride;
+        uint8_t *out = dst + (ptrdiff_t)y * dst_stride;
+
+        // vertical sort of every column in reach of the windows
+        for (int b = 0; b < span; b += VW) {
+            // the last vector overlaps the previous one instead of running past the end
+            if (b + VW > span) {
+                b = span - VW;
+            }
+            VEC p[MAX_NETWORK_MASK];
+            for (int j = 0; j < k; j++) {
+                p[j] = VLOAD(row + (ptrdiff_t)(j - half) * src_stride + span_start + b);
+            }
+            FN(sort_k)(p, k);
+            for (int j = 0; j < k; j++) {
+                VSTORE(cols + j * span + b, p[j]);
+            }
+        }
+
+        for (int b = start; b < end; b += VW) {
+            if (b + VW > end) {
+                b = end - VW;
+            }
+
+            // g[j][i]: j-th smallest value of column i, sorted across i
+            VEC g[MAX_NETWORK_MASK][MAX_NETWORK_MASK];
+            for (int j = 0; j < k; j++) {
+                const uint8_t *c = cols + j * span + (b - span_start);
+                for (int i = 0; i < k; i++) {
+                    g[j][i] = VLOAD(c + (i - half) * bpp);
+                }
+                FN(sort_k)(g[j], k);
+            }
+
+            // g[j][i] has at least (i+1)(j+1) values <= it and (k-i)(k-j)
+            // values >= it; as many values fall out below the median as above
+            VEC q[MAX_NETWORK_MASK * MAX_NETWORK_MASK];
+            int n = 0;
+            for (int j = 0; j < k; j++) {
+                for (int i = 0; i < k; i++) {
+                    if ((i + 1) * (j + 1) <= rank && (k - i) * (k - j) <= rank) {
+                        q[n++] = g[j][i];
+                    }
+                }
+            }
+
+            VSTORE(out + b, FN(median_forgetful)(q, n));
+        }
+    }
+}
+
+TARGET static void FN(median_rows3)(const uint8_t *src, int src_stride, int bpp, uint8_t *dst, int dst_stride,
+                                    int rows, int start, int end, uint8_t *cols) {
+    FN(median_rows)(src, src_stride, bpp, dst, dst_stride, rows, start, end, cols, 3);
+}
+
+TARGET static void FN(median_rows5)(const uint8_t *src, int src_stride, int bpp, uint8_t *dst, int dst_stride,
+                                    int rows, int start, int end, uint8_t *cols) {
+    FN(median_rows)(src, src_stride, bpp, dst, dst_stride, rows, start, end, cols, 5);
+}
+
+TARGET static void FN(median_rows7)(const uint8_t *src, int src_stride, int bpp, uint8_t *dst, int dst_stride,
+                                    int rows, int start, int end, uint8_t *cols) {
+    FN(median_rows)(src, src_stride, bpp, dst, dst_stride, rows, start, end, cols, 7);
+}
+
+#undef CSWAP_P
+#undef CSWAP
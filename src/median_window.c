@@ -0,0 +1,124 @@
+#include "median_window.h"
+#include "pipeline.h"
+#include <string.h>
+
+// bytes of the saved halo rows, rounded up to keep blocks aligned
+static size_t halo_size(int width, int mask_size) {
+    size_t bytes = (size_t)(mask_size / 2) * width * 3;
+    return (bytes + PADDED_ALIGN - 1) / PADDED_ALIGN * PADDED_ALIGN;
+}
+
+size_t median_window_size(int width, int mask_size, BorderMode border) {
+    int rows = fused_strip_rows(width, mask_size) + mask_size - 1;
+    return padded_size(width, rows, 3, padded_border(border, mask_size)) + halo_size(width, mask_size) +
+           median_scratch_size(width, 3, mask_size);
+}
+
+// copies source row y into the window, from the halo once past the band
+static void load_row(MedianWindow *w, int y) {
+    int width = w->src->width;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    const uint8_t *row = (y < w->y1) ? w->src->data + (size_t)y * row_size
+                                     : w->halo + (size_t)(y - w->y1) * width * 3;
+
+    memcpy(w->window.data + (size_t)(y - w->base) * w->window.stride, row, (size_t)width * 3);
+    if (w->window.border > 0) {
+        padded_fill_row_sides(&w->window, y - w->base, w->border);
+    }
+}
+
+void median_window_init(MedianWindow *w, const BMPImage *src, BMPImage *dst, int mask_size,
+                        BorderMode border, MedianEngine engine, int y0, int y1, uint8_t *memory) {
+    int width = src->width;
+    int height = src->height;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    int half = mask_size / 2;
+
+    w->src = src;
+    w->dst = dst;
+    w->mask_size = mask_size;
+    w->border = border;
+    w->engine = engine;
+    w->y0 = y0;
+    w->y1 = y1;
+    w->strip_rows = fused_strip_rows(width, mask_size);
+    padded_init(&w->window, width, w->strip_rows + mask_size - 1, 3,
+                padded_border(border, mask_size), memory);
+    w->halo = memory + padded_size(width, w->window.height, 3, w->window.border);
+    w->scratch = w->halo + halo_size(width, mask_size);
+    w->base = y0 - half;
+    w->held = (y0 - half > 0) ? y0 - half : 0;
+
+    if (y0 >= y1) {
+        return;
+    }
+
+    // the rows below the band may be overwritten by the next band
+    int halo_end = (y1 + half < height) ? y1 + half : height;
+    for (int y = y1; y < halo_end; y++) {
+        memcpy(w->halo + (size_t)(y - y1) * width * 3, src->data + (size_t)y * row_size, (size_t)width * 3);
+    }
+
+    // the rows above the band are only read by its first strip, and may
+    // be overwritten by the previous band: read that strip's rows now
+    int first_end = ((y0 + w->strip_rows < y1) ? y0 + w->strip_rows : y1) + half;
+    if (first_end > height) {
+        first_end = height;
+    }
+    for (int y = w->held; y < first_end; y++) {
+        load_row(w, y);
+    }
+    w->held = first_end;
+}
+
+void median_window_run(MedianWindow *w) {
+    int height = w->src->height;
+    int row_size = ((w->src->width * 3 + 3) / 4) * 4;
+    int half = w->mask_size / 2;
+    PaddedImage *window = &w->window;
+    ptrdiff_t frame = (ptrdiff_t)window->border * window->bpp;
+
+    for (int s0 = w->y0; s0 < w->y1; s0 += w->strip_rows) {
+        int s1 = (s0 + w->strip_rows < w->y1) ? s0 + w->strip_rows : w->y1;
+
+        // source rows [r0, r1) are read by the strip, [lo, hi) exist
+        int r0 = s0 - half;
+        int r1 = s1 + half;
+        int lo = (r0 > 0) ? r0 : 0;
+        int hi = (r1 < height) ? r1 : height;
+
+        if (r0 != w->base) {
+            // slide down, keeping the rows shared with the previous strip
+            memmove(window->data + (ptrdiff_t)(lo - r0) * window->stride - frame,
+                    window->data + (ptrdiff_t)(lo - w->base) * window->stride - frame,
+                    (size_t)(w->held - lo) * window->stride);
+            w->base = r0;
+            for (int y = w->held; y < hi; y++) {
+                load_row(w, y);
+            }
+            w->held = hi;
+        }
+
+        // frame rows past the image edges copy the rows they stand for
+        int v0 = lo;
+        int v1 = hi;
+        if (window->border > 0) {
+            size_t row_bytes = (size_t)(window->width + 2 * window->border) * window->bpp;
+            for (int y = r0; y < r1; y++) {
+                if (y < lo || y >= hi) {
+                    int from = padded_border_index(y, height, w->border);
+                    memcpy(window->data + (ptrdiff_t)(y - r0) * window->stride - frame,
+                           window->data + (ptrdiff_t)(from - r0) * window->stride - frame, row_bytes);
+                }
+            }
+            v0 = r0;
+            v1 = r1;
+        }
+
+        ImageView view = padded_view(window, w->border);
+        view.data += (ptrdiff_t)(v0 - w->base) * window->stride;
+        view.height = v1 - v0;
+        median_filter_rows_scratch(view, w->dst->data + (size_t)s0 * row_size, row_size, w->mask_size,
+                                   s0 - v0, s1 - v0, w->engine, w->scratch);
+    }
+}
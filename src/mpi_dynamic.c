@@ -0,0 +1,254 @@
+#include "mpi_dynamic.h"
+#include "mpi_strip.h"
+#include "image_processing.h"
+#include "timing.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// message tags
+#define TAG_BLOCK 1   // rank 0 -> worker: {y0, y1}, y0 == y1 when there is no block left
+#define TAG_ROWS 2    // rank 0 -> worker: source rows [y0 - half, y1 + half), clipped
+#define TAG_RESULT 3  // worker -> rank 0: gray rows [y0, y1)
+
+// the first block of each worker is this fraction of the rows per worker,
+// small enough to measure its speed before the big blocks go out
+#define PROBE_SPLIT 8
+
+typedef struct {
+    int y0, y1;      // block in flight
+    double sent;     // MPI_Wtime when it was sent
+    double rate;     // rows per second, 0 until a block came back
+    int blocks;
+    int rows;
+} Worker;
+
+typedef struct {
+    const BMPImage *src;
+    int row_size;
+    int half;
+    int min_rows;
+    int max_rows;    // keeps a message under INT_MAX bytes
+    int next;        // first row not handed out yet
+    Worker *workers; // indexed by rank (rank 0 unused)
+    int size;
+    MPI_Comm comm;
+} Coordinator;
+
+// rows of the next block of rank: its share of the rows left, by speed,
+// halved so the last blocks are small enough to finish together
+static int block_rows(const Coordinator *c, int rank) {
+    int height = c->src->height;
+    int remaining = height - c->next;
+    double known = 0.0;
+    int measured = 0;
+    for (int r = 1; r < c->size; r++) {
+        if (c->workers[r].rate > 0.0) {
+            known += c->workers[r].rate;
+            measured++;
+        }
+    }
+
+    int rows;
+    if (c->workers[rank].rate <= 0.0) {
+        rows = height / (PROBE_SPLIT * (c->size - 1));
+    } else {
+        // workers not measured yet count as the mean of the others
+        double mean = known / measured;
+        double total = known + mean * (c->size - 1 - measured);
+        rows = (int)(remaining * (c->workers[rank].rate / total) / 2);
+    }
+
+    if (rows < c->min_rows) {
+        rows = c->min_rows;
+    }
+    if (rows > c->max_rows) {
+        rows = c->max_rows;
+    }
+    return (rows < remaining) ? rows : remaining;
+}
+
+// sends rank its next block with the halo rows, or the stop message
+static int hand_out(Coordinator *c, int rank) {
+    Worker *w = &c->workers[rank];
+    int header[2] = { c->next, c->next };
+    if (c->next < c->src->height) {
+        header[1] = c->next + block_rows(c, rank);
+    }
+    MPI_Send(header, 2, MPI_INT, rank, TAG_BLOCK, c->comm);
+    if (header[0] == header[1]) {
+        return 0;
+    }
+
+    int r0 = (header[0] > c->half) ? header[0] - c->half : 0;
+    int r1 = (header[1] + c->half < c->src->height) ? header[1] + c->half : c->src->height;
+    w->y0 = header[0];
+    w->y1 = header[1];
+    w->sent = MPI_Wtime();
+    MPI_Send(c->src->data + (size_t)r0 * c->row_size, (r1 - r0) * c->row_size, MPI_BYTE, rank,
+             TAG_ROWS, c->comm);
+    c->next = header[1];
+    return 1;
+}
+
+void dynamic_coordinate(const BMPImage *src, BMPImage *dst, int mask_size, int verbose,
+                        MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    Coordinator c;
+    c.src = src;
+    c.row_size = ((src->width * 3 + 3) / 4) * 4;
+    c.half = mask_size / 2;
+    c.min_rows = (mask_size > DYNAMIC_MIN_ROWS) ? mask_size : DYNAMIC_MIN_ROWS;
+    c.max_rows = INT_MAX / c.row_size - 2 * c.half;
+    c.next = 0;
+    c.workers = (Worker*)calloc(size, sizeof(Worker));
+    c.size = size;
+    c.comm = comm;
+
+    // rank 0 only moves rows: its time until the reduction is all MPI
+    TIMING_START(t_mpi);
+    int active = 0;
+    for (int r = 1; r < size; r++) {
+        active += hand_out(&c, r);
+    }
+
+    // whoever finishes first gets the next block
+    while (active > 0) {
+        MPI_Status status;
+        MPI_Probe(MPI_ANY_SOURCE, TAG_RESULT, comm, &status);
+        int rank = status.MPI_SOURCE;
+        Worker *w = &c.workers[rank];
+        MPI_Recv(dst->data + (size_t)w->y0 * c.row_size, (w->y1 - w->y0) * c.row_size, MPI_BYTE,
+                 rank, TAG_RESULT, comm, MPI_STATUS_IGNORE);
+
+        // the time includes the transfers: what the worker costs per row
+        double elapsed = MPI_Wtime() - w->sent;
+        if (elapsed > 0.0) {
+            double rate = (w->y1 - w->y0) / elapsed;
+            w->rate = (w->rate > 0.0) ? (w->rate + rate) / 2 : rate;
+        }
+        w->blocks++;
+        w->rows += w->y1 - w->y0;
+        active--;
+
+        active += hand_out(&c, rank);
+    }
+
+    // sum histograms from all processes (rank 0 counted nothing)
+    HistogramCount none[256] = {0};
+    HistogramCount histogram[256];
+    MPI_Reduce(none, histogram, 256, MPI_INT64_T, MPI_SUM, 0, comm);
+    TIMING_STOP(t_mpi, STAGE_MPI, 0);
+
+    TIMING_START(t_eq);
+    HistogramCount cumulative[256];
+    cumulative[0] = histogram[0];
+    for (int i = 1; i < 256; i++) {
+        cumulative[i] = cumulative[i - 1] + histogram[i];
+    }
+    equalize_rows(dst, cumulative, (HistogramCount)src->width * src->height, 0, src->height);
+    TIMING_STOP(t_eq, STAGE_EQUALIZE, 0);
+
+    for (int r = 1; r < size && verbose; r++) {
+        printf("Processo %d: %d blocos, %d linhas\n", r, c.workers[r].blocks, c.workers[r].rows);
+    }
+    free(c.workers);
+}
+
+// median, grayscale and histogram of the own rows of block into out
+static void process_block(Strip *block, BMPImage *out, HistogramCount *histogram, int mask_size,
+                          const Options *opts) {
+    int rows = out->height;
+
+    // the stages only write pixels: keep the input's row padding bytes
+    int pixel_bytes = block->width * 3;
+    for (int y = 0; y < rows; y++) {
+        memcpy(out->data + (size_t)y * block->row_size + pixel_bytes,
+               strip_own_data(block) + (size_t)y * block->row_size + pixel_bytes,
+               block->row_size - pixel_bytes);
+    }
+
+    PaddedImage *padded;
+    ImageView view = strip_median_source(block, opts->border, mask_size, &padded, MPI_COMM_SELF);
+    TIMING_START(t_median);
+    median_filter_rows(view, out->data, block->row_size, mask_size, block->halo_top,
+                       block->halo_top + rows, opts->median);
+    free_padded(padded);
+    TIMING_STOP(t_median, STAGE_MEDIAN, 0);
+
+    TIMING_START(t_gray);
+    grayscale_rows(out, 0, rows);
+    TIMING_STOP(t_gray, STAGE_GRAYSCALE, 0);
+    TIMING_START(t_hist);
+    histogram_rows(out, histogram, 0, rows);
+    TIMING_STOP(t_hist, STAGE_HISTOGRAM, 0);
+}
+
+void dynamic_work(int width, int height, int mask_size, const Options *opts, MPI_Comm comm) {
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    int half = mask_size / 2;
+    HistogramCount histogram[256] = {0};
+
+    // both buffers grow to the largest block received
+    uint8_t *rows_buffer = NULL;
+    uint8_t *out_buffer = NULL;
+    size_t capacity = 0;
+
+    for (;;) {
+        int header[2];
+        TIMING_START(t_recv);
+        MPI_Recv(header, 2, MPI_INT, 0, TAG_BLOCK, comm, MPI_STATUS_IGNORE);
+        int y0 = header[0];
+        int y1 = header[1];
+        if (y0 >= y1) {
+            TIMING_STOP(t_recv, STAGE_MPI, 0);
+            break;
+        }
+
+        int r0 = (y0 > half) ? y0 - half : 0;
+        int r1 = (y1 + half < height) ? y1 + half : height;
+        size_t bytes = (size_t)(r1 - r0) * row_size;
+        if (bytes > capacity) {
+            free(rows_buffer);
+            free(out_buffer);
+            rows_buffer = (uint8_t*)malloc(bytes);
+            out_buffer = (uint8_t*)malloc(bytes);
+            capacity = bytes;
+        }
+        MPI_Recv(rows_buffer, (r1 - r0) * row_size, MPI_BYTE, 0, TAG_ROWS, comm, MPI_STATUS_IGNORE);
+        TIMING_STOP(t_recv, STAGE_MPI, 0);
+
+        // the block is a strip whose halos came with it
+        Strip block;
+        block.width = width;
+        block.height = height;
+        block.row_size = row_size;
+        block.row_type = MPI_DATATYPE_NULL;
+        block.half = half;
+        block.start_y = y0;
+        block.end_y = y1;
+        block.halo_top = y0 - r0;
+        block.halo_bottom = r1 - y1;
+        block.buffer = rows_buffer;
+        block.image.width = width;
+        block.image.height = r1 - r0;
+        block.image.data = rows_buffer;
+        block.image.top_down = 0;
+        block.halos_ready = 1;
+
+        BMPImage out = { width, y1 - y0, out_buffer, 0 };
+        process_block(&block, &out, histogram, mask_size, opts);
+        TIMING_START(t_send);
+        MPI_Send(out.data, (y1 - y0) * row_size, MPI_BYTE, 0, TAG_RESULT, comm);
+        TIMING_STOP(t_send, STAGE_MPI, 0);
+    }
+
+    TIMING_START(t_reduce);
+    MPI_Reduce(histogram, NULL, 256, MPI_INT64_T, MPI_SUM, 0, comm);
+    TIMING_STOP(t_reduce, STAGE_MPI, 0);
+    free(rows_buffer);
+    free(out_buffer);
+}
@@ -0,0 +1,539 @@
+#include "mpi_strip.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HALO_TAG_UP 10
+#define HALO_TAG_DOWN 11
+
+// interior rows of the overlapped median are split in up to this many chunks
+#define OVERLAP_CHUNKS 8
+#define OVERLAP_MIN_CHUNK_ROWS 32
+
+// own rows [start_y, end_y) of rank out of size ranks
+void strip_rows(int height, int rank, int size, int *start_y, int *end_y) {
+    *start_y = (int)((long)height * rank / size);
+    *end_y = (int)((long)height * (rank + 1) / size);
+}
+
+// halo rows above / below own rows [start_y, end_y): up to half, clipped
+// at the image edges
+static void halo_rows(int height, int half, int start_y, int end_y, int *top, int *bottom) {
+    *top = (start_y > half) ? half : start_y;
+    *bottom = (height - end_y > half) ? half : height - end_y;
+}
+
+// smallest number of own rows over all ranks
+static int min_strip_rows(int height, int size) {
+    return height / size;
+}
+
+// sets up the strip of this rank and allocates its buffer
+void strip_init(Strip *s, int width, int height, int mask_size, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    s->width = width;
+    s->height = height;
+    s->row_size = ((width * 3 + 3) / 4) * 4;
+    s->half = mask_size / 2;
+    strip_rows(height, rank, size, &s->start_y, &s->end_y);
+
+    halo_rows(height, s->half, s->start_y, s->end_y, &s->halo_top, &s->halo_bottom);
+
+    // messages count rows, so a strip of several GiB stays within an int
+    MPI_Type_contiguous(s->row_size, MPI_BYTE, &s->row_type);
+    MPI_Type_commit(&s->row_type);
+
+    int rows = s->halo_top + strip_own_rows(s) + s->halo_bottom;
+    s->buffer = (uint8_t*)malloc((size_t)rows * s->row_size);
+    s->image.width = width;
+    s->image.height = rows;
+    s->image.data = s->buffer;
+    s->image.top_down = 0;
+    s->halos_ready = 0;
+}
+
+// sends every rank the halo rows around its strip from the image of rank 0
+static void send_halos(Strip *s, const BMPImage *img, int size, MPI_Comm comm) {
+    MPI_Request *requests = (MPI_Request*)malloc(2 * size * sizeof(MPI_Request));
+    int n = 0;
+    for (int i = 0; i < size; i++) {
+        int start, end, top, bottom;
+        strip_rows(s->height, i, size, &start, &end);
+        halo_rows(s->height, s->half, start, end, &top, &bottom);
+        const uint8_t *above = img->data + (size_t)(start - top) * s->row_size;
+        const uint8_t *below = img->data + (size_t)end * s->row_size;
+        if (i == 0) {
+            memcpy(s->buffer, above, (size_t)top * s->row_size);
+            memcpy(strip_own_data(s) + (size_t)strip_own_rows(s) * s->row_size, below,
+                   (size_t)bottom * s->row_size);
+        } else {
+            MPI_Isend(above, top, s->row_type, i, HALO_TAG_DOWN, comm, &requests[n++]);
+            MPI_Isend(below, bottom, s->row_type, i, HALO_TAG_UP, comm, &requests[n++]);
+        }
+    }
+    MPI_Waitall(n, requests, MPI_STATUSES_IGNORE);
+    free(requests);
+}
+
+// distributes the image of rank 0: own rows with one MPI_Scatterv, and
+// the halo rows too when a strip is thinner than the halo
+void strip_scatter(Strip *s, const BMPImage *img, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // counts and displacements in rows
+    int *counts = NULL;
+    int *displs = NULL;
+    if (rank == 0) {
+        counts = (int*)malloc(size * sizeof(int));
+        displs = (int*)malloc(size * sizeof(int));
+        for (int i = 0; i < size; i++) {
+            int start, end;
+            strip_rows(s->height, i, size, &start, &end);
+            counts[i] = end - start;
+            displs[i] = start;
+        }
+    }
+
+    TIMING_START(t);
+    MPI_Scatterv(rank == 0 ? img->data : NULL, counts, displs, s->row_type,
+                 strip_own_data(s), strip_own_rows(s), s->row_type, 0, comm);
+
+    // strips thinner than the halo need rows from beyond the neighbours,
+    // which the exchange does not reach: rank 0 sends every halo itself
+    int with_halo = min_strip_rows(s->height, size) < s->half;
+    if (with_halo && rank == 0) {
+        send_halos(s, img, size, comm);
+    } else if (with_halo) {
+        MPI_Recv(s->buffer, s->halo_top, s->row_type, 0, HALO_TAG_DOWN, comm, MPI_STATUS_IGNORE);
+        MPI_Recv(strip_own_data(s) + (size_t)strip_own_rows(s) * s->row_size, s->halo_bottom,
+                 s->row_type, 0, HALO_TAG_UP, comm, MPI_STATUS_IGNORE);
+    }
+    TIMING_STOP(t, STAGE_MPI, 0);
+    s->halos_ready = with_halo;
+
+    free(counts);
+    free(displs);
+}
+
+// posts the halo messages: the first own rows go up as the bottom halo of
+// rank - 1, the last own rows go down as the top halo of rank + 1
+void strip_start_halo_exchange(Strip *s, MPI_Comm comm, MPI_Request requests[4]) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int up = (rank > 0) ? rank - 1 : MPI_PROC_NULL;
+    int down = (rank < size - 1) ? rank + 1 : MPI_PROC_NULL;
+    int own = strip_own_rows(s);
+    uint8_t *own_data = strip_own_data(s);
+
+    TIMING_START(t);
+    MPI_Irecv(s->buffer, s->halo_top, s->row_type, up, HALO_TAG_DOWN, comm, &requests[0]);
+    MPI_Irecv(own_data + (size_t)own * s->row_size, s->halo_bottom, s->row_type, down, HALO_TAG_UP,
+              comm, &requests[1]);
+    MPI_Isend(own_data, s->halo_top, s->row_type, up, HALO_TAG_UP, comm, &requests[2]);
+    MPI_Isend(own_data + (size_t)(own - s->halo_bottom) * s->row_size, s->halo_bottom, s->row_type,
+              down, HALO_TAG_DOWN, comm, &requests[3]);
+    TIMING_STOP(t, STAGE_MPI, 0);
+}
+
+// waits for the halo messages posted by strip_start_halo_exchange
+void strip_finish_halo_exchange(Strip *s, MPI_Request requests[4]) {
+    TIMING_START(t);
+    MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+    TIMING_STOP(t, STAGE_MPI, 0);
+    s->halos_ready = 1;
+}
+
+// fills the halo rows with the neighbours' first / last own rows
+void strip_exchange_halos(Strip *s, MPI_Comm comm) {
+    if (s->halos_ready) {
+        return;
+    }
+
+    MPI_Request requests[4];
+    strip_start_halo_exchange(s, comm, requests);
+    strip_finish_halo_exchange(s, requests);
+}
+
+// the strip buffer, or a padded copy of it with its border filled
+ImageView strip_median_source(Strip *s, BorderMode border, int mask_size, PaddedImage **padded,
+                              MPI_Comm comm) {
+    *padded = NULL;
+    if (border == BORDER_SHRINK) {
+        ImageView view = { s->buffer, s->width, s->image.height, s->row_size, 3, 0 };
+        return view;
+    }
+
+    // the frame is only read past the image edges: inner strip edges have
+    // their halo rows
+    strip_exchange_halos(s, comm);
+    TIMING_START(t);
+    *padded = create_padded(s->width, s->image.height, 3, padded_border(border, mask_size));
+    padded_copy_rows(*padded, s->buffer, s->row_size, 0, s->image.height);
+    padded_fill_border(*padded, border);
+    TIMING_STOP(t, STAGE_MEDIAN, 0);
+    return padded_view(*padded, border);
+}
+
+// calls fn on every own row once the rows it reads are present
+void strip_run_rows(Strip *s, HaloMode mode, strip_rows_fn fn, void *ctx, MPI_Comm comm) {
+    int first = s->halo_top;
+    int last = s->halo_top + strip_own_rows(s);
+
+    if (s->halos_ready || mode == HALO_BLOCKING) {
+        strip_exchange_halos(s, comm);
+        fn(first, last, ctx);
+        return;
+    }
+
+    // own rows [a, b) have their whole window inside the own rows (or
+    // the image border), so they do not wait for the halo messages
+    int a = (s->halo_top > 0) ? first + s->half : first;
+    int b = (s->halo_bottom > 0) ? last - s->half : last;
+    if (a > last) {
+        a = last;
+    }
+    if (b < a) {
+        b = a;
+    }
+
+    MPI_Request requests[4];
+    strip_start_halo_exchange(s, comm, requests);
+
+    // interior in a few chunks, testing the requests in between so the
+    // MPI library can progress large (rendezvous) messages meanwhile
+    int chunk = (b - a) / OVERLAP_CHUNKS;
+    if (chunk < OVERLAP_MIN_CHUNK_ROWS) {
+        chunk = OVERLAP_MIN_CHUNK_ROWS;
+    }
+    for (int y = a; y < b; y += chunk) {
+        int flag;
+        fn(y, (y + chunk < b) ? y + chunk : b, ctx);
+        MPI_Testall(4, requests, &flag, MPI_STATUSES_IGNORE);
+    }
+
+    strip_finish_halo_exchange(s, requests);
+
+    fn(first, a, ctx);
+    fn(b, last, ctx);
+}
+
+// collects the own rows of every rank into img on rank 0
+void strip_gather(const Strip *s, const uint8_t *rows, BMPImage *img, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // counts and displacements in rows
+    int *counts = NULL;
+    int *displs = NULL;
+    if (rank == 0) {
+        counts = (int*)malloc(size * sizeof(int));
+        displs = (int*)malloc(size * sizeof(int));
+        for (int i = 0; i < size; i++) {
+            int start, end;
+            strip_rows(s->height, i, size, &start, &end);
+            counts[i] = end - start;
+            displs[i] = start;
+        }
+    }
+
+    TIMING_START(t);
+    MPI_Gatherv(rows, strip_own_rows(s), s->row_type,
+                rank == 0 ? img->data : NULL, counts, displs, s->row_type, 0, comm);
+    TIMING_STOP(t, STAGE_MPI, 0);
+
+    free(counts);
+    free(displs);
+}
+
+// sums the histograms of all processes and accumulates them
+void global_cumulative_histogram(const HistogramCount *local_histogram, HistogramCount *cumulative,
+                                 MPI_Comm comm) {
+    HistogramCount global_histogram[256];
+    TIMING_START(t);
+    MPI_Allreduce(local_histogram, global_histogram, 256, MPI_INT64_T, MPI_SUM, comm);
+    TIMING_STOP(t, STAGE_MPI, 0);
+
+    cumulative[0] = global_histogram[0];
+    for (int i = 1; i < 256; i++) {
+        cumulative[i] = cumulative[i - 1] + global_histogram[i];
+    }
+}
+
+// file view of rows [start, start + count) of a height x row_size pixel
+// array stored at offset. Rows stay in file order (bottom-up unless the
+// header height is negative): the stages are symmetric in y, so they never
+// need the image order, and the output is written in the same order.
+static int set_rows_view(MPI_File fh, MPI_Offset offset, int height, int row_size,
+                         int start, int count, MPI_Datatype *filetype) {
+    int sizes[2] = { height, row_size };
+    int subsizes[2] = { count, row_size };
+    int starts[2] = { start, 0 };
+    if (count > 0) {
+        MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_BYTE, filetype);
+    } else {
+        // ranks without rows still join the collective call, reading nothing
+        MPI_Type_contiguous(row_size, MPI_BYTE, filetype);
+    }
+    MPI_Type_commit(filetype);
+    return MPI_File_set_view(fh, offset, MPI_BYTE, *filetype, "native", MPI_INFO_NULL);
+}
+
+// every rank reads the header and then only the rows of its strip
+int strip_read_bmp(Strip *s, const char *filename, int mask_size, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    MPI_File fh;
+    if (MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (rank == 0) {
+            printf("Erro ao abrir arquivo: %s\n", filename);
+        }
+        return -1;
+    }
+
+    uint8_t header[BMP_HEADER_SIZE];
+    MPI_Status status;
+    int count = 0;
+    if (MPI_File_read_at_all(fh, 0, header, BMP_HEADER_SIZE, MPI_BYTE, &status) == MPI_SUCCESS) {
+        MPI_Get_count(&status, MPI_BYTE, &count);
+    }
+    if (count != BMP_HEADER_SIZE) {
+        if (rank == 0) {
+            printf("Erro ao ler header BMP\n");
+        }
+        MPI_File_close(&fh);
+        return -1;
+    }
+
+    BMPHeader info;
+    const char *error = parse_bmp_header(header, &info);
+    if (error) {
+        if (rank == 0) {
+            printf("%s\n", error);
+        }
+        MPI_File_close(&fh);
+        return -1;
+    }
+
+    strip_init(s, info.width, info.height, mask_size, comm);
+    s->image.top_down = info.top_down;
+
+    // the halo rows are read along with the own rows: overlapping reads
+    // from the file replace the neighbour exchange
+    int rows = s->image.height;
+    MPI_Datatype filetype;
+    int ok = set_rows_view(fh, info.data_offset, info.height, s->row_size,
+                           s->start_y - s->halo_top, rows, &filetype) == MPI_SUCCESS;
+    count = 0;
+    if (ok && MPI_File_read_at_all(fh, 0, s->buffer, rows, s->row_type, &status) == MPI_SUCCESS) {
+        MPI_Get_count(&status, s->row_type, &count);
+    }
+    MPI_Type_free(&filetype);
+    MPI_File_close(&fh);
+
+    int read_ok = (count == rows);
+    MPI_Allreduce(MPI_IN_PLACE, &read_ok, 1, MPI_INT, MPI_LAND, comm);
+    if (!read_ok) {
+        if (rank == 0) {
+            printf("Erro ao ler dados da imagem\n");
+        }
+        strip_free(s);
+        return -1;
+    }
+
+    s->halos_ready = 1;
+    return 0;
+}
+
+// rank 0 writes the header, then every rank its own rows
+int strip_write_bmp(const Strip *s, const uint8_t *rows, const char *filename, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    MPI_File fh;
+    if (MPI_File_open(comm, filename, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL,
+                      &fh) != MPI_SUCCESS) {
+        if (rank == 0) {
+            printf("Erro ao criar arquivo: %s\n", filename);
+        }
+        return -1;
+    }
+
+    // drop the tail of an older, larger file
+    MPI_Offset file_size = BMP_HEADER_SIZE + (MPI_Offset)s->height * s->row_size;
+    int ok = MPI_File_set_size(fh, file_size) == MPI_SUCCESS;
+
+    if (rank == 0) {
+        uint8_t header[BMP_HEADER_SIZE];
+        make_bmp_header(header, s->width, s->height, s->image.top_down);
+        ok &= MPI_File_write_at(fh, 0, header, BMP_HEADER_SIZE, MPI_BYTE,
+                                MPI_STATUS_IGNORE) == MPI_SUCCESS;
+    }
+
+    MPI_Datatype filetype;
+    ok &= set_rows_view(fh, BMP_HEADER_SIZE, s->height, s->row_size, s->start_y,
+                        strip_own_rows(s), &filetype) == MPI_SUCCESS;
+    ok &= MPI_File_write_at_all(fh, 0, rows, strip_own_rows(s), s->row_type,
+                                MPI_STATUS_IGNORE) == MPI_SUCCESS;
+    MPI_Type_free(&filetype);
+    MPI_File_close(&fh);
+
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, comm);
+    if (!ok) {
+        if (rank == 0) {
+            printf("Erro ao escrever arquivo: %s\n", filename);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+int strip_load(StripFiles *f, const char *input_file, const char *output_file, int mask_size,
+               IOMode io, double *start_time, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    Strip *s = &f->strip;
+    f->io = io;
+    f->img = NULL;
+    f->result = NULL;
+    f->input_map = NULL;
+    f->output_map = NULL;
+
+    if (rank == 0) {
+        printf("Lendo imagem: %s\n", input_file);
+    }
+
+    if (io == IO_MPIIO) {
+        // every process reads its own strip (and halo) from the file
+        TIMING_START(t_read);
+        if (strip_read_bmp(s, input_file, mask_size, comm) != 0) {
+            return -1;
+        }
+        TIMING_STOP(t_read, STAGE_READ, 0);
+        *start_time = MPI_Wtime();
+    } else {
+        // process 0 reads the image (--io=mmap: maps the input and the
+        // output file, and the results are gathered into the mapping)
+        int dims[2];
+        if (rank == 0) {
+            TIMING_START(t_read);
+            if (io == IO_MMAP) {
+                f->input_map = map_bmp(input_file);
+                f->output_map = f->input_map ? create_mapped_bmp(output_file, &f->input_map->image) : NULL;
+                if (!f->output_map) {
+                    MPI_Abort(comm, 1);
+                }
+                f->img = &f->input_map->image;
+                f->result = &f->output_map->image;
+            } else {
+                f->img = read_bmp(input_file);
+                if (!f->img) {
+                    MPI_Abort(comm, 1);
+                }
+                f->result = f->img;
+            }
+            TIMING_STOP(t_read, STAGE_READ, 0);
+            *start_time = MPI_Wtime();
+            dims[0] = f->img->width;
+            dims[1] = f->img->height;
+        }
+
+        // broadcast image dimensions to all processes
+        TIMING_START(t_bcast);
+        MPI_Bcast(dims, 2, MPI_INT, 0, comm);
+        TIMING_STOP(t_bcast, STAGE_MPI, 0);
+
+        strip_init(s, dims[0], dims[1], mask_size, comm);
+        strip_scatter(s, f->img, comm);
+    }
+
+    int rows = strip_own_rows(s);
+    f->out.width = s->width;
+    f->out.height = rows;
+    f->out.data = (uint8_t*)malloc((size_t)rows * s->row_size);
+    f->out.top_down = s->image.top_down;
+
+    // the stages only write pixels: keep the input's row padding bytes
+    int pixel_bytes = s->width * 3;
+    for (int y = 0; y < rows; y++) {
+        memcpy(f->out.data + (size_t)y * s->row_size + pixel_bytes,
+               strip_own_data(s) + (size_t)y * s->row_size + pixel_bytes, s->row_size - pixel_bytes);
+    }
+    return 0;
+}
+
+double strip_store(StripFiles *f, const char *output_file, double start_time, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // gather final results
+    if (f->io != IO_MPIIO) {
+        strip_gather(&f->strip, f->out.data, f->result, comm);
+    }
+
+    double time_spent = 0.0;
+    if (rank == 0) {
+        time_spent = MPI_Wtime() - start_time;
+        TIMING_RECORD(STAGE_TOTAL, 0, time_spent);
+        printf("Salvando imagem: %s\n", output_file);
+    }
+
+    TIMING_START(t_write);
+    if (f->io == IO_MPIIO) {
+        strip_write_bmp(&f->strip, f->out.data, output_file, comm);
+    } else if (f->io == IO_MMAP) {
+        unmap_bmp(f->output_map);
+        unmap_bmp(f->input_map);
+    } else if (rank == 0) {
+        write_bmp(output_file, f->img);
+        free_bmp(f->img);
+    }
+    TIMING_STOP(t_write, STAGE_WRITE, 0);
+
+    free(f->out.data);
+    strip_free(&f->strip);
+    return time_spent;
+}
+
+// frees the strip buffer and row datatype
+void strip_free(Strip *s) {
+    free(s->buffer);
+    s->buffer = NULL;
+    if (s->row_type != MPI_DATATYPE_NULL) {
+        MPI_Type_free(&s->row_type);
+    }
+}
+
+// gathers the timer slots of every rank; rank 0 writes them to one file
+void strip_gather_timing(const Options *opts, const char *binary, int mask_size, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    if (!timing_requested(opts, rank == 0)) {
+        return;
+    }
+
+    double *values = (double*)malloc(sizeof(double) * TIMING_VALUES);
+    double *all = (rank == 0) ? (double*)malloc(sizeof(double) * TIMING_VALUES * size) : NULL;
+    timing_export(values);
+    MPI_Gather(values, TIMING_VALUES, MPI_DOUBLE, all, TIMING_VALUES, MPI_DOUBLE, 0, comm);
+
+    if (rank == 0) {
+        char path[256];
+        timing_path(path, sizeof(path), binary, mask_size, opts->timing);
+        if (timing_write(path, opts->timing, binary, mask_size, size, all) == 0) {
+            printf("Tempos por etapa: %s\n", path);
+        }
+    }
+    free(all);
+    free(values);
+}
@@ -1,106 +1,373 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 #include <mpi.h>
 #include "bmp.h"
 #include "image_processing.h"
+#include "options.h"
+#include "planar.h"
+#include "pipeline.h"
+#include "mpi_strip.h"
+#include "mpi_dynamic.h"
+#include "arena.h"
+#include "batch.h"
+#include "async_batch.h"
+#include "timing.h"
+
+// arguments of the median row callbacks
+typedef struct {
+    Strip *strip;
+    uint8_t *out;        // output row of the first own row
+    int out_stride;
+    HistogramCount *histogram;  // fused pipeline only
+    int mask_size;
+    MedianEngine engine;
+    ImageView src;       // strip rows the median reads (see strip_median_source)
+    uint8_t *scratch;    // median (or fused pipeline) scratch, reused by every call
+} MedianRows;
+
+// median of strip rows [y0, y1) into the matching rows of out
+static void median_strip_rows(int y0, int y1, void *ctx) {
+    MedianRows *m = (MedianRows*)ctx;
+    Strip *strip = m->strip;
+    TIMING_START(t);
+    median_filter_rows_scratch(m->src, m->out + (size_t)(y0 - strip->halo_top) * m->out_stride,
+                               m->out_stride, m->mask_size, y0, y1, m->engine, m->scratch);
+    TIMING_STOP(t, STAGE_MEDIAN, 0);
+}
 
-// helper function for qsort
-int compare_uint8_mpi(const void *a, const void *b) {
-    uint8_t va = *(uint8_t*)a;
-    uint8_t vb = *(uint8_t*)b;
-    return (va < vb) ? -1 : (va > vb) ? 1 : 0;
+// median of the own rows of the strip (reading its halo rows) into out
+void apply_median_filter_region(Strip *strip, BMPImage *out, int mask_size, const Options *opts) {
+    PaddedImage *padded;
+    MedianRows m = { strip, out->data, strip->row_size, NULL, mask_size, opts->median,
+                     strip_median_source(strip, opts->border, mask_size, &padded, MPI_COMM_WORLD),
+                     (uint8_t*)aligned_alloc(64, median_scratch_size(strip->width, 3, mask_size)) };
+    strip_run_rows(strip, opts->halo, median_strip_rows, &m, MPI_COMM_WORLD);
+    free(m.scratch);
+    free_padded(padded);
 }
 
-void apply_median_filter_region(BMPImage *img, int mask_size, int start_y, int end_y) {
-    int width = img->width;
-    int height = img->height;
-    int row_size = ((width * 3 + 3) / 4) * 4;
-    int half = mask_size / 2;
+// interleaved stages on the own rows; the median writes into out and the
+// other stages work on out in place
+void process_strip_staged(Strip *strip, BMPImage *out, int mask_size, const Options *opts) {
+    int rows = out->height;
+
+    // STEP 1: median filter
+    apply_median_filter_region(strip, out, mask_size, opts);
+
+    // STEP 2: convert to grayscale
+    TIMING_START(t_gray);
+    grayscale_rows(out, 0, rows);
+    TIMING_STOP(t_gray, STAGE_GRAYSCALE, 0);
+
+    // STEP 3: histogram equalization
+    TIMING_START(t_hist);
+    HistogramCount local_histogram[256] = {0};
+    histogram_rows(out, local_histogram, 0, rows);
+    TIMING_STOP(t_hist, STAGE_HISTOGRAM, 0);
+
+    HistogramCount cumulative[256];
+    global_cumulative_histogram(local_histogram, cumulative, MPI_COMM_WORLD);
+
+    TIMING_START(t_eq);
+    HistogramCount total_pixels = (HistogramCount)strip->width * strip->height;
+    equalize_rows(out, cumulative, total_pixels, 0, rows);
+    TIMING_STOP(t_eq, STAGE_EQUALIZE, 0);
+}
 
-    uint8_t *original = (uint8_t*)malloc(row_size * height);
-    for (int i = 0; i < row_size * height; i++) {
-        original[i] = img->data[i];
+// planar arguments of the median row callback
+typedef struct {
+    Strip *strip;
+    PlanarImage *planar;
+    PlanarImage *filtered;
+    int mask_size;
+    MedianEngine engine;
+} PlanarMedianRows;
+
+// splits the rows read by the windows of strip rows [y0, y1), then filters them
+static void planar_median_strip_rows(int y0, int y1, void *ctx) {
+    PlanarMedianRows *m = (PlanarMedianRows*)ctx;
+    if (y0 >= y1) {
+        return;
     }
 
-    uint8_t *mask_values = (uint8_t*)malloc(mask_size * mask_size * sizeof(uint8_t));
+    int half = m->mask_size / 2;
+    int r0 = (y0 > half) ? y0 - half : 0;
+    int r1 = (y1 + half < m->strip->image.height) ? y1 + half : m->strip->image.height;
+    TIMING_START(t);
+    bmp_to_planar_rows(&m->strip->image, m->planar, r0, r1);
+
+    planar_median_rows(m->planar, m->filtered, m->mask_size, y0, y1, m->engine);
+    TIMING_STOP(t, STAGE_MEDIAN, 0);
+}
+
+// planar layout on the strip (own rows plus halo), luma written into out
+void process_strip_planar(Strip *strip, BMPImage *out, int mask_size, const Options *opts) {
+    int width = strip->width;
+    int local_rows = strip->image.height;
+    int y0 = strip->halo_top;
+    int y1 = y0 + out->height;
+
+    PlanarImage *planar = create_planar(width, local_rows);
+    PlanarImage *filtered = create_planar(width, local_rows);
+
+    PlanarMedianRows m = { strip, planar, filtered, mask_size, opts->median };
+    strip_run_rows(strip, opts->halo, planar_median_strip_rows, &m, MPI_COMM_WORLD);
+
+    TIMING_START(t_gray);
+    planar_grayscale_rows(filtered, y0, y1);
+    TIMING_STOP(t_gray, STAGE_GRAYSCALE, 0);
+
+    TIMING_START(t_hist);
+    HistogramCount local_histogram[256] = {0};
+    planar_histogram_rows(filtered, local_histogram, y0, y1);
+    TIMING_STOP(t_hist, STAGE_HISTOGRAM, 0);
+
+    HistogramCount cumulative[256];
+    global_cumulative_histogram(local_histogram, cumulative, MPI_COMM_WORLD);
+
+    TIMING_START(t_eq);
+    planar_equalize_rows(filtered, cumulative, (HistogramCount)width * strip->height, y0, y1);
+
+    // out holds only the own rows: shift the luma rows up by the halo
+    PlanarImage own = *filtered;
+    own.luma = filtered->luma + (size_t)y0 * width;
+    luma_to_bmp_rows(&own, out, 0, out->height);
+    TIMING_STOP(t_eq, STAGE_EQUALIZE, 0);
+
+    free_planar(filtered);
+    free_planar(planar);
+}
+
+// fused median, luma and histogram of strip rows [y0, y1)
+static void fused_median_strip_rows(int y0, int y1, void *ctx) {
+    MedianRows *m = (MedianRows*)ctx;
+    Strip *strip = m->strip;
+    TIMING_START(t);
+    fused_median_luma_rows(m->src, m->out + (size_t)(y0 - strip->halo_top) * m->out_stride,
+                           m->histogram, m->mask_size, y0, y1, m->engine, m->scratch);
+    TIMING_STOP(t, STAGE_MEDIAN, 0);
+}
+
+// fused strips over the own rows, then the equalization LUT built from the
+// global histogram
+void process_strip_fused(Strip *strip, BMPImage *out, int mask_size, const Options *opts) {
+    int width = strip->width;
+    int rows = out->height;
+    uint8_t *luma = (uint8_t*)malloc((size_t)width * rows);
+
+    HistogramCount local_histogram[256] = {0};
+    PaddedImage *padded;
+    MedianRows m = { strip, luma, width, local_histogram, mask_size, opts->median,
+                     strip_median_source(strip, opts->border, mask_size, &padded, MPI_COMM_WORLD),
+                     (uint8_t*)aligned_alloc(64, fused_scratch_size(width, mask_size)) };
+    strip_run_rows(strip, opts->halo, fused_median_strip_rows, &m, MPI_COMM_WORLD);
+    free(m.scratch);
+    free_padded(padded);
+
+    // sum histograms from all processes
+    HistogramCount global_histogram[256];
+    TIMING_START(t_reduce);
+    MPI_Allreduce(local_histogram, global_histogram, 256, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+    TIMING_STOP(t_reduce, STAGE_MPI, 0);
+
+    TIMING_START(t_eq);
+    uint8_t lut[256];
+    build_equalization_lut(global_histogram, (HistogramCount)width * strip->height, lut);
+    fused_equalize_rows(out, luma, lut, 0, rows);
+    TIMING_STOP(t_eq, STAGE_EQUALIZE, 0);
+
+    free(luma);
+}
+
+// luma-first order on the strip: luma of the own and halo rows, median of
+// the own rows' luma, then the LUT from the global histogram
+void process_strip_luma(Strip *strip, BMPImage *out, int mask_size, const Options *opts) {
+    int width = strip->width;
+    int local_rows = strip->image.height;
+    int rows = out->height;
+
+    // the median reads the luma of the halo rows: exchange them first
+    strip_exchange_halos(strip, MPI_COMM_WORLD);
+    TIMING_START(t_gray);
+    PaddedImage *plane = create_padded(width, local_rows, 1, padded_border(opts->border, mask_size));
+    luma_plane_rows(&strip->image, plane, 0, local_rows);
+    padded_fill_border(plane, opts->border);
+    TIMING_STOP(t_gray, STAGE_GRAYSCALE, 0);
+
+    TIMING_START(t_median);
+    uint8_t *filtered = (uint8_t*)malloc((size_t)width * rows);
+    HistogramCount local_histogram[256] = {0};
+    luma_median_rows(padded_view(plane, opts->border), filtered, local_histogram, mask_size,
+                     strip->halo_top, strip->halo_top + rows, opts->median, NULL);
+    TIMING_STOP(t_median, STAGE_MEDIAN, 0);
+
+    // sum histograms from all processes
+    HistogramCount global_histogram[256];
+    TIMING_START(t_reduce);
+    MPI_Allreduce(local_histogram, global_histogram, 256, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+    TIMING_STOP(t_reduce, STAGE_MPI, 0);
+
+    TIMING_START(t_eq);
+    uint8_t lut[256];
+    build_equalization_lut(global_histogram, (HistogramCount)width * strip->height, lut);
+    fused_equalize_rows(out, filtered, lut, 0, rows);
+    TIMING_STOP(t_eq, STAGE_EQUALIZE, 0);
+
+    free(filtered);
+    free_padded(plane);
+}
 
-    for (int y = start_y; y < end_y; y++) {
-        for (int x = 0; x < width; x++) {
-            for (int channel = 0; channel < 3; channel++) {
-                int count = 0;
+// stages of one batch image (async batches)
+static void process_quiet(const BMPImage *src, BMPImage *dst, int mask_size,
+                          const Options *opts, Arena *arena) {
+    process_image(src, dst, mask_size, opts, arena, 0);
+}
 
-                for (int dy = -half; dy <= half; dy++) {
-                    for (int dx = -half; dx <= half; dx++) {
-                        int ny = y + dy;
-                        int nx = x + dx;
+// batch of images: whole images are dealt round-robin to the processes,
+// and each process filters its images alone with its own arena; returns
+// the exit status
+static int process_batch(const char *input_arg, int mask_size, const Options *opts,
+                         int rank, int size) {
+    BatchList inputs;
+    if (batch_inputs(input_arg, &inputs) != 0) {
+        return 1;
+    }
 
-                        if (ny >= 0 && ny < height && nx >= 0 && nx < width) {
-                            int idx = ny * row_size + nx * 3 + channel;
-                            mask_values[count++] = original[idx];
-                        }
-                    }
-                }
+    // every process reads and writes its own files
+    Options local = *opts;
+    if (local.io == IO_MPIIO) {
+        local.io = IO_STDIO;
+    }
 
-                qsort(mask_values, count, sizeof(uint8_t), compare_uint8_mpi);
+    Arena arena;
+    arena_init(&arena);
+    double time_spent = 0.0;
+    int failures = 0;
 
-                uint8_t median = mask_values[count / 2];
-                int idx = y * row_size + x * 3 + channel;
-                img->data[idx] = median;
+    if (local.batch == BATCH_ASYNC) {
+        // this process's share of the list (the paths stay owned by inputs)
+        BatchList mine = { (char**)malloc(((inputs.count + size - 1) / size + 1) * sizeof(char*)), 0 };
+        for (int i = rank; i < inputs.count; i += size) {
+            mine.paths[mine.count++] = inputs.paths[i];
+        }
+        failures = async_batch(&mine, "mpi", mask_size, &local, process_quiet, &time_spent);
+        free(mine.paths);
+    } else {
+        for (int i = rank; i < inputs.count; i += size) {
+            char output_file[4096];
+            output_path(output_file, sizeof(output_file), "mpi", mask_size, inputs.paths[i], 1);
+            printf("[%d/%d] processo %d: %s -> %s\n", i + 1, inputs.count, rank, inputs.paths[i], output_file);
+
+            ImageFiles files;
+            if (open_image_files(&files, inputs.paths[i], output_file, local.io, &arena,
+                                 NULL, NULL) != 0) {
+                failures++;
+            } else {
+                double start_time = MPI_Wtime();
+                process_image(files.src, files.dst, mask_size, &local, &arena, 0);
+                double spent = MPI_Wtime() - start_time;
+                TIMING_RECORD(STAGE_TOTAL, 0, spent);
+                time_spent += spent;
+                close_image_files(&files, output_file);
             }
+
+            // buffers are reused by the next image
+            arena_reset(&arena);
         }
     }
 
-    free(mask_values);
-    free(original);
-}
+    // the batch takes as long as the busiest process
+    int total_failures;
+    double max_time;
+    MPI_Reduce(&failures, &total_failures, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&time_spent, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
 
-void convert_to_grayscale_region(BMPImage *img, int start_y, int end_y) {
-    int width = img->width;
-    int row_size = ((width * 3 + 3) / 4) * 4;
-
-    for (int y = start_y; y < end_y; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * row_size + x * 3;
-            uint8_t B = img->data[idx];
-            uint8_t G = img->data[idx + 1];
-            uint8_t R = img->data[idx + 2];
-            uint8_t gray = (uint8_t)(0.299 * R + 0.587 * G + 0.114 * B);
-            img->data[idx] = gray;
-            img->data[idx + 1] = gray;
-            img->data[idx + 2] = gray;
-        }
+    if (rank == 0) {
+        printf("Imagens processadas: %d de %d\n", inputs.count - total_failures, inputs.count);
+        printf("TEMPO_TOTAL=%.6f\n", max_time);
     }
+
+    arena_free(&arena);
+    free_batch_list(&inputs);
+    strip_gather_timing(opts, "mpi", mask_size, MPI_COMM_WORLD);
+    MPI_Bcast(&total_failures, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return total_failures ? 1 : 0;
 }
 
+// prints the run parameters once the image is loaded
+static void print_image_info(int width, int height, int mask_size, int size) {
+    printf("Imagem carregada: %dx%d\n", width, height);
+    printf("Matriz de %d\n", mask_size);
+    printf("Processando com %d processos...\n", size);
+}
 
-void collect_histogram_region(BMPImage *img, int *histogram, int start_y, int end_y) {
-    int width = img->width;
-    int row_size = ((width * 3 + 3) / 4) * 4;
+// --distribute=dynamic on one image: rank 0 loads it, coordinates the
+// other ranks and saves the result, which goes to a second buffer (or the
+// mapped output) since blocks sent later still read the input rows
+static int process_dynamic(const char *input_file, const char *output_file, int mask_size,
+                           const Options *opts, int rank, int size) {
+    BMPImage *img = NULL;
+    BMPImage result;
+    BMPImage *dst = &result;
+    MappedBMP *input_map = NULL;
+    MappedBMP *output_map = NULL;
+    int dims[2];
 
-    for (int y = start_y; y < end_y; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * row_size + x * 3;
-            uint8_t gray = img->data[idx];
-            histogram[gray]++;
+    if (rank == 0) {
+        printf("Lendo imagem: %s\n", input_file);
+        TIMING_START(t_read);
+        if (opts->io == IO_MMAP) {
+            input_map = map_bmp(input_file);
+            output_map = input_map ? create_mapped_bmp(output_file, &input_map->image) : NULL;
+            if (!output_map) {
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            img = &input_map->image;
+            dst = &output_map->image;
+        } else {
+            img = read_bmp(input_file);
+            if (!img) {
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            int row_size = ((img->width * 3 + 3) / 4) * 4;
+            result = *img;
+            result.data = (uint8_t*)malloc((size_t)row_size * img->height);
         }
+        TIMING_STOP(t_read, STAGE_READ, 0);
+        print_image_info(img->width, img->height, mask_size, size);
+        printf("Distribuição dinâmica: processo 0 coordena %d processos\n", size - 1);
+        dims[0] = img->width;
+        dims[1] = img->height;
     }
-}
+    MPI_Bcast(dims, 2, MPI_INT, 0, MPI_COMM_WORLD);
 
-void apply_equalization_region(BMPImage *img, int *cumulative, int total_pixels, int start_y, int end_y) {
-    int width = img->width;
-    int row_size = ((width * 3 + 3) / 4) * 4;
-
-    for (int y = start_y; y < end_y; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * row_size + x * 3;
-            uint8_t gray = img->data[idx];
-            uint8_t new_value = (uint8_t)((cumulative[gray] * 255.0) / total_pixels);
-            img->data[idx] = new_value;
-            img->data[idx + 1] = new_value;
-            img->data[idx + 2] = new_value;
-        }
+    if (rank != 0) {
+        dynamic_work(dims[0], dims[1], mask_size, opts, MPI_COMM_WORLD);
+        strip_gather_timing(opts, "mpi", mask_size, MPI_COMM_WORLD);
+        return 0;
+    }
+
+    double start_time = MPI_Wtime();
+    // the share of each worker is a diagnostic, printed with --timing
+    dynamic_coordinate(img, dst, mask_size, opts->timing != TIMING_NONE, MPI_COMM_WORLD);
+    double time_spent = MPI_Wtime() - start_time;
+    TIMING_RECORD(STAGE_TOTAL, 0, time_spent);
+
+    printf("Salvando imagem: %s\n", output_file);
+    TIMING_START(t_write);
+    if (opts->io == IO_MMAP) {
+        unmap_bmp(output_map);
+        unmap_bmp(input_map);
+    } else {
+        write_bmp(output_file, &result);
+        free(result.data);
+        free_bmp(img);
     }
+    TIMING_STOP(t_write, STAGE_WRITE, 0);
+    printf("TEMPO_TOTAL=%.6f\n", time_spent);
+    strip_gather_timing(opts, "mpi", mask_size, MPI_COMM_WORLD);
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -110,10 +377,12 @@ int main(int argc, char *argv[]) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc != 3) {
+    if (argc < 3) {
         if (rank == 0) {
-            printf("Uso: mpirun -np <num_processos> %s <tamanho_mascara> <arquivo_entrada>\n", argv[0]);
+            printf("Uso: mpirun -np <num_processos> %s <tamanho_mascara> <arquivo_entrada> [opções]\n", argv[0]);
             printf("Exemplo: mpirun -np 4 %s 3 data/img.bmp\n", argv[0]);
+            printf("<arquivo_entrada> pode ser um diretório (todos os .bmp), @lista.txt (um caminho por linha) ou quadros numerados (quadros/f_%%04d.bmp)\n");
+            print_options_usage();
         }
         MPI_Finalize();
         return 1;
@@ -128,150 +397,104 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    const char *input_file = argv[2];
-    
-    char output_file[256];
-    if (rank == 0) {
-        snprintf(output_file, sizeof(output_file), "output/mpi_%d_output.bmp", mask_size);
+    Options opts;
+    options_init(&opts);
+    int bad = parse_options(argc, argv, 3, &opts);
+    if (bad) {
+        if (rank == 0) {
+            printf("Opção inválida: %s\n", argv[bad]);
+            print_options_usage();
+        }
+        MPI_Finalize();
+        return 1;
     }
-
-    BMPImage *img = NULL;
-    double start_time = 0.0, end_time;
-
-    // process 0 reads the image
-    if (rank == 0) {
-        printf("Lendo imagem: %s\n", input_file);
-        img = read_bmp(input_file);
-        if (!img) {
-            MPI_Abort(MPI_COMM_WORLD, 1);
+    if (opts.pipeline == PIPELINE_STREAM) {
+        if (rank == 0) {
+            printf("--pipeline=stream só é suportado na versão sequencial\n");
         }
-        printf("Imagem carregada: %dx%d\n", img->width, img->height);
-        printf("Matriz de %d\n", mask_size);
-        printf("Processando com %d processos...\n", size);
-        start_time = MPI_Wtime();
+        MPI_Finalize();
+        return 1;
     }
-
-    // broadcast image dimensions to all processes
-    int width, height, row_size, data_size;
-    if (rank == 0) {
-        width = img->width;
-        height = img->height;
-        row_size = ((width * 3 + 3) / 4) * 4;
-        data_size = row_size * height;
+    const char *unsupported = unsupported_option(&opts, OPTIONS_PIPELINE | OPTIONS_MPI |
+                                                        OPTIONS_DISTRIBUTE | OPTIONS_BATCH);
+    if (unsupported) {
+        if (rank == 0) {
+            printf("%s não é suportado na versão MPI\n", unsupported);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (!border_supported(&opts)) {
+        if (rank == 0) {
+            printf("--border=replicate|reflect não é suportado com --layout=planar nem --pipeline=stream\n");
+        }
+        MPI_Finalize();
+        return 1;
     }
 
-    MPI_Bcast(&width, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&height, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&row_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&data_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-    // all processes allocate memory
-    if (rank != 0) {
-        img = (BMPImage*)malloc(sizeof(BMPImage));
-        img->width = width;
-        img->height = height;
-        img->data = (uint8_t*)malloc(data_size);
+    // dynamic blocks go through the staged pipeline, arrive with their
+    // halos and are read and written by rank 0
+    if (opts.distribute == DISTRIBUTE_DYNAMIC &&
+        (opts.order == ORDER_LUMA_FIRST || opts.pipeline == PIPELINE_FUSED ||
+         opts.layout == LAYOUT_PLANAR || opts.halo == HALO_OVERLAP || opts.io == IO_MPIIO)) {
+        if (rank == 0) {
+            printf("--distribute=dynamic não é suportado com --order=luma-first, --pipeline=fused, "
+                   "--layout=planar, --halo=overlap nem --io=mpiio\n");
+        }
+        MPI_Finalize();
+        return 1;
     }
 
-    // broadcast image data to all processes
-    MPI_Bcast(img->data, data_size, MPI_BYTE, 0, MPI_COMM_WORLD);
+    timing_init(&opts, rank == 0);
 
-    // calculate each process's region
-    int rows_per_process = height / size;
-    int start_y = rank * rows_per_process;
-    int end_y = (rank == size - 1) ? height : (rank + 1) * rows_per_process;
+    const char *input_file = argv[2];
 
-    // STEP 1: median filter
-    // each process processes its region (need extra rows for border)
-    int half = mask_size / 2;
-    int local_start = (start_y > half) ? start_y - half : 0;
-    int local_end = (end_y < height - half) ? end_y + half : height;
+    if (is_batch_input(input_file)) {
+        int status = process_batch(input_file, mask_size, &opts, rank, size);
+        MPI_Finalize();
+        return status;
+    }
 
-    apply_median_filter_region(img, mask_size, local_start, local_end);
+    char output_file[256];
+    snprintf(output_file, sizeof(output_file), "output/mpi_%d_output.bmp", mask_size);
 
-    // gather processed parts
-    if (rank == 0) {
-        // process 0 already has its part, receive from others
-        for (int i = 1; i < size; i++) {
-            int other_start = i * rows_per_process;
-            int other_end = (i == size - 1) ? height : (i + 1) * rows_per_process;
-            int offset = other_start * row_size;
-            int recv_size = (other_end - other_start) * row_size;
-            MPI_Recv(img->data + offset, recv_size, MPI_BYTE, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        }
-    } else {
-        // other processes send only their part
-        int offset = start_y * row_size;
-        int send_size = (end_y - start_y) * row_size;
-        MPI_Send(img->data + offset, send_size, MPI_BYTE, 0, 0, MPI_COMM_WORLD);
+    // with a single process there is no one to hand blocks to
+    if (opts.distribute == DISTRIBUTE_DYNAMIC && size > 1) {
+        int status = process_dynamic(input_file, output_file, mask_size, &opts, rank, size);
+        MPI_Finalize();
+        return status;
     }
 
-    // STEP 2: convert to grayscale
-    MPI_Bcast(img->data, data_size, MPI_BYTE, 0, MPI_COMM_WORLD);
-    
-    convert_to_grayscale_region(img, start_y, end_y);
-
-    // gather results
+    // each process keeps only its rows plus the median halo
+    StripFiles files;
+    double start_time = 0.0;
+    if (strip_load(&files, input_file, output_file, mask_size, opts.io, &start_time,
+                   MPI_COMM_WORLD) != 0) {
+        MPI_Finalize();
+        return 1;
+    }
     if (rank == 0) {
-        for (int i = 1; i < size; i++) {
-            int other_start = i * rows_per_process;
-            int other_end = (i == size - 1) ? height : (i + 1) * rows_per_process;
-            int offset = other_start * row_size;
-            int recv_size = (other_end - other_start) * row_size;
-            MPI_Recv(img->data + offset, recv_size, MPI_BYTE, i, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        }
-    } else {
-        int offset = start_y * row_size;
-        int send_size = (end_y - start_y) * row_size;
-        MPI_Send(img->data + offset, send_size, MPI_BYTE, 0, 1, MPI_COMM_WORLD);
+        print_image_info(files.strip.width, files.strip.height, mask_size, size);
     }
 
-    // STEP 3: histogram equalization
-    // broadcast grayscale image to all processes
-    MPI_Bcast(img->data, data_size, MPI_BYTE, 0, MPI_COMM_WORLD);
-    
-    int local_histogram[256] = {0};
-    collect_histogram_region(img, local_histogram, start_y, end_y);
-
-    // sum histograms from all processes
-    int global_histogram[256];
-    MPI_Allreduce(local_histogram, global_histogram, 256, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-
-    // calculate cumulative histogram
-    int cumulative[256];
-    cumulative[0] = global_histogram[0];
-    for (int i = 1; i < 256; i++) {
-        cumulative[i] = cumulative[i - 1] + global_histogram[i];
+    if (opts.order == ORDER_LUMA_FIRST) {
+        process_strip_luma(&files.strip, &files.out, mask_size, &opts);
+    } else if (opts.pipeline == PIPELINE_FUSED) {
+        process_strip_fused(&files.strip, &files.out, mask_size, &opts);
+    } else if (opts.layout == LAYOUT_PLANAR) {
+        process_strip_planar(&files.strip, &files.out, mask_size, &opts);
+    } else {
+        process_strip_staged(&files.strip, &files.out, mask_size, &opts);
     }
 
-    int total_pixels = width * height;
-    apply_equalization_region(img, cumulative, total_pixels, start_y, end_y);
+    double time_spent = strip_store(&files, output_file, start_time, MPI_COMM_WORLD);
 
-    // gather final results
     if (rank == 0) {
-        for (int i = 1; i < size; i++) {
-            int other_start = i * rows_per_process;
-            int other_end = (i == size - 1) ? height : (i + 1) * rows_per_process;
-            int offset = other_start * row_size;
-            int recv_size = (other_end - other_start) * row_size;
-            MPI_Recv(img->data + offset, recv_size, MPI_BYTE, i, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        }
-
-        end_time = MPI_Wtime();
-        double time_spent = end_time - start_time;
-
-        printf("Salvando imagem: %s\n", output_file);
-        write_bmp(output_file, img);
         printf("TEMPO_TOTAL=%.6f\n", time_spent);
-    } else {
-        int offset = start_y * row_size;
-        int send_size = (end_y - start_y) * row_size;
-        MPI_Send(img->data + offset, send_size, MPI_BYTE, 0, 2, MPI_COMM_WORLD);
     }
+    strip_gather_timing(&opts, "mpi", mask_size, MPI_COMM_WORLD);
 
-    free_bmp(img);
     MPI_Finalize();
 
     return 0;
 }
-
@@ -1,170 +1,637 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <omp.h>
 #include "bmp.h"
 #include "image_processing.h"
+#include "options.h"
+#include "planar.h"
+#include "padded.h"
+#include "median_window.h"
+#include "tiles.h"
+#include "affinity.h"
+#include "timing.h"
+#include "pipeline.h"
+#include "arena.h"
+#include "batch.h"
+#include "async_batch.h"
 
-int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        printf("Uso: %s <tamanho_mascara> <num_threads> <arquivo_entrada>\n", argv[0]);
-        printf("Exemplo: %s 3 4 data/img.bmp\n", argv[0]);
-        return 1;
+// rows [y_start, y_end) of the calling thread: one contiguous band each
+static void thread_band(int height, int *y_start, int *y_end) {
+    int tid = omp_get_thread_num();
+    int nthreads = omp_get_num_threads();
+    *y_start = (int)((long)height * tid / nthreads);
+    *y_end = (int)((long)height * (tid + 1) / nthreads);
+}
+
+// what the fused median reads: src itself, or a copy of it from arena
+// (rows split among the threads) when opts asks for a replicated /
+// reflected border
+static ImageView median_source(const BMPImage *src, int mask_size, const Options *opts,
+                               Arena *arena) {
+    if (opts->border == BORDER_SHRINK) {
+        return bmp_view(src);
     }
 
-    int mask_size = atoi(argv[1]);
-    if (mask_size % 2 == 0 || mask_size < 3) {
-        printf("Tamanho da máscara deve ser ímpar e >= 3\n");
-        return 1;
+    int width = src->width;
+    int height = src->height;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    int border = padded_border(opts->border, mask_size);
+
+    PaddedImage original;
+    padded_init(&original, width, height, 3, border,
+                (uint8_t*)arena_alloc(arena, padded_size(width, height, 3, border)));
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        padded_copy_rows(&original, src->data, row_size, y_start, y_end);
+        TIMING_STOP(t, STAGE_MEDIAN, omp_get_thread_num());
     }
+    padded_fill_border(&original, opts->border);
+    return padded_view(&original, opts->border);
+}
 
-    int num_threads = atoi(argv[2]);
-    if (num_threads < 1) {
-        printf("Número de threads deve ser >= 1\n");
-        return 1;
+// median, grayscale and equalization on the interleaved BGR rows; the
+// median reads src and every stage writes img (src itself when they are
+// the same image)
+static void process_interleaved(const BMPImage *src_img, BMPImage *img, int mask_size,
+                                const Options *opts, Arena *arena, int verbose) {
+    int width = img->width;
+    int height = img->height;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+
+    // STEP 1: median filter
+    if (verbose) {
+        printf("Aplicando filtro mediana %dx%d...\n", mask_size, mask_size);
     }
 
-    omp_set_num_threads(num_threads);
+    if (src_img == img || opts->border != BORDER_SHRINK) {
+        // in place or with a frame: each thread reads its band through a
+        // rolling window of rows instead of a copy of the image
+        size_t window_size = median_window_size(width, mask_size, opts->border);
+        uint8_t *windows = (uint8_t*)arena_alloc(arena, window_size * omp_get_max_threads());
 
-    const char *input_file = argv[3];
-    
-    char output_file[256];
-    snprintf(output_file, sizeof(output_file), "output/openmp_%d_output.bmp", mask_size);
+        #pragma omp parallel
+        {
+            TIMING_START(t);
+            int y_start, y_end;
+            thread_band(height, &y_start, &y_end);
 
-    printf("Lendo imagem: %s\n", input_file);
-    BMPImage *img = read_bmp(input_file);
-    if (!img) {
-        return 1;
+            MedianWindow window;
+            median_window_init(&window, src_img, img, mask_size, opts->border, opts->median,
+                               y_start, y_end, windows + window_size * omp_get_thread_num());
+
+            // every window holds the rows it shares with the neighbouring
+            // bands before any band is overwritten
+            #pragma omp barrier
+
+            median_window_run(&window);
+            TIMING_STOP(t, STAGE_MEDIAN, omp_get_thread_num());
+        }
+    } else {
+        ImageView src = bmp_view(src_img);
+
+        #pragma omp parallel
+        {
+            // each thread filters one contiguous band of rows, so the
+            // histogram engine can slide down the whole band
+            TIMING_START(t);
+            int y_start, y_end;
+            thread_band(height, &y_start, &y_end);
+
+            median_filter_rows(src, img->data + (size_t)y_start * row_size, row_size,
+                               mask_size, y_start, y_end, opts->median);
+            TIMING_STOP(t, STAGE_MEDIAN, omp_get_thread_num());
+        }
     }
 
-    printf("Imagem carregada: %dx%d\n", img->width, img->height);
-    printf("Matriz de %d\n", mask_size);
-    printf("Processando com %d threads...\n", num_threads);
+    // STEP 2: convert to grayscale
+    if (verbose) {
+        printf("Convertendo para tons de cinza...\n");
+    }
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        grayscale_rows(img, y_start, y_end);
+        TIMING_STOP(t, STAGE_GRAYSCALE, omp_get_thread_num());
+    }
 
-    double start_time = omp_get_wtime();
+    // STEP 3: histogram equalization
+    if (verbose) {
+        printf("Equalizando histograma...\n");
+    }
+    HistogramCount histogram[256] = {0};
 
-    // STEP 1: median filter
-    printf("Aplicando filtro mediana %dx%d...\n", mask_size, mask_size);
+    // calculate histogram: each thread counts into its own copy, summed
+    // when the region ends
+    #pragma omp parallel reduction(+:histogram[:256])
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        histogram_rows(img, histogram, y_start, y_end);
+        TIMING_STOP(t, STAGE_HISTOGRAM, omp_get_thread_num());
+    }
+
+    // calculate cumulative histogram
+    HistogramCount cumulative[256];
+    cumulative[0] = histogram[0];
+    for (int i = 1; i < 256; i++) {
+        cumulative[i] = cumulative[i - 1] + histogram[i];
+    }
+
+    HistogramCount total_pixels = (HistogramCount)width * height;
+
+    // apply equalization (each thread builds the 256-entry LUT of its band)
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        equalize_rows(img, cumulative, total_pixels, y_start, y_end);
+        TIMING_STOP(t, STAGE_EQUALIZE, omp_get_thread_num());
+    }
+}
+
+// PlaceImageFn of --schedule=tiles: each thread first touches the input
+// rows of its home band (ctx points to the mask size, which sets the grid)
+static void place_home_rows(uint8_t *data, int width, int height, void *ctx) {
+    int mask_size = *(const int*)ctx;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    TileGrid grid;
+    tile_grid_init(&grid, width, height, mask_size, omp_get_max_threads());
+
+    #pragma omp parallel
+    {
+        int y_start, y_end;
+        tile_grid_home_rows(&grid, omp_get_thread_num(), &y_start, &y_end);
+        first_touch(data + (size_t)y_start * row_size, (size_t)(y_end - y_start) * row_size);
+    }
+    tile_grid_free(&grid);
+}
+
+// the interleaved stages over tiles (--schedule=tiles). A tile's median
+// reads the rows of the tiles around it, so it cannot write over src: in
+// place, the stages write a new buffer from arena, which then replaces
+// img->data.
+static void process_tiles(const BMPImage *src_img, BMPImage *img, int mask_size,
+                          const Options *opts, Arena *arena, int verbose) {
     int width = img->width;
     int height = img->height;
     int row_size = ((width * 3 + 3) / 4) * 4;
-    int half = mask_size / 2;
+    int threads = omp_get_max_threads();
+    TileGrid grid;
+    tile_grid_init(&grid, width, height, mask_size, threads);
 
-    uint8_t *original = (uint8_t*)malloc(row_size * height);
-    #pragma omp parallel for
-    for (int i = 0; i < row_size * height; i++) {
-        original[i] = img->data[i];
+    BMPImage out = *img;
+    if (src_img == img) {
+        out.data = (uint8_t*)arena_alloc(arena, (size_t)row_size * height);
+    }
+    int border = padded_border(opts->border, mask_size);
+    PaddedImage framed;
+    if (border > 0) {
+        padded_init(&framed, width, height, 3, border,
+                    (uint8_t*)arena_alloc(arena, padded_size(width, height, 3, border)));
     }
+    size_t scratch_size = tile_scratch_size(&grid, mask_size);
+    uint8_t *scratch = (uint8_t*)arena_alloc(arena, scratch_size * threads);
 
+    // STEP 1: median filter
+    if (verbose) {
+        printf("Aplicando filtro mediana %dx%d...\n", mask_size, mask_size);
+    }
     #pragma omp parallel
     {
-        uint8_t *mask_values = (uint8_t*)malloc(mask_size * mask_size * sizeof(uint8_t));
-
-        #pragma omp for
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                for (int channel = 0; channel < 3; channel++) {
-                    int count = 0;
-
-                    for (int dy = -half; dy <= half; dy++) {
-                        for (int dx = -half; dx <= half; dx++) {
-                            int ny = y + dy;
-                            int nx = x + dx;
-
-                            if (ny >= 0 && ny < height && nx >= 0 && nx < width) {
-                                int idx = ny * row_size + nx * 3 + channel;
-                                mask_values[count++] = original[idx];
-                            }
-                        }
-                    }
-
-                    qsort(mask_values, count, sizeof(uint8_t), compare_uint8);
-                    uint8_t median = mask_values[count / 2];
-                    int idx = y * row_size + x * 3 + channel;
-                    img->data[idx] = median;
-                }
+        TIMING_START(t);
+        int tid = omp_get_thread_num();
+        int y_start, y_end;
+        tile_grid_home_rows(&grid, tid, &y_start, &y_end);
+
+        // the home band of every buffer is first touched by its thread
+        if (out.data != img->data) {
+            first_touch(out.data + (size_t)y_start * row_size, (size_t)(y_end - y_start) * row_size);
+
+            // the stages only write pixels: keep the input's row padding
+            size_t pixels = (size_t)width * 3;
+            for (int y = y_start; y < y_end && pixels < (size_t)row_size; y++) {
+                memcpy(out.data + (size_t)y * row_size + pixels,
+                       src_img->data + (size_t)y * row_size + pixels, row_size - pixels);
             }
         }
+        if (border > 0) {
+            padded_copy_rows(&framed, src_img->data, row_size, y_start, y_end);
+        }
+
+        // no tile is taken (possibly from another home band) before every
+        // band is touched and copied
+        #pragma omp barrier
+        if (border > 0) {
+            #pragma omp single
+            padded_fill_border(&framed, opts->border);
+        }
 
-        free(mask_values);
+        ImageView view = (border > 0) ? padded_view(&framed, opts->border) : bmp_view(src_img);
+        Tile tile;
+        while (tile_grid_next(&grid, tid, &tile) == 0) {
+            tile_median(view, &out, &tile, mask_size, opts->median, scratch + scratch_size * tid);
+        }
+        TIMING_STOP(t, STAGE_MEDIAN, tid);
     }
 
-    free(original);
+    // STEP 2 and 3: grayscale and histogram of each tile while it is in cache
+    if (verbose) {
+        printf("Convertendo para tons de cinza...\n");
+        printf("Equalizando histograma...\n");
+    }
+    HistogramCount histogram[256] = {0};
+    tile_grid_reset(&grid);
 
-    // STEP 2: convert to grayscale
-    printf("Convertendo para tons de cinza...\n");
-    #pragma omp parallel for
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * row_size + x * 3;
-            uint8_t B = img->data[idx];
-            uint8_t G = img->data[idx + 1];
-            uint8_t R = img->data[idx + 2];
-            uint8_t gray = (uint8_t)(0.299 * R + 0.587 * G + 0.114 * B);
-            img->data[idx] = gray;
-            img->data[idx + 1] = gray;
-            img->data[idx + 2] = gray;
+    #pragma omp parallel reduction(+:histogram[:256])
+    {
+        TIMING_START(t);
+        int tid = omp_get_thread_num();
+        Tile tile;
+        while (tile_grid_next(&grid, tid, &tile) == 0) {
+            tile_grayscale_histogram(&out, &tile, histogram);
         }
+        TIMING_STOP(t, STAGE_GRAYSCALE, tid);
     }
 
-    // STEP 3: histogram equalization
-    printf("Equalizando histograma...\n");
-    int histogram[256] = {0};
+    uint8_t lut[256];
+    build_equalization_lut(histogram, (HistogramCount)width * height, lut);
+    tile_grid_reset(&grid);
 
-    // calculate histogram
     #pragma omp parallel
     {
-        int local_histogram[256] = {0};
-
-        #pragma omp for
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                int idx = y * row_size + x * 3;
-                uint8_t gray = img->data[idx];
-                local_histogram[gray]++;
-            }
+        TIMING_START(t);
+        int tid = omp_get_thread_num();
+        Tile tile;
+        while (tile_grid_next(&grid, tid, &tile) == 0) {
+            tile_equalize(&out, &tile, lut);
         }
+        TIMING_STOP(t, STAGE_EQUALIZE, tid);
+    }
 
-        // sum local histograms
-        #pragma omp critical
-        {
-            for (int i = 0; i < 256; i++) {
-                histogram[i] += local_histogram[i];
-            }
-        }
+    img->data = out.data;
+    tile_grid_free(&grid);
+}
+
+// same stages on B, G, R and luma planes: split src once, write the luma
+// back into img once
+static void process_planar(const BMPImage *src, BMPImage *img, int mask_size,
+                           const Options *opts, Arena *arena, int verbose) {
+    int width = img->width;
+    int height = img->height;
+    PlanarImage planar_image, filtered_image;
+    planar_init(&planar_image, width, height, (uint8_t*)arena_alloc(arena, planar_size(width, height)));
+    planar_init(&filtered_image, width, height, (uint8_t*)arena_alloc(arena, planar_size(width, height)));
+    PlanarImage *planar = &planar_image;
+    PlanarImage *filtered = &filtered_image;
+
+    // STEP 1: median filter
+    if (verbose) {
+        printf("Aplicando filtro mediana %dx%d...\n", mask_size, mask_size);
+    }
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+
+        bmp_to_planar_rows(src, planar, y_start, y_end);
+
+        // the median of a band reads the rows of the neighbouring bands
+        #pragma omp barrier
+
+        planar_median_rows(planar, filtered, mask_size, y_start, y_end, opts->median);
+        TIMING_STOP(t, STAGE_MEDIAN, omp_get_thread_num());
+    }
+
+    // STEP 2: convert to grayscale
+    if (verbose) {
+        printf("Convertendo para tons de cinza...\n");
+    }
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        planar_grayscale_rows(filtered, y_start, y_end);
+        TIMING_STOP(t, STAGE_GRAYSCALE, omp_get_thread_num());
+    }
+
+    // STEP 3: histogram equalization
+    if (verbose) {
+        printf("Equalizando histograma...\n");
+    }
+    HistogramCount histogram[256] = {0};
+
+    #pragma omp parallel reduction(+:histogram[:256])
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        planar_histogram_rows(filtered, histogram, y_start, y_end);
+        TIMING_STOP(t, STAGE_HISTOGRAM, omp_get_thread_num());
     }
 
     // calculate cumulative histogram
-    int cumulative[256];
+    HistogramCount cumulative[256];
     cumulative[0] = histogram[0];
     for (int i = 1; i < 256; i++) {
         cumulative[i] = cumulative[i - 1] + histogram[i];
     }
 
-    int total_pixels = width * height;
+    HistogramCount total_pixels = (HistogramCount)width * height;
 
-    // apply equalization
-    #pragma omp parallel for
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * row_size + x * 3;
-            uint8_t gray = img->data[idx];
-            uint8_t new_value = (uint8_t)((cumulative[gray] * 255.0) / total_pixels);
-            img->data[idx] = new_value;
-            img->data[idx + 1] = new_value;
-            img->data[idx + 2] = new_value;
-        }
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        planar_equalize_rows(filtered, cumulative, total_pixels, y_start, y_end);
+        luma_to_bmp_rows(filtered, img, y_start, y_end);
+        TIMING_STOP(t, STAGE_EQUALIZE, omp_get_thread_num());
     }
+}
 
-    double end_time = omp_get_wtime();
-    double time_spent = end_time - start_time;
+// fused strips: each thread runs median, luma and histogram over the strips
+// of its band of src, then remaps its band of img through the shared LUT
+static void process_fused(const BMPImage *src, BMPImage *img, int mask_size,
+                          const Options *opts, Arena *arena, int verbose) {
+    int width = img->width;
+    int height = img->height;
+    uint8_t *luma = (uint8_t*)arena_alloc(arena, (size_t)width * height);
+    HistogramCount histogram[256] = {0};
+    uint8_t lut[256];
+
+    if (verbose) {
+        printf("Mediana %dx%d, tons de cinza e histograma em faixas...\n", mask_size, mask_size);
+    }
+    // the fused pass writes luma, not src, so it only needs a copy for a border
+    ImageView view = median_source(src, mask_size, opts, arena);
+    size_t scratch_size = fused_scratch_size(width, mask_size);
+    uint8_t *scratch = (uint8_t*)arena_alloc(arena, scratch_size * omp_get_max_threads());
+
+    #pragma omp parallel reduction(+:histogram[:256])
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+
+        fused_median_luma_rows(view, luma + (size_t)y_start * width, histogram, mask_size,
+                               y_start, y_end, opts->median,
+                               scratch + scratch_size * omp_get_thread_num());
+        TIMING_STOP(t, STAGE_MEDIAN, omp_get_thread_num());
+    }
+
+    // the bands are the same in both regions, so each thread remaps the
+    // luma rows it wrote
+    build_equalization_lut(histogram, (HistogramCount)width * height, lut);
+
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        fused_equalize_rows(img, luma + (size_t)y_start * width, lut, y_start, y_end);
+        TIMING_STOP(t, STAGE_EQUALIZE, omp_get_thread_num());
+    }
+}
+
+// luma-first order: each thread converts its band to luma, then filters
+// and counts it once every band's luma is there, then remaps it
+static void process_luma_first(const BMPImage *src, BMPImage *img, int mask_size,
+                               const Options *opts, Arena *arena, int verbose) {
+    int width = img->width;
+    int height = img->height;
+    int border = padded_border(opts->border, mask_size);
+    PaddedImage plane;
+    padded_init(&plane, width, height, 1, border,
+                (uint8_t*)arena_alloc(arena, padded_size(width, height, 1, border)));
+    uint8_t *filtered = (uint8_t*)arena_alloc(arena, (size_t)width * height);
+    HistogramCount histogram[256] = {0};
+    uint8_t lut[256];
+
+    if (verbose) {
+        printf("Convertendo para tons de cinza e aplicando filtro mediana %dx%d na luminância...\n",
+               mask_size, mask_size);
+    }
+    ImageView view = padded_view(&plane, opts->border);
+    size_t scratch_size = median_scratch_size(width, 1, mask_size);
+    uint8_t *scratch = (uint8_t*)arena_alloc(arena, scratch_size * omp_get_max_threads());
+
+    #pragma omp parallel reduction(+:histogram[:256])
+    {
+        TIMING_START(t_gray);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        luma_plane_rows(src, &plane, y_start, y_end);
+        TIMING_STOP(t_gray, STAGE_GRAYSCALE, omp_get_thread_num());
+
+        // the median of a band reads the luma of the neighbouring bands
+        #pragma omp barrier
+        #pragma omp single
+        padded_fill_border(&plane, opts->border);
+
+        TIMING_START(t_median);
+        luma_median_rows(view, filtered + (size_t)y_start * width, histogram, mask_size,
+                         y_start, y_end, opts->median, scratch + scratch_size * omp_get_thread_num());
+        TIMING_STOP(t_median, STAGE_MEDIAN, omp_get_thread_num());
+    }
+
+    if (verbose) {
+        printf("Equalizando histograma...\n");
+    }
+    build_equalization_lut(histogram, (HistogramCount)width * height, lut);
+
+    #pragma omp parallel
+    {
+        TIMING_START(t);
+        int y_start, y_end;
+        thread_band(height, &y_start, &y_end);
+        fused_equalize_rows(img, filtered + (size_t)y_start * width, lut, y_start, y_end);
+        TIMING_STOP(t, STAGE_EQUALIZE, omp_get_thread_num());
+    }
+}
+
+// the stages selected by opts
+static void process_stages(const BMPImage *src, BMPImage *img, int mask_size,
+                           const Options *opts, Arena *arena, int verbose) {
+    if (opts->order == ORDER_LUMA_FIRST) {
+        process_luma_first(src, img, mask_size, opts, arena, verbose);
+    } else if (opts->pipeline == PIPELINE_FUSED) {
+        process_fused(src, img, mask_size, opts, arena, verbose);
+    } else if (opts->layout == LAYOUT_PLANAR) {
+        process_planar(src, img, mask_size, opts, arena, verbose);
+    } else if (opts->schedule == SCHEDULE_TILES) {
+        process_tiles(src, img, mask_size, opts, arena, verbose);
+    } else {
+        process_interleaved(src, img, mask_size, opts, arena, verbose);
+    }
+}
+
+// stages of one batch image (async batches), on the whole thread team
+static void process_quiet(const BMPImage *src, BMPImage *img, int mask_size,
+                          const Options *opts, Arena *arena) {
+    process_stages(src, img, mask_size, opts, arena, 0);
+}
+
+// loads, processes and saves one image; returns 0, or -1 after printing
+// the error. The stage messages are printed when verbose.
+static int run_image(const char *input_file, const char *output_file, int mask_size,
+                     int num_threads, const Options *opts, Arena *arena, int verbose,
+                     double *time_spent) {
+    if (verbose) {
+        printf("Lendo imagem: %s\n", input_file);
+    }
+
+    // with --io=mmap the stages read the input mapping and write straight
+    // into the mapped output file; otherwise they work in place on the
+    // image read into the arena
+    ImageFiles files;
+    PlaceImageFn place = (opts->schedule == SCHEDULE_TILES) ? place_home_rows : NULL;
+    if (open_image_files(&files, input_file, output_file, opts->io, arena, place, &mask_size) != 0) {
+        return -1;
+    }
+
+    if (verbose) {
+        printf("Imagem carregada: %dx%d\n", files.src->width, files.src->height);
+        printf("Matriz de %d\n", mask_size);
+        printf("Processando com %d threads...\n", num_threads);
+    }
+
+    double start_time = omp_get_wtime();
 
-    printf("Salvando imagem: %s\n", output_file);
-    write_bmp(output_file, img);
+    process_stages(files.src, files.dst, mask_size, opts, arena, verbose);
 
-    printf("TEMPO_TOTAL=%.6f\n", time_spent);
-    free_bmp(img);
+    double end_time = omp_get_wtime();
+    *time_spent = end_time - start_time;
+    TIMING_RECORD(STAGE_TOTAL, 0, *time_spent);
 
+    if (verbose) {
+        printf("Salvando imagem: %s\n", output_file);
+    }
+    close_image_files(&files, output_file);
     return 0;
 }
 
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        printf("Uso: %s <tamanho_mascara> <num_threads> <arquivo_entrada> [opções]\n", argv[0]);
+        printf("Exemplo: %s 3 4 data/img.bmp\n", argv[0]);
+        printf("<arquivo_entrada> pode ser um diretório (todos os .bmp), @lista.txt (um caminho por linha) ou quadros numerados (quadros/f_%%04d.bmp)\n");
+        print_options_usage();
+        return 1;
+    }
+
+    int mask_size = atoi(argv[1]);
+    if (mask_size % 2 == 0 || mask_size < 3) {
+        printf("Tamanho da máscara deve ser ímpar e >= 3\n");
+        return 1;
+    }
+
+    int num_threads = atoi(argv[2]);
+    if (num_threads < 1) {
+        printf("Número de threads deve ser >= 1\n");
+        return 1;
+    }
+
+    Options opts;
+    options_init(&opts);
+    int bad = parse_options(argc, argv, 4, &opts);
+    if (bad) {
+        printf("Opção inválida: %s\n", argv[bad]);
+        print_options_usage();
+        return 1;
+    }
+    if (opts.pipeline == PIPELINE_STREAM) {
+        printf("--pipeline=stream só é suportado na versão sequencial\n");
+        return 1;
+    }
+    const char *unsupported = unsupported_option(&opts, OPTIONS_PIPELINE | OPTIONS_SCHEDULE |
+                                                        OPTIONS_PIN | OPTIONS_BATCH);
+    if (unsupported) {
+        printf("%s não é suportado na versão OpenMP\n", unsupported);
+        return 1;
+    }
+    // the tiles only schedule the staged interleaved stages
+    if (opts.schedule == SCHEDULE_TILES &&
+        (opts.order == ORDER_LUMA_FIRST || opts.pipeline == PIPELINE_FUSED || opts.layout == LAYOUT_PLANAR)) {
+        printf("--schedule=tiles não é suportado com --order=luma-first, --pipeline=fused nem --layout=planar\n");
+        return 1;
+    }
+    if (!border_supported(&opts)) {
+        printf("--border=replicate|reflect não é suportado com --layout=planar nem --pipeline=stream\n");
+        return 1;
+    }
+
+    omp_set_num_threads(num_threads);
+
+    if (opts.pin != PIN_NONE) {
+        int failed = 0;
+        #pragma omp parallel reduction(+:failed)
+        failed += (pin_thread(opts.pin, omp_get_thread_num()) != 0);
+        if (failed) {
+            printf("Aviso: %d threads não puderam ser fixadas (--pin)\n", failed);
+        }
+    }
+
+    timing_init(&opts, 1);
+
+    // one file, or every image of a directory / @list in this process
+    const char *input_arg = argv[3];
+    int batch = is_batch_input(input_arg);
+    BatchList inputs;
+    if (batch_inputs(input_arg, &inputs) != 0) {
+        return 1;
+    }
+
+    Arena arena;
+    arena_init(&arena);
+    double total_time = 0.0;
+    int failures = 0;
+
+    // the I/O threads keep the team fed: one image is read and one written
+    // while the team processes another
+    if (batch && opts.batch == BATCH_ASYNC) {
+        failures = async_batch(&inputs, "openmp", mask_size, &opts, process_quiet, &total_time);
+    } else {
+        for (int i = 0; i < inputs.count; i++) {
+            char output_file[4096];
+            output_path(output_file, sizeof(output_file), "openmp", mask_size, inputs.paths[i], batch);
+            if (batch) {
+                printf("[%d/%d] %s -> %s\n", i + 1, inputs.count, inputs.paths[i], output_file);
+            }
+
+            double time_spent = 0.0;
+            if (run_image(inputs.paths[i], output_file, mask_size, num_threads, &opts, &arena,
+                          !batch, &time_spent) != 0) {
+                failures++;
+            }
+            total_time += time_spent;
+
+            // buffers are reused by the next image
+            arena_reset(&arena);
+        }
+    }
+
+    arena_free(&arena);
+    int count = inputs.count;
+    free_batch_list(&inputs);
+
+    if (batch) {
+        printf("Imagens processadas: %d de %d\n", count - failures, count);
+    } else if (failures) {
+        return 1;
+    }
+    printf("TEMPO_TOTAL=%.6f\n", total_time);
+    timing_finish(&opts, "openmp", mask_size);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,343 @@
+#include "options.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// fills options with the default values
+void options_init(Options *opts) {
+    opts->median = MEDIAN_AUTO;
+    opts->layout = LAYOUT_INTERLEAVED;
+    opts->pipeline = PIPELINE_STAGED;
+    opts->halo = HALO_BLOCKING;
+    opts->io = IO_STDIO;
+    opts->batch = BATCH_SERIAL;
+    opts->border = BORDER_SHRINK;
+    opts->order = ORDER_MEDIAN_FIRST;
+    opts->schedule = SCHEDULE_BANDS;
+    opts->pin = PIN_NONE;
+    opts->distribute = DISTRIBUTE_STATIC;
+    opts->timing = TIMING_NONE;
+    opts->counters = COUNTERS_NONE;
+    opts->smooth = 0.0;
+    opts->lut_threshold = 0.0;
+}
+
+// returns the value of "--name=value" if arg is that flag, NULL otherwise
+static const char* flag_value(const char *arg, const char *name) {
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+        return arg + len + 1;
+    }
+    return NULL;
+}
+
+static int parse_median_engine(const char *value, MedianEngine *engine) {
+    if (strcmp(value, "auto") == 0) {
+        *engine = MEDIAN_AUTO;
+    } else if (strcmp(value, "sort") == 0) {
+        *engine = MEDIAN_SORT;
+    } else if (strcmp(value, "histogram") == 0) {
+        *engine = MEDIAN_HISTOGRAM;
+    } else if (strcmp(value, "network") == 0) {
+        *engine = MEDIAN_NETWORK;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_layout(const char *value, ImageLayout *layout) {
+    if (strcmp(value, "interleaved") == 0) {
+        *layout = LAYOUT_INTERLEAVED;
+    } else if (strcmp(value, "planar") == 0) {
+        *layout = LAYOUT_PLANAR;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_pipeline(const char *value, PipelineMode *pipeline) {
+    if (strcmp(value, "staged") == 0) {
+        *pipeline = PIPELINE_STAGED;
+    } else if (strcmp(value, "fused") == 0) {
+        *pipeline = PIPELINE_FUSED;
+    } else if (strcmp(value, "stream") == 0) {
+        *pipeline = PIPELINE_STREAM;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_halo(const char *value, HaloMode *halo) {
+    if (strcmp(value, "blocking") == 0) {
+        *halo = HALO_BLOCKING;
+    } else if (strcmp(value, "overlap") == 0) {
+        *halo = HALO_OVERLAP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_io(const char *value, IOMode *io) {
+    if (strcmp(value, "stdio") == 0) {
+        *io = IO_STDIO;
+    } else if (strcmp(value, "mmap") == 0) {
+        *io = IO_MMAP;
+    } else if (strcmp(value, "mpiio") == 0) {
+        *io = IO_MPIIO;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_batch(const char *value, BatchMode *batch) {
+    if (strcmp(value, "serial") == 0) {
+        *batch = BATCH_SERIAL;
+    } else if (strcmp(value, "async") == 0) {
+        *batch = BATCH_ASYNC;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_border(const char *value, BorderMode *border) {
+    if (strcmp(value, "shrink") == 0) {
+        *border = BORDER_SHRINK;
+    } else if (strcmp(value, "replicate") == 0) {
+        *border = BORDER_REPLICATE;
+    } else if (strcmp(value, "reflect") == 0) {
+        *border = BORDER_REFLECT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_order(const char *value, StageOrder *order) {
+    if (strcmp(value, "median-first") == 0) {
+        *order = ORDER_MEDIAN_FIRST;
+    } else if (strcmp(value, "luma-first") == 0) {
+        *order = ORDER_LUMA_FIRST;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_schedule(const char *value, ScheduleMode *schedule) {
+    if (strcmp(value, "bands") == 0) {
+        *schedule = SCHEDULE_BANDS;
+    } else if (strcmp(value, "tiles") == 0) {
+        *schedule = SCHEDULE_TILES;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_pin(const char *value, PinMode *pin) {
+    if (strcmp(value, "none") == 0) {
+        *pin = PIN_NONE;
+    } else if (strcmp(value, "close") == 0) {
+        *pin = PIN_CLOSE;
+    } else if (strcmp(value, "spread") == 0) {
+        *pin = PIN_SPREAD;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_distribute(const char *value, DistributeMode *distribute) {
+    if (strcmp(value, "static") == 0) {
+        *distribute = DISTRIBUTE_STATIC;
+    } else if (strcmp(value, "dynamic") == 0) {
+        *distribute = DISTRIBUTE_DYNAMIC;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_timing(const char *value, TimingFormat *timing) {
+    if (strcmp(value, "none") == 0) {
+        *timing = TIMING_NONE;
+    } else if (strcmp(value, "json") == 0) {
+        *timing = TIMING_JSON;
+    } else if (strcmp(value, "csv") == 0) {
+        *timing = TIMING_CSV;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_counters(const char *value, CountersMode *counters) {
+    if (strcmp(value, "none") == 0) {
+        *counters = COUNTERS_NONE;
+    } else if (strcmp(value, "hw") == 0) {
+        *counters = COUNTERS_HW;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// a number in [0, 1)
+static int parse_fraction(const char *value, double *fraction) {
+    char *end;
+    double v = strtod(value, &end);
+    if (end == value || *end != '\0' || !(v >= 0.0 && v < 1.0)) {
+        return -1;
+    }
+    *fraction = v;
+    return 0;
+}
+
+// parses the flags in argv[first..argc-1]
+int parse_options(int argc, char *argv[], int first, Options *opts) {
+    for (int i = first; i < argc; i++) {
+        const char *value;
+
+        if ((value = flag_value(argv[i], "--median")) != NULL) {
+            if (parse_median_engine(value, &opts->median) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--layout")) != NULL) {
+            if (parse_layout(value, &opts->layout) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--pipeline")) != NULL) {
+            if (parse_pipeline(value, &opts->pipeline) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--halo")) != NULL) {
+            if (parse_halo(value, &opts->halo) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--io")) != NULL) {
+            if (parse_io(value, &opts->io) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--batch")) != NULL) {
+            if (parse_batch(value, &opts->batch) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--border")) != NULL) {
+            if (parse_border(value, &opts->border) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--order")) != NULL) {
+            if (parse_order(value, &opts->order) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--schedule")) != NULL) {
+            if (parse_schedule(value, &opts->schedule) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--pin")) != NULL) {
+            if (parse_pin(value, &opts->pin) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--distribute")) != NULL) {
+            if (parse_distribute(value, &opts->distribute) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--timing")) != NULL) {
+            if (parse_timing(value, &opts->timing) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--counters")) != NULL) {
+            if (parse_counters(value, &opts->counters) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--smooth")) != NULL) {
+            if (parse_fraction(value, &opts->smooth) != 0) {
+                return i;
+            }
+        } else if ((value = flag_value(argv[i], "--lut-threshold")) != NULL) {
+            if (parse_fraction(value, &opts->lut_threshold) != 0) {
+                return i;
+            }
+        } else {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// only the interleaved and luma-first medians read a padded copy of the image
+int border_supported(const Options *opts) {
+    if (opts->border == BORDER_SHRINK) {
+        return 1;
+    }
+    if (opts->pipeline == PIPELINE_STREAM) {
+        return 0;
+    }
+    return opts->order == ORDER_LUMA_FIRST || opts->pipeline == PIPELINE_FUSED || opts->layout == LAYOUT_INTERLEAVED;
+}
+
+const char* unsupported_option(const Options *opts, int honoured) {
+    if (!(honoured & OPTIONS_PIPELINE)) {
+        if (opts->layout == LAYOUT_PLANAR) {
+            return "--layout=planar";
+        }
+        if (opts->pipeline != PIPELINE_STAGED) {
+            return (opts->pipeline == PIPELINE_FUSED) ? "--pipeline=fused" : "--pipeline=stream";
+        }
+    }
+    if (!(honoured & OPTIONS_MPI)) {
+        if (opts->halo == HALO_OVERLAP) {
+            return "--halo=overlap";
+        }
+        if (opts->io == IO_MPIIO) {
+            return "--io=mpiio";
+        }
+    }
+    if (!(honoured & OPTIONS_DISTRIBUTE) && opts->distribute == DISTRIBUTE_DYNAMIC) {
+        return "--distribute=dynamic";
+    }
+    if (!(honoured & OPTIONS_SCHEDULE) && opts->schedule == SCHEDULE_TILES) {
+        return "--schedule=tiles";
+    }
+    if (!(honoured & OPTIONS_PIN) && opts->pin != PIN_NONE) {
+        return (opts->pin == PIN_CLOSE) ? "--pin=close" : "--pin=spread";
+    }
+    if (!(honoured & OPTIONS_BATCH) && opts->batch == BATCH_ASYNC) {
+        return "--batch=async";
+    }
+    if (!(honoured & OPTIONS_SEQUENCE)) {
+        if (opts->smooth > 0.0) {
+            return "--smooth";
+        }
+        if (opts->lut_threshold > 0.0) {
+            return "--lut-threshold";
+        }
+    }
+    return NULL;
+}
+
+// prints the accepted flags
+void print_options_usage(void) {
+    printf("Opções:\n");
+    printf("  --median=auto|network|histogram|sort  algoritmo do filtro mediana (padrão: auto)\n");
+    printf("  --layout=interleaved|planar           layout da imagem na memória (padrão: interleaved)\n");
+    printf("  --pipeline=staged|fused|stream        etapas separadas, fundidas em faixas ou fora da memória (só sequencial) (padrão: staged)\n");
+    printf("  --halo=blocking|overlap               MPI: espera o halo ou sobrepõe com o cálculo (padrão: blocking)\n");
+    printf("  --io=stdio|mmap|mpiio                 leitura/escrita com stdio, mmap ou MPI-IO por faixa (só MPI) (padrão: stdio)\n");
+    printf("  --batch=serial|async                  lote: uma imagem por vez ou leitura/escrita em threads de E/S (padrão: serial)\n");
+    printf("  --border=shrink|replicate|reflect     mediana na borda: janela reduzida, pixels replicados ou espelhados (padrão: shrink)\n");
+    printf("  --order=median-first|luma-first       mediana nos canais B, G, R (referência) ou só na luminância (~3x menos trabalho, resultado aproximado) (padrão: median-first)\n");
+    printf("  --schedule=bands|tiles                OpenMP: uma faixa de linhas por thread ou blocos do tamanho da L2 com roubo de trabalho (padrão: bands)\n");
+    printf("  --pin=none|close|spread               OpenMP/híbrido: threads livres, fixadas em núcleos vizinhos ou alternando soquetes (padrão: none)\n");
+    printf("  --distribute=static|dynamic           MPI: uma faixa fixa por processo ou blocos distribuídos sob demanda pelo processo 0 (padrão: static)\n");
+    printf("  --timing=none|json|csv                tempos por etapa, thread e processo em output/ (requer make TIMING=1) (padrão: none)\n");
+    printf("  --counters=none|hw                    com --timing: ciclos, instruções e falhas de LLC e de desvio por etapa (perf_event_open) (padrão: none)\n");
+    printf("  --smooth=0..1                         sequência: peso dos quadros anteriores na CDF suavizada (padrão: 0)\n");
+    printf("  --lut-threshold=0..1                  sequência: fração do histograma que precisa mudar para recalcular a LUT (padrão: 0)\n");
+}
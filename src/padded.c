@@ -0,0 +1,105 @@
+#include "padded.h"
+#include <stdlib.h>
+#include <string.h>
+
+// rounds n up to a multiple of PADDED_ALIGN
+static size_t align_up(size_t n) {
+    return (n + PADDED_ALIGN - 1) / PADDED_ALIGN * PADDED_ALIGN;
+}
+
+// bytes before pixel (0, 0) on its row: the left frame, rounded up so
+// the first pixel of every row is aligned
+static size_t left_bytes(int bpp, int border) {
+    return align_up((size_t)border * bpp);
+}
+
+static size_t row_stride(int width, int bpp, int border) {
+    return align_up(left_bytes(bpp, border) + (size_t)(width + border) * bpp);
+}
+
+size_t padded_size(int width, int height, int bpp, int border) {
+    return row_stride(width, bpp, border) * (height + 2 * (size_t)border);
+}
+
+void padded_init(PaddedImage *p, int width, int height, int bpp, int border, uint8_t *memory) {
+    p->width = width;
+    p->height = height;
+    p->bpp = bpp;
+    p->border = border;
+    p->stride = row_stride(width, bpp, border);
+    p->data = memory + (size_t)border * p->stride + left_bytes(bpp, border);
+    p->block = NULL;
+}
+
+PaddedImage* create_padded(int width, int height, int bpp, int border) {
+    PaddedImage *p = (PaddedImage*)malloc(sizeof(PaddedImage));
+    uint8_t *memory = (uint8_t*)aligned_alloc(PADDED_ALIGN, padded_size(width, height, bpp, border));
+    padded_init(p, width, height, bpp, border, memory);
+    p->block = memory;
+    return p;
+}
+
+void free_padded(PaddedImage *p) {
+    if (p) {
+        free(p->block);
+        free(p);
+    }
+}
+
+void padded_copy_rows(PaddedImage *p, const uint8_t *src, size_t src_stride, int y0, int y1) {
+    size_t row_bytes = (size_t)p->width * p->bpp;
+    for (int y = y0; y < y1; y++) {
+        memcpy(p->data + (size_t)y * p->stride, src + (size_t)y * src_stride, row_bytes);
+    }
+}
+
+int padded_border_index(int i, int n, BorderMode mode) {
+    if (mode == BORDER_REPLICATE || n == 1) {
+        return (i < 0) ? 0 : n - 1;
+    }
+    // frames wider than the image reflect more than once
+    while (i < 0 || i >= n) {
+        i = (i < 0) ? -i : 2 * (n - 1) - i;
+    }
+    return i;
+}
+
+void padded_fill_row_sides(PaddedImage *p, int y, BorderMode mode) {
+    int bpp = p->bpp;
+    uint8_t *row = p->data + (ptrdiff_t)y * p->stride;
+    for (int x = -p->border; x < 0; x++) {
+        memcpy(row + x * bpp, row + padded_border_index(x, p->width, mode) * bpp, bpp);
+    }
+    for (int x = p->width; x < p->width + p->border; x++) {
+        memcpy(row + x * bpp, row + padded_border_index(x, p->width, mode) * bpp, bpp);
+    }
+}
+
+void padded_fill_border(PaddedImage *p, BorderMode mode) {
+    if (mode == BORDER_SHRINK || p->border == 0) {
+        return;
+    }
+
+    int border = p->border;
+    for (int y = 0; y < p->height; y++) {
+        padded_fill_row_sides(p, y, mode);
+    }
+
+    // top and bottom frame rows are whole copies of image rows, frame included
+    size_t row_bytes = (size_t)(p->width + 2 * border) * p->bpp;
+    uint8_t *first = p->data - (size_t)border * p->bpp;
+    for (int y = -border; y < 0; y++) {
+        memcpy(first + y * (ptrdiff_t)p->stride,
+               first + (size_t)padded_border_index(y, p->height, mode) * p->stride, row_bytes);
+    }
+    for (int y = p->height; y < p->height + border; y++) {
+        memcpy(first + (size_t)y * p->stride,
+               first + (size_t)padded_border_index(y, p->height, mode) * p->stride, row_bytes);
+    }
+}
+
+ImageView padded_view(const PaddedImage *p, BorderMode mode) {
+    ImageView view = { p->data, p->width, p->height, (int)p->stride, p->bpp,
+                       (mode == BORDER_SHRINK) ? 0 : p->border };
+    return view;
+}
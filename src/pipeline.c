@@ -0,0 +1,282 @@
+#include "pipeline.h"
+#include "planar.h"
+#include "luma.h"
+#include "padded.h"
+#include "median_window.h"
+#include "timing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// L2 size assumed when the system does not report one
+#define DEFAULT_L2_SIZE (256 * 1024)
+
+// number of rows per strip so one strip fits in half of L2
+int fused_strip_rows(int width, int mask_size) {
+    long l2 = DEFAULT_L2_SIZE;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long reported = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (reported > 0) {
+        l2 = reported;
+    }
+#endif
+
+    // a strip reads rows + mask_size - 1 source rows and writes rows
+    // median rows plus rows luma rows
+    long row_size = ((width * 3 + 3) / 4) * 4;
+    long budget = l2 / 2;
+    long rows = (budget - (mask_size - 1) * row_size) / (2 * row_size + width);
+
+    // keep the histogram engine's per-strip setup small next to the strip
+    if (rows < mask_size) {
+        rows = mask_size;
+    }
+    return (int)rows;
+}
+
+// filtered strip of the BGR pass, rounded up to keep the median scratch aligned
+static size_t fused_strip_size(int width, int mask_size) {
+    size_t row_size = ((width * 3 + 3) / 4) * 4;
+    size_t bytes = (size_t)fused_strip_rows(width, mask_size) * row_size;
+    return (bytes + 63) & ~(size_t)63;
+}
+
+size_t fused_scratch_size(int width, int mask_size) {
+    return fused_strip_size(width, mask_size) + median_scratch_size(width, 3, mask_size);
+}
+
+// pass 1 over rows [y0, y1): median, luma and histogram, strip by strip
+void fused_median_luma_rows(ImageView src, uint8_t *luma, HistogramCount *histogram,
+                            int mask_size, int y0, int y1, MedianEngine engine, uint8_t *scratch) {
+    int width = src.width;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    int strip_rows = fused_strip_rows(width, mask_size);
+
+    uint8_t *owned = scratch ? NULL : (uint8_t*)malloc(fused_scratch_size(width, mask_size));
+    uint8_t *strip = scratch ? scratch : owned;
+    uint8_t *median_scratch = strip + fused_strip_size(width, mask_size);
+
+    for (int s0 = y0; s0 < y1; s0 += strip_rows) {
+        int s1 = (s0 + strip_rows < y1) ? s0 + strip_rows : y1;
+
+        median_filter_rows_scratch(src, strip, row_size, mask_size, s0, s1, engine, median_scratch);
+
+        // luma and histogram while the filtered strip is in cache
+        uint8_t *out = luma + (size_t)(s0 - y0) * width;
+        for (int y = s0; y < s1; y++) {
+            luma_bgr_row(strip + (size_t)(y - s0) * row_size, out + (size_t)(y - s0) * width, width);
+        }
+        histogram_bytes(out, width, s1 - s0, width, 1, histogram);
+    }
+
+    free(owned);
+}
+
+// builds the equalization LUT from the histogram of total_pixels pixels
+void build_equalization_lut(const HistogramCount *histogram, HistogramCount total_pixels, uint8_t *lut) {
+    HistogramCount cumulative[256];
+    cumulative[0] = histogram[0];
+    for (int i = 1; i < 256; i++) {
+        cumulative[i] = cumulative[i - 1] + histogram[i];
+    }
+    equalization_lut(cumulative, total_pixels, lut);
+}
+
+// pixels remapped at a time by fused_equalize_rows
+#define EQUALIZE_CHUNK 1024
+
+// pass 2 over rows [y0, y1): writes lut[luma] to all three channels
+void fused_equalize_rows(BMPImage *img, const uint8_t *luma, const uint8_t *lut, int y0, int y1) {
+    int width = img->width;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    uint8_t gray[EQUALIZE_CHUNK];
+
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *in = luma + (size_t)(y - y0) * width;
+        uint8_t *out = img->data + (size_t)y * row_size;
+        for (int x = 0; x < width; x += EQUALIZE_CHUNK) {
+            int n = (width - x < EQUALIZE_CHUNK) ? width - x : EQUALIZE_CHUNK;
+            lut_row(in + x, gray, lut, n);
+            gray_bgr_row(gray, out + (size_t)x * 3, n);
+        }
+    }
+}
+
+// luma of src rows [y0, y1) into the same rows of plane
+void luma_plane_rows(const BMPImage *src, PaddedImage *plane, int y0, int y1) {
+    int row_size = ((src->width * 3 + 3) / 4) * 4;
+    for (int y = y0; y < y1; y++) {
+        luma_bgr_row(src->data + (size_t)y * row_size, plane->data + (size_t)y * plane->stride, src->width);
+    }
+}
+
+// median of plane rows [y0, y1) and their histogram, strip by strip
+void luma_median_rows(ImageView plane, uint8_t *filtered, HistogramCount *histogram,
+                      int mask_size, int y0, int y1, MedianEngine engine, uint8_t *scratch) {
+    int width = plane.width;
+    int strip_rows = fused_strip_rows(width, mask_size);
+
+    uint8_t *owned = scratch ? NULL : (uint8_t*)malloc(median_scratch_size(width, 1, mask_size));
+    uint8_t *median_scratch = scratch ? scratch : owned;
+
+    for (int s0 = y0; s0 < y1; s0 += strip_rows) {
+        int s1 = (s0 + strip_rows < y1) ? s0 + strip_rows : y1;
+        uint8_t *out = filtered + (size_t)(s0 - y0) * width;
+
+        // histogram while the filtered strip is in cache
+        median_filter_rows_scratch(plane, out, width, mask_size, s0, s1, engine, median_scratch);
+        histogram_bytes(out, width, s1 - s0, width, 1, histogram);
+    }
+
+    free(owned);
+}
+
+// what the fused median reads: src itself, or a copy of it from arena
+// when opts asks for a replicated / reflected border
+static ImageView median_source(const BMPImage *src, int mask_size, const Options *opts,
+                               Arena *arena) {
+    if (opts->border == BORDER_SHRINK) {
+        return bmp_view(src);
+    }
+
+    int width = src->width;
+    int height = src->height;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    int border = padded_border(opts->border, mask_size);
+
+    PaddedImage original;
+    padded_init(&original, width, height, 3, border,
+                (uint8_t*)arena_alloc(arena, padded_size(width, height, 3, border)));
+    padded_copy_rows(&original, src->data, row_size, 0, height);
+    padded_fill_border(&original, opts->border);
+    return padded_view(&original, opts->border);
+}
+
+// one image through the schedule selected in opts
+void process_image(const BMPImage *src, BMPImage *dst, int mask_size, const Options *opts,
+                   Arena *arena, int verbose) {
+    int width = src->width;
+    int height = src->height;
+
+    if (opts->order == ORDER_LUMA_FIRST) {
+        int border = padded_border(opts->border, mask_size);
+        PaddedImage plane;
+        padded_init(&plane, width, height, 1, border,
+                    (uint8_t*)arena_alloc(arena, padded_size(width, height, 1, border)));
+        uint8_t *filtered = (uint8_t*)arena_alloc(arena, (size_t)width * height);
+        HistogramCount histogram[256] = {0};
+        uint8_t lut[256];
+
+        if (verbose) {
+            printf("Convertendo para tons de cinza...\n");
+        }
+        TIMING_START(t_gray);
+        luma_plane_rows(src, &plane, 0, height);
+        padded_fill_border(&plane, opts->border);
+        TIMING_STOP(t_gray, STAGE_GRAYSCALE, 0);
+
+        if (verbose) {
+            printf("Aplicando filtro mediana %dx%d na luminância...\n", mask_size, mask_size);
+        }
+        TIMING_START(t_median);
+        uint8_t *scratch = (uint8_t*)arena_alloc(arena, fused_scratch_size(width, mask_size));
+        luma_median_rows(padded_view(&plane, opts->border), filtered, histogram, mask_size, 0, height,
+                         opts->median, scratch);
+        TIMING_STOP(t_median, STAGE_MEDIAN, 0);
+
+        if (verbose) {
+            printf("Equalizando histograma...\n");
+        }
+        TIMING_START(t_equalize);
+        build_equalization_lut(histogram, (HistogramCount)width * height, lut);
+        fused_equalize_rows(dst, filtered, lut, 0, height);
+        TIMING_STOP(t_equalize, STAGE_EQUALIZE, 0);
+    } else if (opts->pipeline == PIPELINE_FUSED) {
+        if (verbose) {
+            printf("Mediana %dx%d, tons de cinza e histograma em faixas...\n", mask_size, mask_size);
+        }
+        uint8_t *luma = (uint8_t*)arena_alloc(arena, (size_t)width * height);
+        HistogramCount histogram[256] = {0};
+        uint8_t lut[256];
+
+        // the fused pass writes luma, not src, so it only needs a copy for a border
+        TIMING_START(t_median);
+        ImageView view = median_source(src, mask_size, opts, arena);
+        uint8_t *scratch = (uint8_t*)arena_alloc(arena, fused_scratch_size(width, mask_size));
+        fused_median_luma_rows(view, luma, histogram, mask_size, 0, height, opts->median, scratch);
+        TIMING_STOP(t_median, STAGE_MEDIAN, 0);
+
+        TIMING_START(t_equalize);
+        build_equalization_lut(histogram, (HistogramCount)width * height, lut);
+        fused_equalize_rows(dst, luma, lut, 0, height);
+        TIMING_STOP(t_equalize, STAGE_EQUALIZE, 0);
+    } else if (opts->layout == LAYOUT_PLANAR) {
+        // split once, run every stage on planes, write the luma back once
+        PlanarImage planar, filtered;
+        planar_init(&planar, width, height, (uint8_t*)arena_alloc(arena, planar_size(width, height)));
+        planar_init(&filtered, width, height, (uint8_t*)arena_alloc(arena, planar_size(width, height)));
+
+        if (verbose) {
+            printf("Aplicando filtro mediana %dx%d...\n", mask_size, mask_size);
+        }
+        TIMING_START(t_median);
+        bmp_to_planar_rows(src, &planar, 0, height);
+        planar_median_rows(&planar, &filtered, mask_size, 0, height, opts->median);
+        TIMING_STOP(t_median, STAGE_MEDIAN, 0);
+
+        if (verbose) {
+            printf("Convertendo para tons de cinza...\n");
+        }
+        TIMING_START(t_gray);
+        planar_grayscale(&filtered);
+        TIMING_STOP(t_gray, STAGE_GRAYSCALE, 0);
+
+        if (verbose) {
+            printf("Equalizando histograma...\n");
+        }
+        TIMING_START(t_equalize);
+        planar_equalize_histogram(&filtered);
+        planar_to_bmp(&filtered, dst);
+        TIMING_STOP(t_equalize, STAGE_EQUALIZE, 0);
+    } else {
+        if (verbose) {
+            printf("Aplicando filtro mediana %dx%d...\n", mask_size, mask_size);
+        }
+        TIMING_START(t_median);
+        if (src == dst || opts->border != BORDER_SHRINK) {
+            // in place or with a frame: src is read through a rolling window of rows
+            MedianWindow window;
+            uint8_t *memory = (uint8_t*)arena_alloc(arena, median_window_size(width, mask_size, opts->border));
+            median_window_init(&window, src, dst, mask_size, opts->border, opts->median, 0, height, memory);
+            median_window_run(&window);
+        } else {
+            median_filter_image(src, dst, mask_size, opts->median);
+        }
+        TIMING_STOP(t_median, STAGE_MEDIAN, 0);
+
+        if (verbose) {
+            printf("Convertendo para tons de cinza...\n");
+        }
+        TIMING_START(t_gray);
+        convert_to_grayscale(dst);
+        TIMING_STOP(t_gray, STAGE_GRAYSCALE, 0);
+
+        if (verbose) {
+            printf("Equalizando histograma...\n");
+        }
+        // the steps of equalize_histogram, timed apart
+        TIMING_START(t_histogram);
+        HistogramCount histogram[256] = {0};
+        histogram_rows(dst, histogram, 0, height);
+        HistogramCount cumulative[256];
+        cumulative[0] = histogram[0];
+        for (int i = 1; i < 256; i++) {
+            cumulative[i] = cumulative[i - 1] + histogram[i];
+        }
+        TIMING_STOP(t_histogram, STAGE_HISTOGRAM, 0);
+
+        TIMING_START(t_equalize);
+        equalize_rows(dst, cumulative, (HistogramCount)width * height, 0, height);
+        TIMING_STOP(t_equalize, STAGE_EQUALIZE, 0);
+    }
+}
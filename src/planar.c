@@ -0,0 +1,128 @@
+#include "planar.h"
+#include "luma.h"
+#include <stdlib.h>
+
+// B, G, R and luma planes
+size_t planar_size(int width, int height) {
+    return (size_t)width * height * 4;
+}
+
+// points the planes into memory
+void planar_init(PlanarImage *p, int width, int height, uint8_t *memory) {
+    size_t plane_size = (size_t)width * height;
+
+    p->width = width;
+    p->height = height;
+    p->plane[0] = memory;
+    p->plane[1] = p->plane[0] + plane_size;
+    p->plane[2] = p->plane[1] + plane_size;
+    p->luma = p->plane[2] + plane_size;
+}
+
+// allocates a planar image (all four planes in one block)
+PlanarImage* create_planar(int width, int height) {
+    PlanarImage *p = (PlanarImage*)malloc(sizeof(PlanarImage));
+    planar_init(p, width, height, (uint8_t*)malloc(planar_size(width, height)));
+    return p;
+}
+
+// frees planar image memory
+void free_planar(PlanarImage *p) {
+    if (p) {
+        free(p->plane[0]);
+        free(p);
+    }
+}
+
+// splits rows [y0, y1) of the interleaved image into the B, G and R planes
+void bmp_to_planar_rows(const BMPImage *img, PlanarImage *p, int y0, int y1) {
+    int width = p->width;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *row = img->data + (size_t)y * row_size;
+        uint8_t *b = p->plane[0] + (size_t)y * width;
+        uint8_t *g = p->plane[1] + (size_t)y * width;
+        uint8_t *r = p->plane[2] + (size_t)y * width;
+
+        for (int x = 0; x < width; x++) {
+            b[x] = row[x * 3];
+            g[x] = row[x * 3 + 1];
+            r[x] = row[x * 3 + 2];
+        }
+    }
+}
+
+// writes the luma of rows [y0, y1) back as gray BGR pixels
+void luma_to_bmp_rows(const PlanarImage *p, BMPImage *img, int y0, int y1) {
+    int width = p->width;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+
+    for (int y = y0; y < y1; y++) {
+        gray_bgr_row(p->luma + (size_t)y * width, img->data + (size_t)y * row_size, width);
+    }
+}
+
+// median filters rows [y0, y1) of the B, G and R planes of src into dst
+void planar_median_rows(const PlanarImage *src, PlanarImage *dst, int mask_size,
+                        int y0, int y1, MedianEngine engine) {
+    int width = src->width;
+
+    for (int c = 0; c < 3; c++) {
+        ImageView view = { src->plane[c], width, src->height, width, 1, 0 };
+        median_filter_rows(view, dst->plane[c] + (size_t)y0 * width, width,
+                           mask_size, y0, y1, engine);
+    }
+}
+
+// computes the luma plane of rows [y0, y1) from the B, G and R planes
+void planar_grayscale_rows(PlanarImage *p, int y0, int y1) {
+    size_t start = (size_t)y0 * p->width;
+    size_t end = (size_t)y1 * p->width;
+
+    luma_planes_row(p->plane[0] + start, p->plane[1] + start, p->plane[2] + start,
+                    p->luma + start, (int)(end - start));
+}
+
+// adds the luma values of rows [y0, y1) to histogram
+void planar_histogram_rows(const PlanarImage *p, HistogramCount *histogram, int y0, int y1) {
+    if (y0 < y1) {
+        histogram_bytes(p->luma + (size_t)y0 * p->width, p->width, y1 - y0, p->width, 1, histogram);
+    }
+}
+
+// remaps the luma of rows [y0, y1) through the cumulative histogram
+void planar_equalize_rows(PlanarImage *p, const HistogramCount *cumulative, HistogramCount total_pixels,
+                          int y0, int y1) {
+    size_t start = (size_t)y0 * p->width;
+    size_t end = (size_t)y1 * p->width;
+
+    uint8_t lut[256];
+    equalization_lut(cumulative, total_pixels, lut);
+    lut_row(p->luma + start, p->luma + start, lut, (int)(end - start));
+}
+
+// writes the luma plane back into the interleaved image as gray pixels
+void planar_to_bmp(const PlanarImage *p, BMPImage *img) {
+    luma_to_bmp_rows(p, img, 0, p->height);
+}
+
+// computes the luma plane
+void planar_grayscale(PlanarImage *p) {
+    planar_grayscale_rows(p, 0, p->height);
+}
+
+// equalizes the histogram of the luma plane
+void planar_equalize_histogram(PlanarImage *p) {
+    HistogramCount histogram[256] = {0};
+    planar_histogram_rows(p, histogram, 0, p->height);
+
+    // calculate cumulative histogram
+    HistogramCount cumulative[256];
+    cumulative[0] = histogram[0];
+    for (int i = 1; i < 256; i++) {
+        cumulative[i] = cumulative[i - 1] + histogram[i];
+    }
+
+    planar_equalize_rows(p, cumulative, (HistogramCount)p->width * p->height, 0, p->height);
+}
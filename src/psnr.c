@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "bmp.h"
+#include "options.h"
+#include "pipeline.h"
+#include "arena.h"
+
+// Runs one image through the reference order (median on B, G and R, then
+// grayscale) and through --order=luma-first, and reports how far apart
+// the two equalized outputs are.
+
+// runs the stages of opts on src into a new image from arena; returns
+// the time spent in seconds
+static double run_order(const BMPImage *src, BMPImage *dst, int mask_size, const Options *opts,
+                        StageOrder order, Arena *arena) {
+    int row_size = ((src->width * 3 + 3) / 4) * 4;
+    size_t data_size = (size_t)row_size * src->height;
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->top_down = src->top_down;
+    dst->data = (uint8_t*)arena_alloc(arena, data_size);
+
+    Options local = *opts;
+    local.order = order;
+
+    clock_t start = clock();
+    process_image(src, dst, mask_size, &local, arena, 0);
+    return ((double)(clock() - start)) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Uso: %s <tamanho_mascara> <arquivo_entrada> [opções]\n", argv[0]);
+        printf("Compara a ordem de referência (--order=median-first) com --order=luma-first\n");
+        printf("Exemplo: %s 5 data/img.bmp\n", argv[0]);
+        print_options_usage();
+        return 1;
+    }
+
+    int mask_size = atoi(argv[1]);
+    if (mask_size % 2 == 0 || mask_size < 3) {
+        printf("Tamanho da máscara deve ser ímpar e >= 3\n");
+        return 1;
+    }
+
+    Options opts;
+    options_init(&opts);
+    int bad = parse_options(argc, argv, 3, &opts);
+    if (bad) {
+        printf("Opção inválida: %s\n", argv[bad]);
+        print_options_usage();
+        return 1;
+    }
+    if (opts.pipeline == PIPELINE_STREAM || !border_supported(&opts)) {
+        printf("--pipeline=stream e --border=replicate|reflect com --layout=planar não são suportados\n");
+        return 1;
+    }
+
+    BMPImage *img = read_bmp(argv[2]);
+    if (!img) {
+        return 1;
+    }
+
+    Arena arena;
+    arena_init(&arena);
+    BMPImage reference, luma_first;
+    double reference_time = run_order(img, &reference, mask_size, &opts, ORDER_MEDIAN_FIRST, &arena);
+    double luma_time = run_order(img, &luma_first, mask_size, &opts, ORDER_LUMA_FIRST, &arena);
+
+    // the outputs are gray: every channel holds the same value
+    int width = img->width;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    double squared_error = 0.0;
+    long long differing = 0;
+    int max_difference = 0;
+    for (int y = 0; y < img->height; y++) {
+        const uint8_t *a = reference.data + (size_t)y * row_size;
+        const uint8_t *b = luma_first.data + (size_t)y * row_size;
+        for (int x = 0; x < width; x++) {
+            int d = abs((int)a[x * 3] - (int)b[x * 3]);
+            squared_error += (double)d * d;
+            differing += (d != 0);
+            if (d > max_difference) {
+                max_difference = d;
+            }
+        }
+    }
+    double pixels = (double)width * img->height;
+    double mse = squared_error / pixels;
+
+    printf("Imagem: %s (%dx%d), máscara %dx%d\n", argv[2], width, img->height, mask_size, mask_size);
+    printf("Tempo median-first: %.6f s\n", reference_time);
+    printf("Tempo luma-first:   %.6f s\n", luma_time);
+    if (mse == 0.0) {
+        printf("PSNR=inf\n");
+    } else {
+        printf("PSNR=%.2f\n", 10.0 * log10(255.0 * 255.0 / mse));
+    }
+    printf("DIFERENCA_MAXIMA=%d\n", max_difference);
+    printf("PIXELS_DIFERENTES=%.4f%%\n", 100.0 * differing / pixels);
+
+    arena_free(&arena);
+    free_bmp(img);
+    return 0;
+}
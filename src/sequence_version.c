@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include "bmp.h"
+#include "batch.h"
+#include "async_batch.h"
+#include "histeq.h"
+#include "options.h"
+#include "timing.h"
+
+// Frame sequences (video stored as numbered BMP files): every frame goes
+// through one libhisteq context, so the OpenMP team, the median scratch
+// and the luma plane are reused from frame to frame, and the frames are
+// read and written by the I/O threads of the async batch while the team
+// processes the current one (--batch=serial turns that off). With --smooth
+// the LUT follows a smoothed histogram, which removes the flicker of
+// per-frame equalization; with --lut-threshold it is only rebuilt when the
+// histogram moved enough (see histeq.h).
+
+// the context of the run (the async batch calls process_frame without one)
+static HistEqContext *context;
+
+// one frame, on the whole thread team
+static void process_frame(const BMPImage *src, BMPImage *dst, int mask_size,
+                          const Options *opts, Arena *arena) {
+    (void)mask_size;
+    (void)opts;
+    (void)arena;
+    int row_size = ((src->width * 3 + 3) / 4) * 4;
+    HistEqImage in = { src->data, src->width, src->height, row_size, HISTEQ_BGR };
+    HistEqImage out = { dst->data, dst->width, dst->height, row_size, HISTEQ_BGR };
+    histeq_process(context, &in, &out);
+}
+
+// frames one at a time: read, process, write
+static int serial_frames(const BatchList *frames, int mask_size, const Options *opts,
+                         double *time_spent) {
+    Arena arena;
+    arena_init(&arena);
+    int failures = 0;
+    *time_spent = 0.0;
+
+    for (int i = 0; i < frames->count; i++) {
+        char output_file[4096];
+        output_path(output_file, sizeof(output_file), "sequence", mask_size, frames->paths[i], 1);
+        printf("[%d/%d] %s -> %s\n", i + 1, frames->count, frames->paths[i], output_file);
+
+        ImageFiles files;
+        if (open_image_files(&files, frames->paths[i], output_file, opts->io, &arena, NULL, NULL) != 0) {
+            failures++;
+            continue;
+        }
+        double start = wall_time();
+        process_frame(files.src, files.dst, mask_size, opts, &arena);
+        double spent = wall_time() - start;
+        TIMING_RECORD(STAGE_TOTAL, 0, spent);
+        *time_spent += spent;
+        close_image_files(&files, output_file);
+
+        // buffers are reused by the next frame
+        arena_reset(&arena);
+    }
+
+    arena_free(&arena);
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        printf("Uso: %s <tamanho_mascara> <num_threads> <quadros> [opções]\n", argv[0]);
+        printf("Exemplo: %s 3 4 quadros/f_%%04d.bmp --smooth=0.8 --lut-threshold=0.01\n", argv[0]);
+        printf("<quadros> pode ser um padrão numerado (quadros/f_%%04d.bmp), um diretório ou @lista.txt\n");
+        print_options_usage();
+        return 1;
+    }
+
+    int mask_size = atoi(argv[1]);
+    if (mask_size % 2 == 0 || mask_size < 3) {
+        printf("Tamanho da máscara deve ser ímpar e >= 3\n");
+        return 1;
+    }
+
+    int num_threads = atoi(argv[2]);
+    if (num_threads < 1) {
+        printf("Número de threads deve ser >= 1\n");
+        return 1;
+    }
+
+    // frames overlap their I/O with the processing unless --batch=serial
+    Options opts;
+    options_init(&opts);
+    opts.batch = BATCH_ASYNC;
+    int bad = parse_options(argc, argv, 4, &opts);
+    if (bad) {
+        printf("Opção inválida: %s\n", argv[bad]);
+        print_options_usage();
+        return 1;
+    }
+    // every frame goes through libhisteq, which has no pipeline or layout
+    const char *unsupported = unsupported_option(&opts, OPTIONS_BATCH | OPTIONS_SEQUENCE);
+    if (unsupported) {
+        printf("%s não é suportado no modo sequência\n", unsupported);
+        return 1;
+    }
+
+    omp_set_num_threads(num_threads);
+    timing_init(&opts, 1);
+
+    BatchList frames;
+    if (batch_inputs(argv[3], &frames) != 0) {
+        return 1;
+    }
+
+    context = histeq_create(mask_size, &opts, num_threads);
+    if (!context) {
+        printf("Erro ao criar o contexto de processamento\n");
+        free_batch_list(&frames);
+        return 1;
+    }
+
+    double total_time = 0.0;
+    double start = wall_time();
+    int failures;
+    if (opts.batch == BATCH_ASYNC) {
+        failures = async_batch(&frames, "sequence", mask_size, &opts, process_frame, &total_time);
+    } else {
+        failures = serial_frames(&frames, mask_size, &opts, &total_time);
+    }
+    double elapsed = wall_time() - start;
+
+    HistEqStats stats;
+    histeq_stats(context, &stats);
+    histeq_destroy(context);
+    int count = frames.count;
+    free_batch_list(&frames);
+
+    printf("Quadros processados: %d de %d\n", count - failures, count);
+    printf("LUTs calculadas: %ld de %ld quadros\n", stats.lut_builds, stats.frames);
+    printf("QUADROS_POR_SEGUNDO=%.2f\n", (elapsed > 0.0) ? (count - failures) / elapsed : 0.0);
+    printf("TEMPO_TOTAL=%.6f\n", total_time);
+    timing_finish(&opts, "sequence", mask_size);
+
+    return failures ? 1 : 0;
+}
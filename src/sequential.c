@@ -1,13 +1,76 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include "bmp.h"
 #include "image_processing.h"
+#include "options.h"
+#include "planar.h"
+#include "pipeline.h"
+#include "stream.h"
+#include "arena.h"
+#include "batch.h"
+#include "async_batch.h"
+#include "timing.h"
+
+// loads, processes and saves one image; returns 0, or -1 after printing
+// the error. The stage messages are printed when verbose.
+static int run_image(const char *input_file, const char *output_file, int mask_size,
+                     const Options *opts, Arena *arena, int verbose, double *time_spent) {
+    if (opts->pipeline == PIPELINE_STREAM) {
+        // the image is never loaded: both passes go file to file
+        if (verbose) {
+            printf("Processando em faixas: %s -> %s\n", input_file, output_file);
+        }
+        double start = wall_time();
+        if (stream_pipeline(input_file, output_file, mask_size, opts->median, verbose) != 0) {
+            return -1;
+        }
+        *time_spent = wall_time() - start;
+        TIMING_RECORD(STAGE_TOTAL, 0, *time_spent);
+        return 0;
+    }
+
+    if (verbose) {
+        printf("Lendo imagem: %s\n", input_file);
+    }
+
+    // with --io=mmap the stages read the input mapping and write straight
+    // into the mapped output file; otherwise they work in place on the
+    // image read into the arena
+    ImageFiles files;
+    if (open_image_files(&files, input_file, output_file, opts->io, arena, NULL, NULL) != 0) {
+        return -1;
+    }
+
+    if (verbose) {
+        printf("Imagem carregada: %dx%d\n", files.src->width, files.src->height);
+        printf("Matriz de %d\n", mask_size);
+    }
+
+    // wall time: clock() would count CPU time, and miss the waits on I/O
+    double start = wall_time();
+    process_image(files.src, files.dst, mask_size, opts, arena, verbose);
+    *time_spent = wall_time() - start;
+    TIMING_RECORD(STAGE_TOTAL, 0, *time_spent);
+
+    if (verbose) {
+        printf("Salvando imagem: %s\n", output_file);
+    }
+    close_image_files(&files, output_file);
+    return 0;
+}
+
+// stages of one batch image (async batches)
+static void process_quiet(const BMPImage *src, BMPImage *dst, int mask_size,
+                          const Options *opts, Arena *arena) {
+    process_image(src, dst, mask_size, opts, arena, 0);
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Uso: %s <tamanho_mascara> <arquivo_entrada>\n", argv[0]);
+    if (argc < 3) {
+        printf("Uso: %s <tamanho_mascara> <arquivo_entrada> [opções]\n", argv[0]);
         printf("Exemplo: %s 3 data/img.bmp\n", argv[0]);
+        printf("<arquivo_entrada> pode ser um diretório (todos os .bmp), @lista.txt (um caminho por linha) ou quadros numerados (quadros/f_%%04d.bmp)\n");
+        print_options_usage();
         return 1;
     }
 
@@ -17,41 +80,76 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    const char *input_file = argv[2];
-    
-    char output_file[256];
-    snprintf(output_file, sizeof(output_file), "output/sequential_%d_output.bmp", mask_size);
-
-    printf("Lendo imagem: %s\n", input_file);
-    BMPImage *img = read_bmp(input_file);
-    if (!img) {
+    Options opts;
+    options_init(&opts);
+    int bad = parse_options(argc, argv, 3, &opts);
+    if (bad) {
+        printf("Opção inválida: %s\n", argv[bad]);
+        print_options_usage();
+        return 1;
+    }
+    const char *unsupported = unsupported_option(&opts, OPTIONS_PIPELINE | OPTIONS_BATCH);
+    if (unsupported) {
+        printf("%s não é suportado na versão sequencial\n", unsupported);
+        return 1;
+    }
+    if (!border_supported(&opts)) {
+        printf("--border=replicate|reflect não é suportado com --layout=planar nem --pipeline=stream\n");
+        return 1;
+    }
+    if (opts.order == ORDER_LUMA_FIRST && opts.pipeline == PIPELINE_STREAM) {
+        printf("--order=luma-first não é suportado com --pipeline=stream\n");
         return 1;
     }
 
-    printf("Imagem carregada: %dx%d\n", img->width, img->height);
-    printf("Matriz de %d\n", mask_size);
-
-    clock_t start = clock();
+    timing_init(&opts, 1);
 
-    printf("Aplicando filtro mediana %dx%d...\n", mask_size, mask_size);
-    apply_median_filter(img, mask_size);
+    // one file, or every image of a directory / @list in this process
+    const char *input_arg = argv[2];
+    int batch = is_batch_input(input_arg);
+    BatchList inputs;
+    if (batch_inputs(input_arg, &inputs) != 0) {
+        return 1;
+    }
 
-    printf("Convertendo para tons de cinza...\n");
-    convert_to_grayscale(img);
+    Arena arena;
+    arena_init(&arena);
+    double total_time = 0.0;
+    int failures = 0;
 
-    printf("Equalizando histograma...\n");
-    equalize_histogram(img);
+    // the streaming pipeline already works file to file, so it stays serial
+    if (batch && opts.batch == BATCH_ASYNC && opts.pipeline != PIPELINE_STREAM) {
+        failures = async_batch(&inputs, "sequential", mask_size, &opts, process_quiet, &total_time);
+    } else {
+        for (int i = 0; i < inputs.count; i++) {
+            char output_file[4096];
+            output_path(output_file, sizeof(output_file), "sequential", mask_size, inputs.paths[i], batch);
+            if (batch) {
+                printf("[%d/%d] %s -> %s\n", i + 1, inputs.count, inputs.paths[i], output_file);
+            }
 
-    clock_t end = clock();
-    double time_spent = ((double)(end - start)) / CLOCKS_PER_SEC;
+            double time_spent = 0.0;
+            if (run_image(inputs.paths[i], output_file, mask_size, &opts, &arena, !batch, &time_spent) != 0) {
+                failures++;
+            }
+            total_time += time_spent;
 
-    printf("Salvando imagem: %s\n", output_file);
-    write_bmp(output_file, img);
+            // buffers are reused by the next image
+            arena_reset(&arena);
+        }
+    }
 
-    printf("TEMPO_TOTAL=%.6f\n", time_spent);
+    arena_free(&arena);
+    int count = inputs.count;
+    free_batch_list(&inputs);
 
-    free_bmp(img);
+    if (batch) {
+        printf("Imagens processadas: %d de %d\n", count - failures, count);
+    } else if (failures) {
+        return 1;
+    }
+    printf("TEMPO_TOTAL=%.6f\n", total_time);
+    timing_finish(&opts, "sequential", mask_size);
 
-    return 0;
+    return failures ? 1 : 0;
 }
-
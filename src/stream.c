@@ -0,0 +1,206 @@
+#define _POSIX_C_SOURCE 200809L
+#include "stream.h"
+#include "pipeline.h"
+#include "luma.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// reads exactly size bytes at offset; returns 0 or -1
+static int read_full(int fd, uint8_t *buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, buf, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+// writes exactly size bytes at offset; returns 0 or -1
+static int write_full(int fd, const uint8_t *buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+// remaps `count` gray rows in place through lut (all three channels)
+static void remap_gray_rows(uint8_t *rows, int width, int row_size, int count, const uint8_t *lut) {
+    for (int y = 0; y < count; y++) {
+        lut_bgr_row(rows + (size_t)y * row_size, lut, width);
+    }
+}
+
+// pass 1: median and luma of each strip through the rolling window,
+// written to out as gray rows; the histogram is counted on the way
+static int stream_median_luma(int in, int out, const BMPHeader *info, int mask_size,
+                              MedianEngine engine, int strip_rows, HistogramCount *histogram) {
+    int width = info->width;
+    int height = info->height;
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    int half = mask_size / 2;
+    int pixel_bytes = width * 3;
+
+    uint8_t *window = (uint8_t*)malloc((size_t)(strip_rows + 2 * half) * row_size);
+    uint8_t *luma = (uint8_t*)malloc((size_t)strip_rows * width);
+    uint8_t *rows = (uint8_t*)malloc((size_t)strip_rows * row_size);
+    uint8_t *scratch = (uint8_t*)aligned_alloc(64, fused_scratch_size(width, mask_size));
+
+    int w0 = 0, w1 = 0;  // the window holds input rows [w0, w1)
+    int ok = 1;
+    for (int y0 = 0; y0 < height && ok; y0 += strip_rows) {
+        int y1 = (y0 + strip_rows < height) ? y0 + strip_rows : height;
+        int r0 = (y0 > half) ? y0 - half : 0;
+        int r1 = (y1 + half < height) ? y1 + half : height;
+
+        // keep the rows shared with the previous window, read the new ones
+        if (r0 < w1) {
+            memmove(window, window + (size_t)(r0 - w0) * row_size, (size_t)(w1 - r0) * row_size);
+        } else {
+            w1 = r0;
+        }
+        if (read_full(in, window + (size_t)(w1 - r0) * row_size, (size_t)(r1 - w1) * row_size,
+                      (off_t)info->data_offset + (off_t)w1 * row_size) != 0) {
+            printf("Erro ao ler dados da imagem\n");
+            ok = 0;
+            break;
+        }
+        w0 = r0;
+        w1 = r1;
+
+        // the window has the halo rows of the strip, so its edges are the
+        // image edges only where the image really ends
+        ImageView view = { window, width, r1 - r0, row_size, 3, 0 };
+        fused_median_luma_rows(view, luma, histogram, mask_size, y0 - r0, y1 - r0, engine, scratch);
+        for (int y = 0; y < y1 - y0; y++) {
+            gray_bgr_row(luma + (size_t)y * width, rows + (size_t)y * row_size, width);
+        }
+
+        // the stages only write pixels: keep the input's row padding bytes
+        for (int y = y0; y < y1; y++) {
+            memcpy(rows + (size_t)(y - y0) * row_size + pixel_bytes,
+                   window + (size_t)(y - r0) * row_size + pixel_bytes, row_size - pixel_bytes);
+        }
+
+        if (write_full(out, rows, (size_t)(y1 - y0) * row_size,
+                       BMP_HEADER_SIZE + (off_t)y0 * row_size) != 0) {
+            printf("Erro ao escrever imagem\n");
+            ok = 0;
+        }
+    }
+
+    free(scratch);
+    free(rows);
+    free(luma);
+    free(window);
+    return ok ? 0 : -1;
+}
+
+// pass 2: remaps the gray rows of out through lut, strip by strip
+static int stream_equalize(int out, int width, int height, int strip_rows, const uint8_t *lut) {
+    int row_size = ((width * 3 + 3) / 4) * 4;
+    uint8_t *rows = (uint8_t*)malloc((size_t)strip_rows * row_size);
+
+    int ok = 1;
+    for (int y0 = 0; y0 < height && ok; y0 += strip_rows) {
+        int count = (y0 + strip_rows < height) ? strip_rows : height - y0;
+        size_t size = (size_t)count * row_size;
+        off_t offset = BMP_HEADER_SIZE + (off_t)y0 * row_size;
+
+        if (read_full(out, rows, size, offset) != 0) {
+            printf("Erro ao ler dados da imagem\n");
+            ok = 0;
+            break;
+        }
+        remap_gray_rows(rows, width, row_size, count, lut);
+        if (write_full(out, rows, size, offset) != 0) {
+            printf("Erro ao escrever imagem\n");
+            ok = 0;
+        }
+    }
+
+    free(rows);
+    return ok ? 0 : -1;
+}
+
+// both passes, the image never held whole
+int stream_pipeline(const char *input_file, const char *output_file,
+                    int mask_size, MedianEngine engine, int verbose) {
+    int in = open(input_file, O_RDONLY);
+    if (in < 0) {
+        printf("Erro ao abrir arquivo: %s\n", input_file);
+        return -1;
+    }
+
+    uint8_t header[BMP_HEADER_SIZE];
+    BMPHeader info;
+    const char *error = "Erro ao ler header BMP";
+    if (read_full(in, header, BMP_HEADER_SIZE, 0) == 0) {
+        error = parse_bmp_header(header, &info);
+    }
+    if (error) {
+        printf("%s\n", error);
+        close(in);
+        return -1;
+    }
+
+    int out = open(output_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        printf("Erro ao criar arquivo: %s\n", output_file);
+        close(in);
+        return -1;
+    }
+
+    int width = info.width;
+    int height = info.height;
+    int strip_rows = fused_strip_rows(width, mask_size);
+    if (verbose) {
+        printf("Imagem: %dx%d, faixas de %d linhas\n", width, height, strip_rows);
+    }
+
+    make_bmp_header(header, width, height, info.top_down);
+    int result = write_full(out, header, BMP_HEADER_SIZE, 0);
+    if (result != 0) {
+        printf("Erro ao escrever imagem\n");
+    }
+
+    HistogramCount histogram[256] = {0};
+    if (result == 0) {
+        if (verbose) {
+            printf("Passo 1: mediana %dx%d, tons de cinza e histograma...\n", mask_size, mask_size);
+        }
+        result = stream_median_luma(in, out, &info, mask_size, engine, strip_rows, histogram);
+    }
+
+    if (result == 0) {
+        if (verbose) {
+            printf("Passo 2: equalizando histograma...\n");
+        }
+        uint8_t lut[256];
+        build_equalization_lut(histogram, (HistogramCount)width * height, lut);
+        result = stream_equalize(out, width, height, strip_rows, lut);
+    }
+
+    close(out);
+    close(in);
+    return result;
+}
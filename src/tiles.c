@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+#include "tiles.h"
+#include "pipeline.h"
+#include "luma.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// tiles per thread the grid aims for, so stealing has work to balance
+#define TILES_PER_THREAD 4
+
+// gray values converted per step of tile_grayscale_histogram
+#define GRAY_CHUNK 256
+
+static uint64_t pack_range(uint32_t front, uint32_t back) {
+    return ((uint64_t)back << 32) | front;
+}
+
+void tile_grid_init(TileGrid *grid, int width, int height, int mask_size, int threads) {
+    grid->width = width;
+    grid->height = height;
+    grid->threads = threads;
+    grid->tile_width = (width <= TILE_MAX_WIDTH) ? width : TILE_WIDTH;
+
+    // as tall as fits in L2, but short enough for a few tiles per thread
+    // while a tile still spans a few windows
+    int tile_height = fused_strip_rows(grid->tile_width, mask_size);
+    int balanced = height / (TILES_PER_THREAD * threads);
+    if (balanced >= mask_size && balanced < tile_height) {
+        tile_height = balanced;
+    }
+    if (tile_height > height) {
+        tile_height = height;
+    }
+    grid->tile_height = (tile_height > 0) ? tile_height : 1;
+
+    grid->columns = (width + grid->tile_width - 1) / grid->tile_width;
+    grid->rows = (height + grid->tile_height - 1) / grid->tile_height;
+    grid->queues = (TileQueue*)aligned_alloc(sizeof(TileQueue), sizeof(TileQueue) * threads);
+    tile_grid_reset(grid);
+}
+
+void tile_grid_free(TileGrid *grid) {
+    free(grid->queues);
+    grid->queues = NULL;
+}
+
+// tile rows [r0, r1) of the home band of thread
+static void home_tile_rows(const TileGrid *grid, int thread, int *r0, int *r1) {
+    *r0 = (int)((long)grid->rows * thread / grid->threads);
+    *r1 = (int)((long)grid->rows * (thread + 1) / grid->threads);
+}
+
+void tile_grid_reset(TileGrid *grid) {
+    for (int t = 0; t < grid->threads; t++) {
+        int r0, r1;
+        home_tile_rows(grid, t, &r0, &r1);
+        __atomic_store_n(&grid->queues[t].range,
+                         pack_range((uint32_t)(r0 * grid->columns), (uint32_t)(r1 * grid->columns)),
+                         __ATOMIC_RELEASE);
+    }
+}
+
+void tile_grid_home_rows(const TileGrid *grid, int thread, int *y0, int *y1) {
+    int r0, r1;
+    home_tile_rows(grid, thread, &r0, &r1);
+    *y0 = (r0 * grid->tile_height < grid->height) ? r0 * grid->tile_height : grid->height;
+    *y1 = (r1 * grid->tile_height < grid->height) ? r1 * grid->tile_height : grid->height;
+}
+
+// claims the front tile (owner) or the back tile (thief) of queue;
+// returns its index, or -1 when the queue is empty
+static int take_tile(TileQueue *queue, int from_back) {
+    uint64_t range = __atomic_load_n(&queue->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t front = (uint32_t)range;
+        uint32_t back = (uint32_t)(range >> 32);
+        if (front >= back) {
+            return -1;
+        }
+        uint64_t next = from_back ? pack_range(front, back - 1) : pack_range(front + 1, back);
+        if (__atomic_compare_exchange_n(&queue->range, &range, next, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return (int)(from_back ? back - 1 : front);
+        }
+    }
+}
+
+int tile_grid_next(TileGrid *grid, int thread, Tile *tile) {
+    int index = take_tile(&grid->queues[thread], 0);
+
+    // the back of a victim's queue is the farthest from where it works
+    for (int i = 1; index < 0 && i < grid->threads; i++) {
+        index = take_tile(&grid->queues[(thread + i) % grid->threads], 1);
+    }
+    if (index < 0) {
+        return -1;
+    }
+
+    int row = index / grid->columns;
+    int column = index % grid->columns;
+    tile->x0 = column * grid->tile_width;
+    tile->y0 = row * grid->tile_height;
+    tile->x1 = (tile->x0 + grid->tile_width < grid->width) ? tile->x0 + grid->tile_width : grid->width;
+    tile->y1 = (tile->y0 + grid->tile_height < grid->height) ? tile->y0 + grid->tile_height : grid->height;
+    return 0;
+}
+
+void first_touch(uint8_t *data, size_t size) {
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0) {
+        page = 4096;
+    }
+    for (size_t i = 0; i < size; i += (size_t)page) {
+        data[i] = 0;
+    }
+}
+
+size_t tile_scratch_size(const TileGrid *grid, int mask_size) {
+    if (grid->tile_width == grid->width) {
+        return 0;
+    }
+    return (size_t)grid->tile_height * (grid->tile_width + 2 * (mask_size / 2)) * 3;
+}
+
+void tile_median(ImageView src, BMPImage *dst, const Tile *tile, int mask_size,
+                 MedianEngine engine, uint8_t *scratch) {
+    int row_size = ((dst->width * 3 + 3) / 4) * 4;
+    int half = mask_size / 2;
+    uint8_t *out = dst->data + (size_t)tile->y0 * row_size + (size_t)tile->x0 * 3;
+
+    // full rows, or a framed source: the columns around the tile are
+    // there to read, so a view of the tile's columns is complete
+    if ((tile->x0 == 0 && tile->x1 == src.width) || src.border >= half) {
+        ImageView view = src;
+        view.data += (size_t)tile->x0 * src.bpp;
+        view.width = tile->x1 - tile->x0;
+        median_filter_rows(view, out, row_size, mask_size, tile->y0, tile->y1, engine);
+        return;
+    }
+
+    // clipped windows: filter the neighbouring columns the windows read
+    // too, and keep the tile's own
+    int v0 = (tile->x0 - half > 0) ? tile->x0 - half : 0;
+    int v1 = (tile->x1 + half < src.width) ? tile->x1 + half : src.width;
+    ImageView view = src;
+    view.data += (size_t)v0 * src.bpp;
+    view.width = v1 - v0;
+    view.border = 0;
+
+    int scratch_stride = (v1 - v0) * 3;
+    median_filter_rows(view, scratch, scratch_stride, mask_size, tile->y0, tile->y1, engine);
+    for (int y = tile->y0; y < tile->y1; y++) {
+        memcpy(out + (size_t)(y - tile->y0) * row_size,
+               scratch + (size_t)(y - tile->y0) * scratch_stride + (size_t)(tile->x0 - v0) * 3,
+               (size_t)(tile->x1 - tile->x0) * 3);
+    }
+}
+
+void tile_grayscale_histogram(BMPImage *img, const Tile *tile, HistogramCount *histogram) {
+    int row_size = ((img->width * 3 + 3) / 4) * 4;
+    int width = tile->x1 - tile->x0;
+    uint8_t gray[GRAY_CHUNK];
+
+    for (int y = tile->y0; y < tile->y1; y++) {
+        uint8_t *row = img->data + (size_t)y * row_size + (size_t)tile->x0 * 3;
+        for (int x = 0; x < width; x += GRAY_CHUNK) {
+            int n = (width - x < GRAY_CHUNK) ? width - x : GRAY_CHUNK;
+            luma_bgr_row(row + x * 3, gray, n);
+            gray_bgr_row(gray, row + x * 3, n);
+        }
+    }
+
+    // counted while the tile is still in cache
+    histogram_bytes(img->data + (size_t)tile->y0 * row_size + (size_t)tile->x0 * 3, width,
+                    tile->y1 - tile->y0, row_size, 3, histogram);
+}
+
+void tile_equalize(BMPImage *img, const Tile *tile, const uint8_t *lut) {
+    int row_size = ((img->width * 3 + 3) / 4) * 4;
+    for (int y = tile->y0; y < tile->y1; y++) {
+        lut_bgr_row(img->data + (size_t)y * row_size + (size_t)tile->x0 * 3, lut, tile->x1 - tile->x0);
+    }
+}
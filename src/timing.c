@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include "timing.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+// seconds, calls and counters of one thread, one cache line per slot
+typedef struct {
+    _Alignas(64) double seconds[STAGE_COUNT];
+    double calls[STAGE_COUNT];
+    double counted[STAGE_COUNT];   // calls that also read the counters
+    double counters[STAGE_COUNT][COUNTER_COUNT];
+} TimingSlot;
+
+static TimingSlot slots[TIMING_MAX_THREADS];
+
+static const char *stage_names[STAGE_COUNT] = {
+    "read", "median", "grayscale", "histogram", "equalize", "write", "mpi", "total"
+};
+
+static const char *counter_names[COUNTER_COUNT] = {
+    "cycles", "instructions", "llc_misses", "branch_misses"
+};
+
+// set once by timing_init, before any thread reads it
+static int counters_on;
+
+// counter group of the calling thread: -2 until opened, -1 if unavailable
+static _Thread_local int counter_group = -2;
+
+double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#ifdef __linux__
+// one counter of the calling thread, user space only, in group (or as the
+// leader when group is -1)
+static int open_counter(uint64_t config, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// the four counters as one group, so they are scheduled (and read) together;
+// returns the leader, or -1 with errno set
+static int open_counter_group(void) {
+    // PERF_COUNT_HW_CACHE_MISSES counts the last level cache misses
+    static const uint64_t events[COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    int fds[COUNTER_COUNT];
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        fds[i] = open_counter(events[i], (i == 0) ? -1 : fds[0]);
+        if (fds[i] < 0) {
+            int error = errno;
+            for (int j = 0; j < i; j++) {
+                close(fds[j]);
+            }
+            errno = error;
+            return -1;
+        }
+    }
+    return fds[0];
+}
+
+// current counters of the calling thread; 0 if it has none
+static int read_counters(uint64_t *values) {
+    if (counter_group == -2) {
+        counter_group = open_counter_group();
+    }
+    if (counter_group < 0) {
+        return 0;
+    }
+
+    // PERF_FORMAT_GROUP: the number of counters, then their values
+    uint64_t buffer[1 + COUNTER_COUNT];
+    if (read(counter_group, buffer, sizeof(buffer)) != (ssize_t)sizeof(buffer)) {
+        return 0;
+    }
+    memcpy(values, buffer + 1, sizeof(uint64_t) * COUNTER_COUNT);
+    return 1;
+}
+#else
+static int read_counters(uint64_t *values) {
+    (void)values;
+    errno = ENOSYS;
+    return 0;
+}
+#endif
+
+void timing_init(const Options *opts, int verbose) {
+    if (!TIMING_ENABLED || opts->counters == COUNTERS_NONE) {
+        return;
+    }
+    if (opts->timing == TIMING_NONE) {
+        if (verbose) {
+            printf("Aviso: --counters requer --timing=json|csv\n");
+        }
+        return;
+    }
+
+    uint64_t probe[COUNTER_COUNT];
+    if (!read_counters(probe)) {
+        if (verbose) {
+            printf("Aviso: contadores de hardware indisponíveis (%s), apenas tempos\n", strerror(errno));
+        }
+        return;
+    }
+    counters_on = 1;
+}
+
+// the async batch I/O threads record under thread 0 too: add atomically
+static void atomic_add(double *p, double value) {
+    double old, sum;
+    __atomic_load(p, &old, __ATOMIC_RELAXED);
+    do {
+        sum = old + value;
+    } while (!__atomic_compare_exchange(p, &old, &sum, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void timing_add(TimingStage stage, int thread, double seconds) {
+    if (thread < 0 || thread >= TIMING_MAX_THREADS) {
+        return;
+    }
+    atomic_add(&slots[thread].seconds[stage], seconds);
+    atomic_add(&slots[thread].calls[stage], 1.0);
+}
+
+void timing_start(TimingMark *mark) {
+    mark->counted = counters_on && read_counters(mark->counters);
+    mark->seconds = wall_time();
+}
+
+void timing_stop(const TimingMark *mark, TimingStage stage, int thread) {
+    timing_add(stage, thread, wall_time() - mark->seconds);
+
+    uint64_t now[COUNTER_COUNT];
+    if (!mark->counted || thread < 0 || thread >= TIMING_MAX_THREADS || !read_counters(now)) {
+        return;
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        atomic_add(&slots[thread].counters[stage][c], (double)(now[c] - mark->counters[c]));
+    }
+    atomic_add(&slots[thread].counted[stage], 1.0);
+}
+
+void timing_export(double *values) {
+    for (int t = 0; t < TIMING_MAX_THREADS; t++) {
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            double *v = values + (t * STAGE_COUNT + s) * TIMING_FIELDS;
+            v[0] = slots[t].seconds[s];
+            v[1] = slots[t].calls[s];
+            v[2] = slots[t].counted[s];
+            for (int c = 0; c < COUNTER_COUNT; c++) {
+                v[3 + c] = slots[t].counters[s][c];
+            }
+        }
+    }
+}
+
+void timing_path(char *path, size_t size, const char *binary, int mask_size, TimingFormat format) {
+    snprintf(path, size, "output/%s_%d_timing.%s", binary, mask_size,
+             (format == TIMING_JSON) ? "json" : "csv");
+}
+
+int timing_write(const char *path, TimingFormat format, const char *binary, int mask_size,
+                 int ranks, const double *values) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        printf("Erro ao criar arquivo de tempos: %s\n", path);
+        return -1;
+    }
+
+    if (format == TIMING_JSON) {
+        fprintf(file, "{\n  \"binary\": \"%s\",\n  \"mask\": %d,\n  \"ranks\": %d,\n  \"records\": [",
+                binary, mask_size, ranks);
+    } else {
+        fprintf(file, "Modelo,Máscara,Processos,Processo,Thread,Etapa,Tempo (s),Chamadas,"
+                      "Ciclos,Instruções,Falhas LLC,Falhas de desvio\n");
+    }
+
+    // only the slots a thread used
+    int first = 1;
+    for (int r = 0; r < ranks; r++) {
+        for (int t = 0; t < TIMING_MAX_THREADS; t++) {
+            for (int s = 0; s < STAGE_COUNT; s++) {
+                const double *v = values + ((size_t)r * TIMING_VALUES) + (t * STAGE_COUNT + s) * TIMING_FIELDS;
+                if (v[1] == 0.0) {
+                    continue;
+                }
+                // counters only when every call read them: partial sums would mislead
+                int counted = (v[2] == v[1]);
+                if (format == TIMING_JSON) {
+                    fprintf(file, "%s\n    {\"rank\": %d, \"thread\": %d, \"stage\": \"%s\", "
+                            "\"seconds\": %.6f, \"calls\": %.0f",
+                            first ? "" : ",", r, t, stage_names[s], v[0], v[1]);
+                    for (int c = 0; c < COUNTER_COUNT && counted; c++) {
+                        fprintf(file, ", \"%s\": %.0f", counter_names[c], v[3 + c]);
+                    }
+                    fprintf(file, "}");
+                } else {
+                    fprintf(file, "%s,%dx%d,%d,%d,%d,%s,%.6f,%.0f", binary, mask_size, mask_size,
+                            ranks, r, t, stage_names[s], v[0], v[1]);
+                    for (int c = 0; c < COUNTER_COUNT; c++) {
+                        if (counted) {
+                            fprintf(file, ",%.0f", v[3 + c]);
+                        } else {
+                            fprintf(file, ",");
+                        }
+                    }
+                    fprintf(file, "\n");
+                }
+                first = 0;
+            }
+        }
+    }
+
+    if (format == TIMING_JSON) {
+        fprintf(file, "\n  ]\n}\n");
+    }
+    fclose(file);
+    return 0;
+}
+
+int timing_requested(const Options *opts, int verbose) {
+    if (opts->timing == TIMING_NONE) {
+        return 0;
+    }
+    if (!TIMING_ENABLED) {
+        if (verbose) {
+            printf("Aviso: --timing requer compilação com make TIMING=1 (make clean antes)\n");
+        }
+        return 0;
+    }
+    return 1;
+}
+
+void timing_finish(const Options *opts, const char *binary, int mask_size) {
+    if (!timing_requested(opts, 1)) {
+        return;
+    }
+    double *values = (double*)malloc(sizeof(double) * TIMING_VALUES);
+    char path[256];
+    timing_export(values);
+    timing_path(path, sizeof(path), binary, mask_size, opts->timing);
+    if (timing_write(path, opts->timing, binary, mask_size, 1, values) == 0) {
+        printf("Tempos por etapa: %s\n", path);
+    }
+    free(values);
+}
@@ -1,5 +1,8 @@
 #!/bin/bash
 # ./test_performance.sh <arquivo_entrada>
+# STAGE_TIMING=1 ./test_performance.sh <arquivo_entrada> também salva os
+# tempos por etapa de cada execução em stage_metrics.csv (make TIMING=1);
+# com COUNTERS=1, também os contadores de hardware de cada etapa
 
 if [ $# -ne 1 ]; then
     echo "Uso: $0 <arquivo_entrada>"
@@ -10,10 +13,21 @@ fi
 INPUT_FILE=$1
 OUTPUT_DIR="output"
 CSV_FILE="performance_metrics.csv"
+STAGE_CSV_FILE="stage_metrics.csv"
+TIMING_ARGS=""
 
 # Limpa arquivo CSV anterior
 > $CSV_FILE
 
+# Tempos por etapa: cada execução escreve output/<modelo>_<máscara>_timing.csv
+if [ "$STAGE_TIMING" = "1" ]; then
+    TIMING_ARGS="--timing=csv"
+    if [ "$COUNTERS" = "1" ]; then
+        TIMING_ARGS="$TIMING_ARGS --counters=hw"
+    fi
+    echo "Modelo,Máscara,Processos,Processo,Thread,Etapa,Tempo (s),Chamadas,Ciclos,Instruções,Falhas LLC,Falhas de desvio" > $STAGE_CSV_FILE
+fi
+
 # Cabeçalho CSV
 echo "Modelo,Máscara,Tarefas,Tempo Médio (s)" >> $CSV_FILE
 
@@ -62,6 +76,24 @@ capture_time() {
     return 0
 }
 
+# Acrescenta os tempos por etapa da última execução ao STAGE_CSV_FILE
+# Parâmetros: modelo, máscara
+append_stage_times() {
+    if [ -z "$TIMING_ARGS" ]; then
+        return
+    fi
+    local binary
+    case $1 in
+        Sequencial) binary="sequential" ;;
+        MPI) binary="mpi" ;;
+        OpenMP) binary="openmp" ;;
+    esac
+    local timing_file="$OUTPUT_DIR/${binary}_${2}_timing.csv"
+    if [ -f "$timing_file" ]; then
+        tail -n +2 "$timing_file" >> $STAGE_CSV_FILE
+    fi
+}
+
 # Função para executar múltiplas vezes e calcular média
 # Parâmetros: comando, modelo, máscara, tarefas, num_executions
 run_and_average() {
@@ -88,6 +120,7 @@ run_and_average() {
             sum=$(echo "$sum + $time_value" | bc -l)
             valid_executions=$((valid_executions + 1))
             echo "    Execução $valid_executions/$num_executions: $time_value segundos" >&2
+            append_stage_times "$model" "$mask"
         else
             echo "    Tentando novamente..." >&2
         fi
@@ -129,7 +162,7 @@ run_and_average() {
 echo "Testando versão sequencial..."
 
 for mask in 3 5 7; do
-    cmd="./bin/sequential $mask $INPUT_FILE"
+    cmd="./bin/sequential $mask $INPUT_FILE $TIMING_ARGS"
     avg_time=$(run_and_average "$cmd" "Sequencial" "$mask" "-" 5)
     echo "Sequencial,${mask}x${mask},-,${avg_time}" >> $CSV_FILE
 done
@@ -141,7 +174,7 @@ echo "Testando versão MPI..."
 
 for mask in 3 5 7; do
     for procs in 1 2 3 4; do
-        cmd="mpirun -np $procs ./bin/mpi_version $mask $INPUT_FILE"
+        cmd="mpirun -np $procs ./bin/mpi_version $mask $INPUT_FILE $TIMING_ARGS"
         avg_time=$(run_and_average "$cmd" "MPI" "$mask" "$procs" 5)
         echo "MPI,${mask}x${mask},${procs},${avg_time}" >> $CSV_FILE
     done
@@ -154,7 +187,7 @@ echo "Testando versão OpenMP..."
 
 for mask in 3 5 7; do
     for threads in 1 2 3 4; do
-        cmd="./bin/openmp_version $mask $threads $INPUT_FILE"
+        cmd="./bin/openmp_version $mask $threads $INPUT_FILE $TIMING_ARGS"
         avg_time=$(run_and_average "$cmd" "OpenMP" "$mask" "$threads" 5)
         echo "OpenMP,${mask}x${mask},${threads},${avg_time}" >> $CSV_FILE
     done
@@ -163,6 +196,9 @@ done
 echo ""
 echo "Benchmark concluído!"
 echo "Resultados salvos em: $CSV_FILE"
+if [ -n "$TIMING_ARGS" ]; then
+    echo "Tempos por etapa salvos em: $STAGE_CSV_FILE"
+fi
 echo ""
 echo "=== VISUALIZAÇÃO FORMATADA DO CSV ==="
 column -t -s',' $CSV_FILE